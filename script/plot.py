@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 
 import matplotlib.pyplot as plt
+import math
 import struct
 import argparse
 
@@ -14,10 +15,17 @@ class Parser:
         self.accuracy_train = []
         self.costs_test = []
         self.accuracy_test = []
+        # per phase: {"total": [...], "p50": [...], "p99": [...]}
+        self.phases = {}
+        self.samples_per_second = []
+        self.evaluation_time = []
 
     def parse_file(self, filename):
         with open(filename, "rb") as file:
             content = file.read()
+            if content[:8] == TRACE_MAGIC:
+                self.parse_records(content)
+                return
             self.nb_epochs, self.minibatch_size, self.learning_rate =\
                 struct.unpack("<QQf", content[:8 + 8 + 4])
 
@@ -27,34 +35,104 @@ class Parser:
             print(len(content[8 + 8 + 4:]))
             it = struct.iter_unpack("<f", content[8 + 8 + 4:])
 
-            self.costs_train = [next(it) for _ in range(self.nb_epochs)]
-            self.accuracy_train = [next(it) for _ in range(self.nb_epochs)]
-            self.costs_test = [next(it) for _ in range(self.nb_epochs)]
-            self.accuracy_test = [next(it) for _ in range(self.nb_epochs)]
-
-
-def plot(filename):
-    fig, ax = plt.subplots(2, 1, squeeze=False)
+            self.costs_train = [next(it)[0] for _ in range(self.nb_epochs)]
+            self.accuracy_train = [next(it)[0] for _ in range(self.nb_epochs)]
+            self.costs_test = [next(it)[0] for _ in range(self.nb_epochs)]
+            self.accuracy_test = [next(it)[0] for _ in range(self.nb_epochs)]
+
+    # versioned trace file: header, names of the fields and records
+    def parse_records(self, content):
+        version, nb_fields, self.nb_epochs, self.minibatch_size,\
+            self.learning_rate, _ = struct.unpack("<IIQQfI", content[8:40])
+        assert version == 1, f"unknown trace version {version}"
+        offset = 40
+        names = []
+        for _ in range(nb_fields):
+            size, = struct.unpack("<I", content[offset:offset + 4])
+            names.append(content[offset + 4:offset + 4 + size].decode())
+            offset += 4 + size
+
+        # the epochs that are not traced are NaN, the last record may be
+        # incomplete when the file is read during the run
+        fields = {name: [math.nan] * self.nb_epochs for name in names}
+        record_size = 8 + 4 * nb_fields
+        while offset + record_size <= len(content):
+            epoch, = struct.unpack("<Q", content[offset:offset + 8])
+            values = struct.unpack(f"<{nb_fields}f",
+                                   content[offset + 8:offset + record_size])
+            for name, value in zip(names, values):
+                fields[name][epoch] = value
+            offset += record_size
+
+        missing = [math.nan] * self.nb_epochs
+        self.costs_train = fields.get("cost_train", missing)
+        self.accuracy_train = fields.get("accuracy_train", missing)
+        self.costs_test = fields.get("cost_test", missing)
+        self.accuracy_test = fields.get("accuracy_test", missing)
+        self.phases = {
+            name: {stat: fields[f"{name}_{stat}"]
+                   for stat in ("total", "p50", "p99")}
+            for name in PHASES if f"{name}_total" in fields
+        }
+        self.samples_per_second = fields.get("samples_per_second", missing)
+        self.evaluation_time = fields.get("evaluation_time", missing)
+
+
+# phases of the training steps (fields <phase>_total, _p50 and _p99)
+PHASES = ["data", "forward", "backward", "optimizer"]
+
+TRACE_MAGIC = b"NNTRACE\0"
+
+
+# the epochs that are not traced are NaN
+def traced(values):
+    epochs = [i for i, v in enumerate(values) if not math.isnan(v)]
+    return epochs, [values[i] for i in epochs]
+
+
+def plot(filename, watch=0):
     parser = Parser()
 
     parser.parse_file(filename)
+    fig, ax = plt.subplots(3 if parser.phases else 2, 1, squeeze=False)
+    while watch > 0:
+        # redraw the file written by a running training
+        draw(fig, ax, parser)
+        plt.pause(watch)
+        parser = Parser()
+        parser.parse_file(filename)
+        for a in ax.flat:
+            a.clear()
+    draw(fig, ax, parser)
+    plt.show()
+
+
+def draw(fig, ax, parser):
 
     ax[0, 0].set_title("Evolution of the cost per epochs")
-    ax[0, 0].plot(parser.costs_train, label="train")
-    ax[0, 0].plot(parser.costs_test, label="test")
+    ax[0, 0].plot(*traced(parser.costs_train), label="train")
+    ax[0, 0].plot(*traced(parser.costs_test), label="test")
     ax[0, 0].set_xlabel("epochs")
     ax[0, 0].set_ylabel("cost")
     ax[0, 0].legend()
 
     ax[1, 0].set_title("Evolution of the accuracy per epochs")
-    ax[1, 0].plot(parser.accuracy_train, label="train")
-    ax[1, 0].plot(parser.accuracy_test, label="test")
+    ax[1, 0].plot(*traced(parser.accuracy_train), label="train")
+    ax[1, 0].plot(*traced(parser.accuracy_test), label="test")
     ax[1, 0].set_xlabel("epochs")
     ax[1, 0].set_ylabel("accuracy (%)")
     ax[1, 0].legend()
 
+    if parser.phases:
+        ax[2, 0].set_title("Time of the phases between the traced epochs")
+        for name, stats in parser.phases.items():
+            ax[2, 0].plot(*traced(stats["total"]), label=name)
+        ax[2, 0].plot(*traced(parser.evaluation_time), label="evaluation")
+        ax[2, 0].set_xlabel("epochs")
+        ax[2, 0].set_ylabel("time (s)")
+        ax[2, 0].legend()
+
     fig.suptitle(f"epochs = {parser.nb_epochs}, minibatch_size = {parser.minibatch_size}, learning_rate = {parser.learning_rate}")
-    plt.show()
 
 
 def plot_adam_sgd(files):
@@ -76,8 +154,8 @@ def plot_adam_sgd(files):
         parser.parse_file(elements[0])
         label = elements[-1]
 
-        ax[0, 0].plot(parser.costs_test, label=label)
-        ax[1, 0].plot(parser.accuracy_test, label=label)
+        ax[0, 0].plot(*traced(parser.costs_test), label=label)
+        ax[1, 0].plot(*traced(parser.accuracy_test), label=label)
         fig.suptitle(f"epochs = {parser.nb_epochs}, minibatch_size = {parser.minibatch_size}, learning_rate = {parser.learning_rate}")
 
     plt.show()
@@ -86,6 +164,8 @@ def plot_adam_sgd(files):
 def parse_args():
     parser = argparse.ArgumentParser("plot")
     parser.add_argument("files", nargs="+")
+    parser.add_argument("--watch", type=float, default=0,
+                        help="reload the file every WATCH seconds")
     return parser.parse_args()
 
 
@@ -94,7 +174,7 @@ def main():
     if len(args.files) > 1:
         plot_adam_sgd(args.files)
     else:
-        plot(args.files[0])
+        plot(args.files[0], args.watch)
 
 
 if __name__ == "__main__":
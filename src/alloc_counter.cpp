@@ -0,0 +1,45 @@
+#include "alloc_counter.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> alloc_count = 0;
+static std::atomic<size_t> alloc_bytes = 0;
+
+size_t AllocCounter::count() { return alloc_count.load(); }
+size_t AllocCounter::bytes() { return alloc_bytes.load(); }
+
+static void *counted_alloc(size_t size, size_t alignment) {
+    void *ptr = nullptr;
+
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (size == 0) {
+        size = 1;
+    }
+    if (alignment <= alignof(std::max_align_t)) {
+        ptr = std::malloc(size);
+    } else {
+        size = (size + alignment - 1) / alignment * alignment;
+        ptr = std::aligned_alloc(alignment, size);
+    }
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new(size_t size) {
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    return counted_alloc(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
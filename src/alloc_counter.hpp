@@ -0,0 +1,14 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+#include <cstddef>
+
+/*
+ * Count the calls to the global operator new. This is used to check that the
+ * training loop does not allocate once the workspace is warm.
+ */
+struct AllocCounter {
+    static size_t count();
+    static size_t bytes();
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "allocator.hpp"
+#include <algorithm>
+#include <bit>
+#include <new>
+
+/******************************************************************************/
+/*                                 allocator                                  */
+/******************************************************************************/
+
+AllocatorStats Allocator::stats() const {
+    return AllocatorStats{nb_allocations_.load(), nb_reused_.load(),
+                          nb_system_.load(),      bytes_in_use_.load(),
+                          peak_bytes_in_use_.load(), bytes_cached_.load()};
+}
+
+void Allocator::record_allocation(size_t bytes, bool reused) {
+    nb_allocations_.fetch_add(1, std::memory_order_relaxed);
+    (reused ? nb_reused_ : nb_system_).fetch_add(1, std::memory_order_relaxed);
+    size_t in_use =
+        bytes_in_use_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_bytes_in_use_.load(std::memory_order_relaxed);
+    while (in_use > peak && !peak_bytes_in_use_.compare_exchange_weak(
+                                peak, in_use, std::memory_order_relaxed)) {
+    }
+}
+
+void Allocator::record_deallocation(size_t bytes) {
+    bytes_in_use_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void Allocator::record_cache(size_t bytes_added, size_t bytes_removed) {
+    bytes_cached_.fetch_add(bytes_added, std::memory_order_relaxed);
+    bytes_cached_.fetch_sub(bytes_removed, std::memory_order_relaxed);
+}
+
+static void *system_allocate(size_t bytes) {
+    return ::operator new(bytes, std::align_val_t(Allocator::ALIGNMENT));
+}
+
+static void system_deallocate(void *ptr) {
+    ::operator delete(ptr, std::align_val_t(Allocator::ALIGNMENT));
+}
+
+/******************************************************************************/
+/*                             aligned allocator                              */
+/******************************************************************************/
+
+void *AlignedAllocator::allocate(size_t bytes) {
+    record_allocation(bytes, false);
+    return system_allocate(bytes);
+}
+
+void AlignedAllocator::deallocate(void *ptr, size_t bytes) {
+    if (ptr == nullptr) {
+        return;
+    }
+    record_deallocation(bytes);
+    system_deallocate(ptr);
+}
+
+/******************************************************************************/
+/*                               pool allocator                               */
+/******************************************************************************/
+
+// The free lists are intrusive: the first bytes of a free buffer hold the
+// pointer to the next one, so the pool never allocates for itself.
+struct FreeBuffer {
+    FreeBuffer *next;
+};
+
+struct ThreadCache {
+    FreeBuffer *free[PoolAllocator::NB_CLASSES] = {};
+    size_t bytes = 0;
+
+    ~ThreadCache();
+};
+
+// The cache of the main thread is destroyed before the global objects, which
+// may still free buffers: they then go directly to the system.
+static thread_local bool cache_destroyed = false;
+static thread_local ThreadCache cache;
+
+ThreadCache::~ThreadCache() {
+    PoolAllocator::instance().trim();
+    cache_destroyed = true;
+}
+
+static size_t size_class(size_t bytes) {
+    size_t lines = (bytes + Allocator::ALIGNMENT - 1) / Allocator::ALIGNMENT;
+    return std::bit_width(std::max<size_t>(lines, 1) - 1);
+}
+
+static size_t class_bytes(size_t c) { return Allocator::ALIGNMENT << c; }
+
+void *PoolAllocator::allocate(size_t bytes) {
+    size_t c = size_class(bytes);
+
+    if (c >= NB_CLASSES) {
+        record_allocation(bytes, false);
+        return system_allocate(bytes);
+    }
+    if (!cache_destroyed && cache.free[c] != nullptr) {
+        FreeBuffer *buffer = cache.free[c];
+        cache.free[c] = buffer->next;
+        cache.bytes -= class_bytes(c);
+        record_cache(0, class_bytes(c));
+        record_allocation(class_bytes(c), true);
+        return buffer;
+    }
+    record_allocation(class_bytes(c), false);
+    return system_allocate(class_bytes(c));
+}
+
+void PoolAllocator::deallocate(void *ptr, size_t bytes) {
+    if (ptr == nullptr) {
+        return;
+    }
+    size_t c = size_class(bytes);
+
+    if (c >= NB_CLASSES) {
+        record_deallocation(bytes);
+        system_deallocate(ptr);
+        return;
+    }
+    record_deallocation(class_bytes(c));
+    if (cache_destroyed || cache.bytes + class_bytes(c) > MAX_CACHED_BYTES) {
+        system_deallocate(ptr);
+        return;
+    }
+    FreeBuffer *buffer = static_cast<FreeBuffer *>(ptr);
+    buffer->next = cache.free[c];
+    cache.free[c] = buffer;
+    cache.bytes += class_bytes(c);
+    record_cache(class_bytes(c), 0);
+}
+
+void PoolAllocator::trim() {
+    if (cache_destroyed) {
+        return;
+    }
+    for (size_t c = 0; c < NB_CLASSES; ++c) {
+        while (cache.free[c] != nullptr) {
+            FreeBuffer *buffer = cache.free[c];
+            cache.free[c] = buffer->next;
+            system_deallocate(buffer);
+        }
+    }
+    record_cache(0, cache.bytes);
+    cache.bytes = 0;
+}
+
+/******************************************************************************/
+/*                             default allocator                              */
+/******************************************************************************/
+
+// Constant initialized, so it outlives the global matrices of every
+// translation unit.
+constinit PoolAllocator PoolAllocator::instance_;
+constinit static std::atomic<Allocator *> current_allocator =
+    &PoolAllocator::instance();
+
+Allocator *default_allocator() {
+    return current_allocator.load(std::memory_order_relaxed);
+}
+
+void default_allocator(Allocator *allocator) {
+    current_allocator.store(allocator ? allocator : &PoolAllocator::instance(),
+                            std::memory_order_relaxed);
+}
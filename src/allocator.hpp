@@ -0,0 +1,96 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+#include <atomic>
+#include <cstddef>
+
+struct AllocatorStats {
+    size_t nb_allocations = 0;
+    size_t nb_reused = 0; // allocations served from a free list
+    size_t nb_system = 0; // allocations that reached the system allocator
+    size_t bytes_in_use = 0;
+    size_t peak_bytes_in_use = 0;
+    size_t bytes_cached = 0; // freed buffers kept for reuse
+};
+
+/*
+ * Allocator of the memory of the matrices and vectors. The memory is always
+ * aligned on ALIGNMENT bytes, and must be released with the allocator that
+ * returned it (Matrix and Vector keep a pointer to their allocator).
+ */
+class Allocator {
+  public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    constexpr Allocator() = default;
+    virtual ~Allocator() = default;
+
+    Allocator(Allocator const &) = delete;
+    Allocator const &operator=(Allocator const &) = delete;
+
+  public:
+    virtual void *allocate(size_t bytes) = 0;
+    virtual void deallocate(void *ptr, size_t bytes) = 0;
+
+    AllocatorStats stats() const;
+
+  protected:
+    void record_allocation(size_t bytes, bool reused);
+    void record_deallocation(size_t bytes);
+    void record_cache(size_t bytes_added, size_t bytes_removed);
+
+  private:
+    std::atomic<size_t> nb_allocations_ = 0;
+    std::atomic<size_t> nb_reused_ = 0;
+    std::atomic<size_t> nb_system_ = 0;
+    std::atomic<size_t> bytes_in_use_ = 0;
+    std::atomic<size_t> peak_bytes_in_use_ = 0;
+    std::atomic<size_t> bytes_cached_ = 0;
+};
+
+/* Aligned operator new / delete, without any caching. */
+class AlignedAllocator final : public Allocator {
+  public:
+    constexpr AlignedAllocator() = default;
+
+    void *allocate(size_t bytes) override;
+    void deallocate(void *ptr, size_t bytes) override;
+};
+
+/*
+ * Size class pool. The sizes are rounded up to a power of two (from 64 B to
+ * 1 MiB) and the freed buffers are kept in thread local free lists, one per
+ * class, so the temporaries of the few shapes used by a model are recycled
+ * without reaching the global heap and without locks. Larger buffers are not
+ * pooled: their allocation is rare next to their use, and rounding them up
+ * would waste up to half of their memory. A thread keeps at most
+ * MAX_CACHED_BYTES, its cache is released when it exits, and the long lived
+ * threads (pool workers, prefetch producers) trim it when they finish. A
+ * buffer can be freed by another thread than the one that allocated it (it
+ * then goes to the cache of the freeing thread). The caches are per thread,
+ * so there is a single pool.
+ */
+class PoolAllocator final : public Allocator {
+  public:
+    static constexpr size_t NB_CLASSES = 15;
+    static constexpr size_t MAX_CACHED_BYTES = size_t(8) << 20;
+
+    static constexpr PoolAllocator &instance() { return instance_; }
+
+    void *allocate(size_t bytes) override;
+    void deallocate(void *ptr, size_t bytes) override;
+
+    /* release the buffers cached by the calling thread */
+    void trim();
+
+  private:
+    constexpr PoolAllocator() = default;
+
+    static PoolAllocator instance_;
+};
+
+/* Allocator used by the new matrices and vectors (the pool by default). The
+ * setter only affects the following allocations, nullptr restores the pool. */
+Allocator *default_allocator();
+void default_allocator(Allocator *allocator);
+
+#endif
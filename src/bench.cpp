@@ -0,0 +1,579 @@
+#include "functions.hpp"
+#include "inference.hpp"
+#include "kernels.hpp"
+#include "math.hpp"
+#include "minibatch_generator.hpp"
+#include "mnist/minist_loader.hpp"
+#include "model.hpp"
+#include "thread_budget.hpp"
+#include "trainer.hpp"
+#include "workspace.hpp"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Microbenchmarks of the numeric hot paths. Every benchmark runs a sweep of
+ * layer widths, depths and batch sizes, and reports the time per operation,
+ * the throughput in GFLOP/s and the bandwidth in bytes/s (computed from the
+ * minimal number of flops and bytes of the operation) as JSON:
+ *
+ *     nn-bench [--quick] [--filter name] [--min-time seconds] [--out path]
+ *              [--gemm openblas|native]
+ *
+ * The models have NB_INPUTS inputs (an MNIST image), depth hidden layers of
+ * width nodes and NB_OUTPUTS outputs. --gemm selects the backend of the
+ * products of the other benchmarks, the gemm_ and gemv_ benchmarks run the
+ * shapes of the layers on every available backend.
+ */
+
+constexpr size_t NB_INPUTS = 28 * 28;
+constexpr size_t NB_OUTPUTS = 10;
+
+struct Options {
+    bool quick = false;
+    std::string filter = {};
+    double min_time = 0.05; // seconds per measure
+    std::string out = {};
+};
+
+struct Config {
+    size_t width = 0;
+    size_t depth = 0;
+    size_t batch = 0;
+};
+
+struct Result {
+    std::string name;
+    Config config;
+    size_t iterations;
+    double ns_per_op;
+    double flops; // per operation
+    double bytes; // per operation
+};
+
+// prevent the compiler from removing the computation of value
+template <typename T>
+void keep(T const &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+class Bench {
+  public:
+    explicit Bench(Options const &options) : options_(options) {}
+
+    bool enabled(std::string const &name) const {
+        return name.find(options_.filter) != std::string::npos;
+    }
+
+    /* The number of iterations is doubled until a run lasts min_time / 4,
+     * the time per operation is the best of 4 runs. */
+    template <typename F>
+    void run(std::string const &name, Config const &config, double flops,
+             double bytes, F &&op) {
+        size_t iterations = 1;
+        double best = 0;
+
+        op(); // warm up
+        while (time(op, iterations) < options_.min_time / 4 &&
+               iterations < (size_t(1) << 30)) {
+            iterations *= 2;
+        }
+        for (size_t r = 0; r < 4; ++r) {
+            double t = time(op, iterations) / iterations;
+            best = r == 0 ? t : std::min(best, t);
+        }
+        results_.push_back(
+            Result{name, config, iterations, best * 1e9, flops, bytes});
+        std::cerr << name << " width=" << config.width
+                  << " depth=" << config.depth << " batch=" << config.batch
+                  << ": " << best * 1e9 << " ns/op" << std::endl;
+    }
+
+    void write_json(std::ostream &os) const {
+        os << "{\n  \"simd\": \"" << simd_level_name(simd_level())
+           << "\",\n  \"gemm\": \"" << gemm_backend_name(gemm_backend())
+           << "\",\n  \"threads\": " << ThreadBudget::budget()
+           << ",\n  \"ftype_size\": " << sizeof(ftype)
+           << ",\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results_.size(); ++i) {
+            Result const &r = results_[i];
+            double seconds = r.ns_per_op * 1e-9;
+            os << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << r.name
+               << "\", \"width\": " << r.config.width
+               << ", \"depth\": " << r.config.depth
+               << ", \"batch\": " << r.config.batch
+               << ", \"iterations\": " << r.iterations
+               << ", \"ns_per_op\": " << r.ns_per_op
+               << ", \"gflops\": " << r.flops / seconds * 1e-9
+               << ", \"bytes_per_second\": " << r.bytes / seconds << "}";
+        }
+        os << "\n  ]\n}" << std::endl;
+    }
+
+  private:
+    Options options_;
+    std::vector<Result> results_ = {};
+
+    template <typename F>
+    static double time(F &op, size_t iterations) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+};
+
+/******************************************************************************/
+/*                                  helpers                                   */
+/******************************************************************************/
+
+Model create_model(Config const &config) {
+    Model m;
+
+    m.input(NB_INPUTS);
+    for (size_t l = 0; l < config.depth; ++l) {
+        m.add_layer(config.width);
+    }
+    m.add_layer(NB_OUTPUTS);
+    m.init(0);
+    return m;
+}
+
+DataSet create_dataset(size_t size) {
+    DataSet ds = DataSet::with_labels(size, NB_INPUTS, NB_OUTPUTS);
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<ftype> dist(0, 1);
+
+    for (size_t i = 0; i < size; ++i) {
+        for (auto &x : ds.input(i)) {
+            x = dist(gen);
+        }
+        ds.label(i, gen() % NB_OUTPUTS);
+    }
+    return ds;
+}
+
+Vector random_vector(size_t size) {
+    Vector v(size);
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<ftype> dist(-1, 1);
+
+    for (size_t i = 0; i < size; ++i) {
+        v[i] = dist(gen);
+    }
+    return v;
+}
+
+Matrix random_matrix(size_t rows, size_t cols) {
+    Matrix m(rows, cols);
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<ftype> dist(-1, 1);
+
+    for (size_t i = 0; i < rows * cols; ++i) {
+        m.mem[i] = dist(gen);
+    }
+    return m;
+}
+
+// multiply-adds of the weights of the model for one sample
+double nb_weights(Model const &m) {
+    double result = 0;
+
+    for (auto const &layer : m.layers) {
+        result += layer.nb_nodes * layer.nb_inputs;
+    }
+    return result;
+}
+
+// the errors are not propagated to the inputs
+double backward_flops(Model const &m) {
+    return 2 * (2 * nb_weights(m) - m.layers[0].nb_nodes * NB_INPUTS);
+}
+
+void write_idx(std::string const &path, std::vector<uint32_t> const &dims,
+               std::vector<uint8_t> const &data) {
+    std::ofstream fs(path, std::ios::binary);
+
+    fs.put(0).put(0).put(0x08).put(char(dims.size()));
+    for (uint32_t dim : dims) {
+        fs.put(dim >> 24).put(dim >> 16).put(dim >> 8).put(dim);
+    }
+    fs.write(reinterpret_cast<char const *>(data.data()), data.size());
+}
+
+/******************************************************************************/
+/*                                 benchmarks                                 */
+/******************************************************************************/
+
+using BenchTrainer = BasicTrainer<QuadraticLoss, Sigmoid, SGD>;
+
+void bench_layers(Bench &bench, std::vector<Config> const &configs) {
+    QuadraticLoss cost;
+    Sigmoid sigmoid;
+    SGD sgd;
+
+    for (Config const &config : configs) {
+        Model m = create_model(config);
+        BenchTrainer t(&m, &cost, &sigmoid, &sgd);
+        DataSet ds = create_dataset(config.batch);
+        double weights_bytes = m.parameters().size() * sizeof(ftype);
+        double flops = 2 * nb_weights(m) * config.batch;
+
+        if (config.batch == 1) {
+            Layer const &layer = m.layers[0];
+            Vector x = random_vector(NB_INPUTS);
+            Vector y(NB_OUTPUTS);
+            y[0] = 1;
+            auto [as, zs] = t.feedforward(x);
+
+            if (bench.enabled("compute_z")) {
+                bench.run("compute_z", config, 2. * config.width * NB_INPUTS,
+                          (layer.nb_nodes * (NB_INPUTS + 2.) + NB_INPUTS) *
+                              sizeof(ftype),
+                          [&]() { keep(t.compute_z(layer, x)); });
+            }
+            if (bench.enabled("feedforward")) {
+                bench.run("feedforward", config, flops, weights_bytes,
+                          [&]() { keep(t.feedforward(x)); });
+            }
+            if (bench.enabled("backpropagate")) {
+                bench.run("backpropagate", config, backward_flops(m),
+                          2 * weights_bytes,
+                          [&]() { keep(t.backpropagate(y, as, zs)); });
+            }
+        }
+
+        TrainingWorkspace ws(m, config.batch);
+        MinibatchGenerator minibatch(ds, config.batch, 0);
+        double data_bytes = config.batch * NB_INPUTS * sizeof(ftype);
+
+        minibatch.generate();
+        minibatch.pack(ws.inputs(), ws.ground_truths);
+        if (bench.enabled("compute_z_batch")) {
+            Layer const &layer = m.layers[0];
+            bench.run("compute_z_batch", config,
+                      2. * config.width * NB_INPUTS * config.batch,
+                      layer.nb_nodes * NB_INPUTS * sizeof(ftype) + data_bytes,
+                      [&]() { t.compute_z(layer, ws.as[0], ws.zs[0]); });
+        }
+        if (bench.enabled("feedforward_batch")) {
+            bench.run("feedforward_batch", config, flops,
+                      weights_bytes + data_bytes,
+                      [&]() { t.feedforward(ws); });
+        }
+        if (bench.enabled("backpropagate_batch")) {
+            t.feedforward(ws);
+            bench.run("backpropagate_batch", config,
+                      backward_flops(m) * config.batch, 3 * weights_bytes,
+                      [&]() { t.backpropagate(ws); });
+        }
+        if (bench.enabled("update_minibatch")) {
+            // forward, backward and update of the parameters
+            bench.run("update_minibatch", config,
+                      flops + backward_flops(m) * config.batch +
+                          2 * m.parameters().size(),
+                      5 * weights_bytes + data_bytes,
+                      [&]() { t.update_minibatch(minibatch, 0.01); });
+        }
+
+        // inference with the fp32 weights and with their 16 bits copies
+        for (Precision precision :
+             {Precision::FP32, Precision::BF16, Precision::FP16}) {
+            std::string name =
+                std::string("inference/") + precision_name(precision);
+            if (!bench.enabled(name)) {
+                continue;
+            }
+            Model half = m;
+            half.half_precision(precision);
+            InferenceSession session(&half, &sigmoid, config.batch);
+            size_t weight_size = precision == Precision::FP32
+                                     ? sizeof(ftype)
+                                     : sizeof(uint16_t);
+            bench.run(name, config, flops,
+                      nb_weights(m) * weight_size + data_bytes, [&]() {
+                          keep(session.predict_batch(ds, 0, config.batch));
+                      });
+        }
+    }
+}
+
+void bench_optimizers(Bench &bench, std::vector<Config> const &configs) {
+    for (Config const &config : configs) {
+        if (config.batch != 1) {
+            continue;
+        }
+        Model m = create_model(config);
+        Parameters grads = Parameters::zeros_like(m.parameters());
+        double size = m.parameters().size();
+        SGD sgd;
+        Adam adam;
+
+        grads.fill(1e-3);
+        if (bench.enabled("sgd")) {
+            // read the gradients, read and write the parameters
+            bench.run("sgd", config, 2 * size, 3 * size * sizeof(ftype),
+                      [&]() { sgd.execute(&m, grads, 1e-3); });
+        }
+        if (bench.enabled("adam")) {
+            // m, v and the parameters are read and written
+            bench.run("adam", config, 12 * size, 7 * size * sizeof(ftype),
+                      [&]() { adam.execute(&m, grads, 1e-3); });
+        }
+    }
+}
+
+void bench_math(Bench &bench, std::vector<Config> const &configs) {
+    for (Config const &config : configs) {
+        if (config.depth != 1) {
+            continue;
+        }
+        size_t n = config.width, b = config.batch;
+        Matrix w = random_matrix(n, NB_INPUTS);
+        Matrix errs = random_matrix(n, b), as = random_matrix(NB_INPUTS, b);
+        Matrix errs_in(NB_INPUTS, b), grads(n, NB_INPUTS);
+        Matrix zs = random_matrix(n, b), ones(n, b);
+
+        if (bench.enabled("matmul_wT_errs")) {
+            bench.run("matmul_wT_errs", config, 2. * n * NB_INPUTS * b,
+                      (n * NB_INPUTS + (n + NB_INPUTS) * b) * sizeof(ftype),
+                      [&]() { matmul(T(w), errs, errs_in); });
+        }
+        if (bench.enabled("matmul_errs_asT")) {
+            bench.run("matmul_errs_asT", config, 2. * n * NB_INPUTS * b,
+                      (n * NB_INPUTS + (n + NB_INPUTS) * b) * sizeof(ftype),
+                      [&]() { matmul(errs, T(as), grads); });
+        }
+        if (bench.enabled("hadamard")) {
+            // zs is multiplied again at each run: by ones, so its values do
+            // not become subnormals
+            std::fill(ones.mem, ones.mem + n * b, 1);
+            bench.run("hadamard", config, n * b, 3. * n * b * sizeof(ftype),
+                      [&]() { hadamard(zs, ones); });
+        }
+        if (b != 1) {
+            continue;
+        }
+        // operators of math.hpp on the weights of a layer
+        Vector v = random_vector(n * NB_INPUTS);
+        Vector u = random_vector(n * NB_INPUTS);
+        Matrix g = random_matrix(n, NB_INPUTS);
+        double size = n * NB_INPUTS;
+
+        if (bench.enabled("vector_add")) {
+            bench.run("vector_add", config, size, 3 * size * sizeof(ftype),
+                      [&]() { v += u; });
+        }
+        if (bench.enabled("vector_sub_scaled")) {
+            bench.run("vector_sub_scaled", config, 2 * size,
+                      3 * size * sizeof(ftype), [&]() { v -= 1e-6 * u; });
+        }
+        if (bench.enabled("vector_div")) {
+            bench.run("vector_div", config, size, 2 * size * sizeof(ftype),
+                      [&]() { v /= 1.0f; });
+        }
+        if (bench.enabled("matrix_add")) {
+            bench.run("matrix_add", config, size, 3 * size * sizeof(ftype),
+                      [&]() { w += g; });
+        }
+        if (bench.enabled("matrix_sub_scaled")) {
+            bench.run("matrix_sub_scaled", config, 2 * size,
+                      3 * size * sizeof(ftype), [&]() { w -= 1e-6 * g; });
+        }
+        if (bench.enabled("matrix_div")) {
+            bench.run("matrix_div", config, size, 2 * size * sizeof(ftype),
+                      [&]() { w /= 1.0f; });
+        }
+    }
+}
+
+// The products of the first layer: forward (W * as), backward (W^T * errs)
+// and gradient (errs * as^T) for the batches, and the two gemv of one sample.
+// The results are named after the backend, e.g. gemm_forward/native.
+void bench_gemm(Bench &bench, std::vector<Config> const &configs) {
+    std::vector<GemmBackend> backends = {GemmBackend::Native};
+    GemmBackend selected = gemm_backend();
+
+#ifdef NN_OPENBLAS
+    backends.insert(backends.begin(), GemmBackend::OpenBLAS);
+#endif
+    for (Config const &config : configs) {
+        if (config.depth != 1) {
+            continue;
+        }
+        size_t n = config.width, b = config.batch;
+        Matrix w = random_matrix(n, NB_INPUTS);
+        Matrix as = random_matrix(NB_INPUTS, b), zs(n, b);
+        Matrix errs = random_matrix(n, b), errs_in(NB_INPUTS, b);
+        Matrix grads(n, NB_INPUTS);
+        double flops = 2. * n * NB_INPUTS * b;
+        double bytes = (n * NB_INPUTS + (n + NB_INPUTS) * b) * sizeof(ftype);
+
+        for (GemmBackend backend : backends) {
+            std::string suffix = std::string("/") + gemm_backend_name(backend);
+            gemm_backend(backend);
+            if (b == 1) {
+                if (bench.enabled("gemv" + suffix)) {
+                    bench.run("gemv" + suffix, config, flops, bytes, [&]() {
+                        gemv<ftype>(CblasNoTrans, n, NB_INPUTS, 1, w.mem,
+                                    NB_INPUTS, as.mem, 1, 0, zs.mem, 1);
+                    });
+                }
+                if (bench.enabled("gemv_trans" + suffix)) {
+                    bench.run("gemv_trans" + suffix, config, flops, bytes,
+                              [&]() {
+                                  gemv<ftype>(CblasTrans, n, NB_INPUTS, 1,
+                                              w.mem, NB_INPUTS, errs.mem, 1,
+                                              0, errs_in.mem, 1);
+                              });
+                }
+                continue;
+            }
+            if (bench.enabled("gemm_forward" + suffix)) {
+                bench.run("gemm_forward" + suffix, config, flops, bytes,
+                          [&]() {
+                              gemm<ftype>(CblasNoTrans, CblasNoTrans, n, b,
+                                          NB_INPUTS, 1, w.mem, NB_INPUTS,
+                                          as.mem, b, 0, zs.mem, b);
+                          });
+            }
+            if (bench.enabled("gemm_backward" + suffix)) {
+                bench.run("gemm_backward" + suffix, config, flops, bytes,
+                          [&]() {
+                              gemm<ftype>(CblasTrans, CblasNoTrans, NB_INPUTS,
+                                          b, n, 1, w.mem, NB_INPUTS, errs.mem,
+                                          b, 0, errs_in.mem, b);
+                          });
+            }
+            if (bench.enabled("gemm_gradient" + suffix)) {
+                bench.run("gemm_gradient" + suffix, config, flops, bytes,
+                          [&]() {
+                              gemm<ftype>(CblasNoTrans, CblasTrans, n,
+                                          NB_INPUTS, b, 1, errs.mem, b, as.mem,
+                                          b, 0, grads.mem, NB_INPUTS);
+                          });
+            }
+        }
+        gemm_backend(selected);
+    }
+}
+
+// load_ds on synthetic MNIST files (mapping and labels), then the
+// normalization of the images
+void bench_loader(Bench &bench, bool quick) {
+    if (!bench.enabled("load_ds") && !bench.enabled("normalized")) {
+        return;
+    }
+    std::string dir = std::filesystem::temp_directory_path();
+    std::string labels_path = dir + "/nn-bench-labels.idx";
+    std::string images_path = dir + "/nn-bench-images.idx";
+    uint32_t size = quick ? 10'000 : 60'000;
+    std::vector<uint8_t> labels(size), pixels(size * NB_INPUTS);
+    std::mt19937 gen(0);
+    Config config = {0, 0, size};
+    MNISTLoader loader;
+    std::streambuf *cout = std::cout.rdbuf(nullptr); // silent loader
+
+    for (auto &label : labels) {
+        label = gen() % NB_OUTPUTS;
+    }
+    for (auto &px : pixels) {
+        px = gen() % 256;
+    }
+    write_idx(labels_path, {size}, labels);
+    write_idx(images_path, {size, 28, 28}, pixels);
+    if (bench.enabled("load_ds")) {
+        bench.run("load_ds", config, 0, size * (NB_INPUTS + 1.), [&]() {
+            keep(loader.load_ds(labels_path, images_path));
+        });
+    }
+    if (bench.enabled("normalized")) {
+        DataSet ds = loader.load_ds(labels_path, images_path);
+        bench.run("normalized", config, size * NB_INPUTS,
+                  size * NB_INPUTS * (1. + sizeof(ftype)),
+                  [&]() { keep(ds.normalized()); });
+    }
+    std::cout.rdbuf(cout);
+    std::filesystem::remove(labels_path);
+    std::filesystem::remove(images_path);
+}
+
+int main(int argc, char **argv) {
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            options.quick = true;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            options.min_time = std::stod(argv[++i]);
+        } else if (arg == "--out" && i + 1 < argc) {
+            options.out = argv[++i];
+        } else if (arg == "--gemm" && i + 1 < argc &&
+                   std::strcmp(argv[i + 1], "native") == 0) {
+            gemm_backend(GemmBackend::Native);
+            ++i;
+#ifdef NN_OPENBLAS
+        } else if (arg == "--gemm" && i + 1 < argc &&
+                   std::strcmp(argv[i + 1], "openblas") == 0) {
+            gemm_backend(GemmBackend::OpenBLAS);
+            ++i;
+#endif
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--quick] [--filter name] [--min-time seconds]"
+                         " [--out path] [--gemm openblas|native]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    std::vector<size_t> widths = {32, 128, 512};
+    std::vector<size_t> depths = {1, 2, 4};
+    std::vector<size_t> batches = {1, 8, 64};
+    std::vector<Config> configs;
+
+    if (options.quick) {
+        widths = {32, 128};
+        depths = {1, 2};
+        batches = {1, 16};
+        options.min_time = std::min(options.min_time, 0.01);
+    }
+    for (size_t width : widths) {
+        for (size_t depth : depths) {
+            for (size_t batch : batches) {
+                configs.push_back({width, depth, batch});
+            }
+        }
+    }
+
+    Bench bench(options);
+    bench_layers(bench, configs);
+    bench_optimizers(bench, configs);
+    bench_math(bench, configs);
+    bench_gemm(bench, configs);
+    bench_loader(bench, options.quick);
+
+    if (options.out.empty()) {
+        bench.write_json(std::cout);
+    } else {
+        std::ofstream fs(options.out);
+        bench.write_json(fs);
+        if (!fs) {
+            std::cerr << "error: can't write " << options.out << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
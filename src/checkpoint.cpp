@@ -0,0 +1,261 @@
+#include "checkpoint.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+constexpr char MAGIC[8] = {'N', 'N', 'C', 'K', 'P', 'T', '\0', '\0'};
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+// bound of the sizes read from a file, before any allocation
+constexpr uint64_t MAX_SIZE = uint64_t(1) << 40;
+
+template <typename T>
+void write(std::ostream &os, T value) {
+    os.write(reinterpret_cast<char const *>(&value), sizeof(value));
+}
+
+template <typename T>
+void write(std::ostream &os, std::span<T const> values) {
+    write<uint64_t>(os, values.size());
+    os.write(reinterpret_cast<char const *>(values.data()),
+             values.size() * sizeof(T));
+}
+
+template <typename T>
+bool read(std::istream &is, T &value) {
+    return bool(is.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+// the values are read in a buffer of the expected size
+template <typename T>
+bool read(std::istream &is, std::span<T> values) {
+    uint64_t size;
+    return read(is, size) && size == values.size() &&
+           is.read(reinterpret_cast<char *>(values.data()),
+                   size * sizeof(T));
+}
+
+template <typename Container>
+bool read_resized(std::istream &is, Container &values) {
+    uint64_t size;
+    if (!read(is, size) || size > MAX_SIZE) {
+        return false;
+    }
+    values.resize(size);
+    return bool(is.read(reinterpret_cast<char *>(values.data()),
+                        size * sizeof(values[0])));
+}
+
+void write_model(std::ostream &os, Model const &model) {
+    write<uint64_t>(os, model.nb_inputs());
+    write<uint64_t>(os, model.layers.size());
+    for (auto const &layer : model.layers) {
+        write<uint64_t>(os, layer.nb_nodes);
+    }
+    write(os, model.parameters().flat());
+}
+
+// the model is rebuilt only when the topology changes
+bool read_model(std::istream &is, Model &model) {
+    uint64_t nb_inputs, nb_layers;
+    std::vector<uint64_t> nb_nodes;
+
+    if (!read(is, nb_inputs) || !read(is, nb_layers) ||
+        nb_layers > MAX_SIZE) {
+        return false;
+    }
+    nb_nodes.resize(nb_layers);
+    for (auto &n : nb_nodes) {
+        if (!read(is, n) || n == 0 || n > MAX_SIZE) {
+            return false;
+        }
+    }
+    bool same = model.nb_inputs() == nb_inputs &&
+                model.layers.size() == nb_layers;
+    for (size_t l = 0; same && l < nb_layers; ++l) {
+        same = model.layers[l].nb_nodes == nb_nodes[l];
+    }
+    if (!same) {
+        model.clear();
+        model.input(nb_inputs);
+        for (auto n : nb_nodes) {
+            model.add_layer(n);
+        }
+    }
+    return read(is, model.parameters().flat());
+}
+
+void write_optimizer(std::ostream &os, OptimizerState const &state) {
+    write(os, std::span<ftype const>(state.values));
+    write<uint64_t>(os, state.buffers.size());
+    for (auto const &buffer : state.buffers) {
+        write(os, buffer.flat());
+    }
+}
+
+bool read_optimizer(std::istream &is, OptimizerState &state,
+                    Model const &model) {
+    uint64_t nb_buffers;
+
+    if (!read_resized(is, state.values) || !read(is, nb_buffers) ||
+        nb_buffers > MAX_SIZE) {
+        return false;
+    }
+    state.buffers.resize(nb_buffers);
+    for (auto &buffer : state.buffers) {
+        if (!buffer.same_layout(model.parameters())) {
+            buffer = Parameters::zeros_like(model.parameters());
+        }
+        if (!read(is, buffer.flat())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void write_minibatch(std::ostream &os, MinibatchGenerator::State const &state) {
+    write<uint64_t>(os, state.batch_size);
+    write<uint64_t>(os, state.nb_epochs);
+    write<uint64_t>(os, state.offset);
+    write<uint64_t>(os, state.count);
+    write(os, std::span<size_t const>(state.indexes));
+    write(os, std::span<char const>(state.rng));
+}
+
+bool read_minibatch(std::istream &is, MinibatchGenerator::State &state) {
+    uint64_t batch_size, nb_epochs, offset, count;
+
+    if (!read(is, batch_size) || !read(is, nb_epochs) || !read(is, offset) ||
+        !read(is, count) || !read_resized(is, state.indexes) ||
+        !read_resized(is, state.rng)) {
+        return false;
+    }
+    state.batch_size = batch_size;
+    state.nb_epochs = nb_epochs;
+    state.offset = offset;
+    state.count = count;
+    return true;
+}
+
+} // namespace
+
+bool save_checkpoint(std::string const &path, Checkpoint const &checkpoint) {
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+
+    if (!file) {
+        std::cerr << "error: can't create checkpoint file " << tmp_path
+                  << std::endl;
+        return false;
+    }
+    file.write(MAGIC, sizeof(MAGIC));
+    write<uint32_t>(file, VERSION);
+    write<uint32_t>(file, sizeof(ftype));
+    write<uint32_t>(file, BYTE_ORDER_MARK);
+    write<uint32_t>(file, 0);
+    write<uint64_t>(file, checkpoint.step);
+    write_model(file, checkpoint.model);
+    write_optimizer(file, checkpoint.optimizer);
+    write_minibatch(file, checkpoint.minibatch);
+    file.close();
+    if (!file) {
+        std::cerr << "error: can't write checkpoint file " << tmp_path
+                  << std::endl;
+        std::filesystem::remove(tmp_path);
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "error: can't rename checkpoint file " << tmp_path
+                  << " to " << path << std::endl;
+        std::filesystem::remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+bool load_checkpoint(std::string const &path, Checkpoint &checkpoint) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    uint32_t version, ftype_size, byte_order, reserved;
+    uint64_t step;
+
+    if (!file) {
+        std::cerr << "error: can't open checkpoint file " << path << std::endl;
+        return false;
+    }
+    if (!file.read(magic, sizeof(magic)) ||
+        memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || !read(file, version) ||
+        version != VERSION || !read(file, ftype_size) ||
+        ftype_size != sizeof(ftype) || !read(file, byte_order) ||
+        byte_order != BYTE_ORDER_MARK || !read(file, reserved) ||
+        !read(file, step) || !read_model(file, checkpoint.model) ||
+        !read_optimizer(file, checkpoint.optimizer, checkpoint.model) ||
+        !read_minibatch(file, checkpoint.minibatch) ||
+        file.peek() != std::ifstream::traits_type::eof()) {
+        std::cerr << "error: invalid checkpoint file " << path << std::endl;
+        return false;
+    }
+    checkpoint.step = step;
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter(std::string path)
+    : path_(std::move(path)), worker_([this]() { work(); }) {}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+void CheckpointWriter::submit() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cv_.wait(lock, [this]() { return !pending_; });
+    pending_ = true;
+    current_ ^= 1;
+    cv_.notify_all();
+}
+
+void CheckpointWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !pending_; });
+}
+
+size_t CheckpointWriter::nb_written() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return nb_written_;
+}
+
+size_t CheckpointWriter::nb_errors() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return nb_errors_;
+}
+
+// The pending snapshot is the one that is not filled by the trainer. The
+// submitted checkpoints are written before stopping.
+void CheckpointWriter::work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+        cv_.wait(lock, [this]() { return pending_ || stopping_; });
+        if (!pending_) {
+            return;
+        }
+        Checkpoint const &checkpoint = snapshots_[current_ ^ 1];
+        lock.unlock();
+        bool saved = save_checkpoint(path_, checkpoint);
+        lock.lock();
+        ++(saved ? nb_written_ : nb_errors_);
+        pending_ = false;
+        cv_.notify_all();
+    }
+}
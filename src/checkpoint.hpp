@@ -0,0 +1,73 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include "functions.hpp"
+#include "minibatch_generator.hpp"
+#include "model.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * State of a minibatch training after step minibatches: the model, the state
+ * of the optimizer and the position of the minibatch generator (with its
+ * random generator). Restarting from a checkpoint gives the same parameters
+ * as the run that was saved.
+ */
+struct Checkpoint {
+    size_t step = 0;
+    Model model = {};
+    OptimizerState optimizer = {};
+    MinibatchGenerator::State minibatch = {};
+};
+
+/* Binary file (native byte order): magic "NNCKPT\0\0", version, size of
+ * ftype, byte order mark and step, then the topology and parameters of the
+ * model, the values and buffers of the optimizer and the state of the
+ * minibatch generator. The file is written to a temporary file renamed at the
+ * end, so the previous checkpoint stays valid until the new one is complete.
+ * Both functions return false on error. */
+bool save_checkpoint(std::string const &path, Checkpoint const &checkpoint);
+bool load_checkpoint(std::string const &path, Checkpoint &checkpoint);
+
+/*
+ * Write the checkpoints in a background thread. The trainer fills snapshot()
+ * and submits it, then the snapshot is written while the training continues
+ * and the next one is filled in the other buffer. submit waits when the
+ * previous checkpoint is still being written, so at most two checkpoints are
+ * in memory. The buffers are reused: filling a snapshot does not allocate the
+ * parameters again.
+ */
+class CheckpointWriter {
+  public:
+    explicit CheckpointWriter(std::string path);
+    ~CheckpointWriter();
+
+    CheckpointWriter(CheckpointWriter const &) = delete;
+    CheckpointWriter &operator=(CheckpointWriter const &) = delete;
+
+  public:
+    Checkpoint &snapshot() { return snapshots_[current_]; }
+    void submit();
+    /* wait until the submitted checkpoints are written */
+    void flush();
+
+    size_t nb_written() const;
+    size_t nb_errors() const;
+
+  private:
+    std::string path_;
+    Checkpoint snapshots_[2] = {};
+    size_t current_ = 0; // filled by the trainer
+    bool pending_ = false; // the other snapshot is being written
+    bool stopping_ = false;
+    size_t nb_written_ = 0;
+    size_t nb_errors_ = 0;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread worker_;
+
+    void work();
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include "dataset.hpp"
+#include "kernels.hpp"
+#include <algorithm>
+#include <cassert>
+
+DataSet DataSet::with_labels(size_t size, size_t nb_inputs,
+                             size_t nb_classes) {
+    DataSet ds;
+
+    assert(nb_classes > 0 && nb_classes - 1 <= UINT16_MAX);
+    ds.storage_ = std::make_shared<Storage>();
+    ds.storage_->inputs = Matrix(size, nb_inputs);
+    ds.storage_->labels.resize(size);
+    ds.storage_->nb_inputs = nb_inputs;
+    ds.storage_->nb_outputs = nb_classes;
+    ds.size_ = size;
+    return ds;
+}
+
+DataSet DataSet::with_targets(size_t size, size_t nb_inputs,
+                              size_t nb_outputs) {
+    DataSet ds;
+
+    ds.storage_ = std::make_shared<Storage>();
+    ds.storage_->inputs = Matrix(size, nb_inputs);
+    ds.storage_->targets = Matrix(size, nb_outputs);
+    ds.storage_->nb_inputs = nb_inputs;
+    ds.storage_->nb_outputs = nb_outputs;
+    ds.size_ = size;
+    return ds;
+}
+
+DataSet DataSet::from_rows(std::vector<std::vector<ftype>> const &inputs,
+                           std::vector<std::vector<ftype>> const &targets) {
+    assert(!inputs.empty() && inputs.size() == targets.size());
+    DataSet ds = with_targets(inputs.size(), inputs[0].size(),
+                              targets[0].size());
+
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        assert(inputs[i].size() == ds.nb_inputs());
+        assert(targets[i].size() == ds.nb_outputs());
+        std::copy(inputs[i].begin(), inputs[i].end(), ds.input(i).begin());
+        std::copy(targets[i].begin(), targets[i].end(), ds.target(i).begin());
+    }
+    return ds;
+}
+
+DataSet DataSet::with_raw_inputs(std::span<uint8_t const> inputs,
+                                 size_t nb_inputs, ftype scale,
+                                 std::shared_ptr<void const> owner,
+                                 size_t nb_classes) {
+    DataSet ds;
+
+    assert(nb_inputs > 0 && inputs.size() % nb_inputs == 0);
+    assert(nb_classes > 0 && nb_classes - 1 <= UINT16_MAX);
+    ds.size_ = inputs.size() / nb_inputs;
+    ds.storage_ = std::make_shared<Storage>();
+    ds.storage_->labels.resize(ds.size_);
+    ds.storage_->nb_inputs = nb_inputs;
+    ds.storage_->nb_outputs = nb_classes;
+    ds.storage_->raw_inputs = inputs;
+    ds.storage_->raw_scale = scale;
+    ds.storage_->raw_owner = std::move(owner);
+    return ds;
+}
+
+size_t DataSet::nb_inputs() const {
+    return storage_ ? storage_->nb_inputs : 0;
+}
+
+size_t DataSet::nb_outputs() const {
+    return storage_ ? storage_->nb_outputs : 0;
+}
+
+bool DataSet::has_labels() const {
+    return storage_ && storage_->targets.mem == nullptr;
+}
+
+std::span<ftype const> DataSet::input(size_t i) const {
+    assert(!is_encoded() && i < size_);
+    return {storage_->inputs[first_ + i], storage_->inputs.cols};
+}
+
+std::span<ftype> DataSet::input(size_t i) {
+    assert(!is_encoded() && i < size_);
+    return {storage_->inputs[first_ + i], storage_->inputs.cols};
+}
+
+bool DataSet::is_raw() const {
+    return storage_ && storage_->raw_inputs.data() != nullptr;
+}
+
+std::span<uint8_t const> DataSet::raw_input(size_t i) const {
+    assert(is_raw() && i < size_);
+    return storage_->raw_inputs.subspan((first_ + i) * storage_->nb_inputs,
+                                        storage_->nb_inputs);
+}
+
+Precision DataSet::precision() const {
+    return storage_ ? storage_->precision : Precision::FP32;
+}
+
+std::span<uint16_t const> DataSet::half_input(size_t i) const {
+    assert(precision() != Precision::FP32 && i < size_);
+    return std::span<uint16_t const>(storage_->half_inputs)
+        .subspan((first_ + i) * storage_->nb_inputs, storage_->nb_inputs);
+}
+
+bool DataSet::is_encoded() const {
+    return is_raw() || precision() != Precision::FP32;
+}
+
+void DataSet::input(size_t i, std::span<ftype> out) const {
+    inputs(i, 1, out);
+}
+
+void DataSet::input(size_t i, size_t offset, std::span<ftype> out) const {
+    size_t first = (first_ + i) * storage_->nb_inputs + offset;
+
+    assert(i < size_ && offset + out.size() <= storage_->nb_inputs);
+    if (is_raw()) {
+        normalize(storage_->raw_inputs.subspan(first, out.size()),
+                  storage_->raw_scale, out);
+    } else if (precision() != Precision::FP32) {
+        from_half(precision(),
+                  std::span<uint16_t const>(storage_->half_inputs)
+                      .subspan(first, out.size()),
+                  out);
+    } else {
+        std::copy_n(storage_->inputs.mem + first, out.size(), out.begin());
+    }
+}
+
+void DataSet::inputs(size_t first, size_t count, std::span<ftype> out) const {
+    size_t size = count * storage_->nb_inputs;
+    size_t offset = (first_ + first) * storage_->nb_inputs;
+
+    assert(first + count <= size_ && out.size() == size);
+    if (is_raw()) {
+        normalize(storage_->raw_inputs.subspan(offset, size),
+                  storage_->raw_scale, out);
+    } else if (precision() != Precision::FP32) {
+        from_half(precision(),
+                  std::span<uint16_t const>(storage_->half_inputs)
+                      .subspan(offset, size),
+                  out);
+    } else {
+        std::copy_n(storage_->inputs.mem + offset, size, out.begin());
+    }
+}
+
+DataSet DataSet::copy_targets() const {
+    DataSet ds = has_labels() ? with_labels(size_, nb_inputs(), nb_outputs())
+                              : with_targets(size_, nb_inputs(), nb_outputs());
+
+    if (has_labels()) {
+        std::copy_n(storage_->labels.begin() + first_, size_,
+                    ds.storage_->labels.begin());
+    } else {
+        std::copy_n(storage_->targets[first_], size_ * nb_outputs(),
+                    ds.storage_->targets.mem);
+    }
+    return ds;
+}
+
+void DataSet::parallel_for(
+    ThreadPool *pool, std::function<void(size_t, size_t)> const &task) const {
+    size_t nb_threads = pool ? pool->size() : 1;
+    auto run = [&](size_t id) {
+        size_t first = id * size_ / nb_threads;
+        size_t last = (id + 1) * size_ / nb_threads;
+        if (first < last) {
+            task(first, last);
+        }
+    };
+
+    if (pool) {
+        pool->run(run);
+    } else {
+        run(0);
+    }
+}
+
+DataSet DataSet::normalized(ThreadPool *pool) const {
+    if (!is_encoded()) {
+        return *this;
+    }
+    DataSet ds = copy_targets();
+
+    parallel_for(pool, [&](size_t first, size_t last) {
+        inputs(first, last - first,
+               std::span(ds.input(first).data(),
+                         (last - first) * nb_inputs()));
+    });
+    return ds;
+}
+
+DataSet DataSet::converted(Precision precision, ThreadPool *pool) const {
+    if (precision == Precision::FP32) {
+        return normalized(pool);
+    }
+    if (!is_raw() && precision == this->precision()) {
+        return *this;
+    }
+    DataSet ds = copy_targets();
+
+    // the float inputs of the copy are replaced by the 16 bits ones
+    ds.storage_->inputs = Matrix();
+    ds.storage_->half_inputs.resize(size_ * nb_inputs());
+    ds.storage_->precision = precision;
+    parallel_for(pool, [&](size_t first, size_t last) {
+        std::vector<ftype> row(nb_inputs());
+        for (size_t i = first; i < last; ++i) {
+            input(i, row);
+            to_half(precision, row,
+                    std::span(ds.storage_->half_inputs)
+                        .subspan(i * nb_inputs(), nb_inputs()));
+        }
+    });
+    return ds;
+}
+
+Label DataSet::label(size_t i) const {
+    if (has_labels()) {
+        assert(i < size_);
+        return storage_->labels[first_ + i];
+    }
+    std::span<ftype const> t = target(i);
+    return std::max_element(t.begin(), t.end()) - t.begin();
+}
+
+void DataSet::label(size_t i, Label label) {
+    assert(has_labels() && i < size_ && label < storage_->nb_outputs);
+    storage_->labels[first_ + i] = label;
+}
+
+std::span<ftype const> DataSet::target(size_t i) const {
+    assert(!has_labels() && i < size_);
+    return {storage_->targets[first_ + i], storage_->targets.cols};
+}
+
+std::span<ftype> DataSet::target(size_t i) {
+    assert(!has_labels() && i < size_);
+    return {storage_->targets[first_ + i], storage_->targets.cols};
+}
+
+void DataSet::ground_truth(size_t i, ftype *out, size_t stride) const {
+    size_t nb_outputs = storage_->nb_outputs;
+
+    if (has_labels()) {
+        for (size_t r = 0; r < nb_outputs; ++r) {
+            out[r * stride] = 0;
+        }
+        out[label(i) * stride] = 1;
+    } else {
+        std::span<ftype const> t = target(i);
+        for (size_t r = 0; r < nb_outputs; ++r) {
+            out[r * stride] = t[r];
+        }
+    }
+}
+
+DataSet DataSet::slice(size_t first, size_t count) const {
+    assert(first + count <= size_);
+    DataSet ds = *this;
+
+    ds.first_ = first_ + first;
+    ds.size_ = count;
+    return ds;
+}
+
+std::pair<DataSet, DataSet> DataSet::split(size_t size) const {
+    assert(size <= size_);
+    return {slice(0, size), slice(size, size_ - size)};
+}
+
+DataSet DataSet::select(std::vector<size_t> const &indexes) const {
+    DataSet ds = has_labels()
+                     ? with_labels(indexes.size(), nb_inputs(), nb_outputs())
+                     : with_targets(indexes.size(), nb_inputs(), nb_outputs());
+
+    for (size_t i = 0; i < indexes.size(); ++i) {
+        input(indexes[i], ds.input(i));
+        if (has_labels()) {
+            ds.label(i, label(indexes[i]));
+        } else {
+            std::span<ftype const> t = target(indexes[i]);
+            std::copy(t.begin(), t.end(), ds.target(i).begin());
+        }
+    }
+    return ds;
+}
@@ -0,0 +1,130 @@
+#ifndef DATASET_H
+#define DATASET_H
+#include "kernels.hpp"
+#include "math.hpp"
+#include "thread_pool.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+using Label = uint16_t;
+
+/*
+ * Samples stored as structure of arrays. The inputs are the rows of one
+ * contiguous (size x nb_inputs) matrix, so the inputs of consecutive samples
+ * are contiguous too. The targets are either class ids (labels), which are
+ * one-hot encoded on nb_outputs values when needed, or the rows of a dense
+ * (size x nb_outputs) matrix. The buffers are shared: copying a dataset,
+ * taking a slice or splitting it does not copy the samples (and writing to a
+ * row is visible from all of them).
+ *
+ * The inputs can also be raw bytes owned by someone else (ex: a memory mapped
+ * file), or 16 bits floats (see converted). They are then normalized
+ * (multiplied by a scale) or converted only when they are read with
+ * input(i, out) or inputs(first, count, out), batch by batch, or all at once
+ * with normalized().
+ */
+class DataSet {
+  public:
+    DataSet() = default;
+
+    /* size samples of nb_inputs values labelled in [0, nb_classes) */
+    static DataSet with_labels(size_t size, size_t nb_inputs,
+                               size_t nb_classes);
+    /* size samples of nb_inputs values with nb_outputs target values */
+    static DataSet with_targets(size_t size, size_t nb_inputs,
+                                size_t nb_outputs);
+    /* dense dataset built from rows, ex: from_rows({{0, 1}}, {{1}}) */
+    static DataSet from_rows(std::vector<std::vector<ftype>> const &inputs,
+                             std::vector<std::vector<ftype>> const &targets);
+    /* labelled dataset on the (size x nb_inputs) raw bytes, which stay valid
+     * as long as owner is alive */
+    static DataSet with_raw_inputs(std::span<uint8_t const> inputs,
+                                   size_t nb_inputs, ftype scale,
+                                   std::shared_ptr<void const> owner,
+                                   size_t nb_classes);
+
+  public:
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t nb_inputs() const;
+    size_t nb_outputs() const;
+    bool has_labels() const;
+
+    /* inputs stored as ftype only */
+    std::span<ftype const> input(size_t i) const;
+    std::span<ftype> input(size_t i);
+
+    /* raw inputs only */
+    bool is_raw() const;
+    std::span<uint8_t const> raw_input(size_t i) const;
+    ftype raw_scale() const { return storage_ ? storage_->raw_scale : 1; }
+
+    /* 16 bits inputs only */
+    Precision precision() const;
+    std::span<uint16_t const> half_input(size_t i) const;
+    /* inputs not stored as ftype (raw or 16 bits) */
+    bool is_encoded() const;
+
+    /* normalized (or copied) input of the sample i */
+    void input(size_t i, std::span<ftype> out) const;
+    /* normalized values [offset, offset + out.size()) of the input i */
+    void input(size_t i, size_t offset, std::span<ftype> out) const;
+    /* normalized (or copied) inputs of the samples [first, first + count) as
+     * (count x nb_inputs) rows */
+    void inputs(size_t first, size_t count, std::span<ftype> out) const;
+    /* copy of a raw dataset with normalized inputs (the conversion is split
+     * between the threads of the pool), the dataset itself otherwise */
+    DataSet normalized(ThreadPool *pool = nullptr) const;
+    /* copy with the inputs stored with the given precision (the dataset
+     * itself if it is already stored with it) */
+    DataSet converted(Precision precision, ThreadPool *pool = nullptr) const;
+
+    /* class of the sample (the first maximum of the dense targets) */
+    Label label(size_t i) const;
+    void label(size_t i, Label label);
+
+    /* dense targets only */
+    std::span<ftype const> target(size_t i) const;
+    std::span<ftype> target(size_t i);
+
+    /* write the nb_outputs values of the ground truth of the sample i at out,
+     * out + stride, out + 2 * stride... */
+    void ground_truth(size_t i, ftype *out, size_t stride = 1) const;
+
+    /* views on the samples [first, first + count) */
+    DataSet slice(size_t first, size_t count) const;
+    /* the first size samples and the others */
+    std::pair<DataSet, DataSet> split(size_t size) const;
+    /* copy of the samples at the given indexes */
+    DataSet select(std::vector<size_t> const &indexes) const;
+
+  private:
+    struct Storage {
+        Matrix inputs = {};  // (size x nb_inputs), empty for raw inputs
+        Matrix targets = {}; // (size x nb_outputs), empty with labels
+        std::vector<Label> labels = {};
+        size_t nb_inputs = 0;
+        size_t nb_outputs = 0;
+        std::span<uint8_t const> raw_inputs = {}; // (size x nb_inputs)
+        ftype raw_scale = 1;
+        std::shared_ptr<void const> raw_owner = nullptr;
+        std::vector<uint16_t> half_inputs = {}; // (size x nb_inputs)
+        Precision precision = Precision::FP32;
+    };
+
+    // dataset with float inputs and a copy of the targets
+    DataSet copy_targets() const;
+    // split the samples between the threads of the pool: task(first, last)
+    void parallel_for(ThreadPool *pool,
+                      std::function<void(size_t, size_t)> const &task) const;
+
+    std::shared_ptr<Storage> storage_ = nullptr;
+    size_t first_ = 0;
+    size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "evaluator.hpp"
+#include "thread_budget.hpp"
+#include <algorithm>
+#include <cassert>
+
+template <CostFunctionType Cost, ActivationFunctionType Act>
+std::pair<ftype, ftype>
+BasicEvaluator<Cost, Act>::evaluate(DataSet const &ds) const {
+    size_t nb_threads = pool_ ? pool_->size() : 1;
+    size_t nb_blocks = (ds.size() + block_size_ - 1) / block_size_;
+    std::vector<Result> results(nb_threads);
+    ThreadBudget::Lease lease(Activity::Evaluation, nb_threads);
+
+    assert(!model_->layers.empty());
+    assert(ds.nb_inputs() == model_->layers.front().nb_inputs);
+    assert(ds.nb_outputs() == model_->layers.back().nb_nodes);
+
+    auto task = [&](size_t id) {
+        BasicInferenceSession<Act> session(model_, activation_, block_size_);
+        std::vector<ftype> ground_truth(model_->layers.back().nb_nodes);
+
+        for (size_t b = id; b < nb_blocks; b += nb_threads) {
+            size_t first = b * block_size_;
+            size_t last = std::min(ds.size(), first + block_size_);
+            evaluate_block(ds, first, last, session, ground_truth.data(),
+                           results[id]);
+        }
+    };
+    if (pool_) {
+        pool_->run(task);
+    } else {
+        task(0);
+    }
+
+    // the partial results are combined in a fixed order
+    Result total;
+    for (auto const &result : results) {
+        total.cost_sum += result.cost_sum;
+        total.count_valid += result.count_valid;
+    }
+    ftype avg_cost = total.cost_sum / (ftype)ds.size();
+    ftype accuracy = 100 * ((ftype)total.count_valid / (ftype)ds.size());
+    return {avg_cost, accuracy};
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act>
+void BasicEvaluator<Cost, Act>::evaluate_block(
+    DataSet const &ds, size_t first, size_t last,
+    BasicInferenceSession<Act> &session, ftype *ground_truth,
+    Result &result) const {
+    size_t n = last - first;
+    ftype const *z = session.predict_batch(ds, first, n).mem;
+
+    // output layer: cost and argmax in one pass over the samples
+    size_t nb_outputs = model_->layers.back().nb_nodes;
+    for (size_t i = 0; i < n; ++i) {
+        ftype cost_sum = 0;
+        size_t found = 0, expected = ds.label(first + i);
+        ftype found_max = 0;
+
+        ds.ground_truth(first + i, ground_truth);
+        for (size_t r = 0; r < nb_outputs; ++r) {
+            ftype y = z[r * n + i];
+            cost_sum += cost_->execute(ground_truth[r], y);
+            if (r == 0 || y > found_max) {
+                found_max = y;
+                found = r;
+            }
+        }
+        result.cost_sum += cost_sum / nb_outputs;
+        result.count_valid += found == expected;
+    }
+}
+
+template class BasicEvaluator<CostFunction, ActivationFunction>;
+template class BasicEvaluator<QuadraticLoss, Sigmoid>;
@@ -0,0 +1,56 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+#include "functions.hpp"
+#include "inference.hpp"
+#include "model.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+#include <utility>
+
+/*
+ * Inference only evaluation of a model on a dataset. The samples are processed
+ * in blocks of block_size columns by the batched prediction of an inference
+ * session (one gemm per layer, no history of the activations). The cost and
+ * the accuracy are computed in one pass over the outputs of a block. The
+ * first layer reads the inputs directly from the contiguous rows of the
+ * dataset (raw and 16 bits inputs are decoded block by block), and the 16
+ * bits copy of the weights when the model has one (see Model::half_precision).
+ * When a pool is given, the blocks are split between its threads. Like the
+ * trainer, the evaluator is specialized on the function types.
+ */
+template <CostFunctionType Cost, ActivationFunctionType Act>
+class BasicEvaluator {
+  public:
+    BasicEvaluator(Model const *model, Cost *cost, Act *activation,
+                   ThreadPool *pool = nullptr, size_t block_size = 256)
+        : model_(model), cost_(cost), activation_(activation), pool_(pool),
+          block_size_(block_size) {}
+
+  public:
+    /* returns the average cost and the accuracy (%) */
+    std::pair<ftype, ftype> evaluate(DataSet const &ds) const;
+
+    void model(Model const *model) { model_ = model; }
+    void pool(ThreadPool *pool) { pool_ = pool; }
+
+  private:
+    struct Result {
+        double cost_sum = 0;
+        size_t count_valid = 0;
+    };
+
+    void evaluate_block(DataSet const &ds, size_t first, size_t last,
+                        BasicInferenceSession<Act> &session,
+                        ftype *ground_truth, Result &result) const;
+
+  private:
+    Model const *model_ = nullptr;
+    Cost *cost_ = nullptr;
+    Act *activation_ = nullptr;
+    ThreadPool *pool_ = nullptr;
+    size_t block_size_ = 256;
+};
+
+using Evaluator = BasicEvaluator<CostFunction, ActivationFunction>;
+
+#endif
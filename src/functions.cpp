@@ -39,3 +39,4 @@ Vector map_derivative(CostFunction *cost, Vector const &v1, Vector const &v2) {
     }
     return result;
 }
+
@@ -1,34 +1,126 @@
 #ifndef FUNCTIONS_H
 #define FUNCTIONS_H
+#include "kernels.hpp"
 #include "math.hpp"
 #include "model.hpp"
+#include "thread_pool.hpp"
 #include <cassert>
 #include <cmath>
+#include <concepts>
+#include <memory>
+#include <span>
+#include <vector>
 
 /******************************************************************************/
 /*                                 interfaces                                 */
 /******************************************************************************/
 
+/* The span versions process whole arrays and can be overridden with
+ * vectorized implementations. By default, they call the scalar functions. */
+
 struct CostFunction {
     virtual ftype execute(ftype ground_truth, ftype layer_output) = 0;
     virtual ftype derivative(ftype ground_truth, ftype layer_output) = 0;
+
+    virtual void execute(std::span<ftype const> ground_truth,
+                         std::span<ftype const> layer_output,
+                         std::span<ftype> out) {
+        assert(ground_truth.size() == out.size());
+        assert(layer_output.size() == out.size());
+        for (size_t i = 0; i < out.size(); ++i) {
+            out[i] = execute(ground_truth[i], layer_output[i]);
+        }
+    }
+
+    virtual void derivative(std::span<ftype const> ground_truth,
+                            std::span<ftype const> layer_output,
+                            std::span<ftype> out) {
+        assert(ground_truth.size() == out.size());
+        assert(layer_output.size() == out.size());
+        for (size_t i = 0; i < out.size(); ++i) {
+            out[i] = derivative(ground_truth[i], layer_output[i]);
+        }
+    }
 };
 
 struct ActivationFunction {
     virtual ftype execute(ftype) = 0;
     virtual ftype derivative(ftype) = 0;
+
+    /* out may alias in */
+    virtual void execute(std::span<ftype const> in, std::span<ftype> out) {
+        assert(in.size() == out.size());
+        for (size_t i = 0; i < in.size(); ++i) {
+            out[i] = execute(in[i]);
+        }
+    }
+
+    /* out may alias in */
+    virtual void derivative(std::span<ftype const> in, std::span<ftype> out) {
+        assert(in.size() == out.size());
+        for (size_t i = 0; i < in.size(); ++i) {
+            out[i] = derivative(in[i]);
+        }
+    }
+
+    /* out = f(in) and out_prime = f'(in) in one pass, out_prime may alias in */
+    virtual void execute_and_derivative(std::span<ftype const> in,
+                                        std::span<ftype> out,
+                                        std::span<ftype> out_prime) {
+        assert(in.size() == out.size() && in.size() == out_prime.size());
+        for (size_t i = 0; i < in.size(); ++i) {
+            ftype x = in[i];
+            out[i] = execute(x);
+            out_prime[i] = derivative(x);
+        }
+    }
+};
+
+/* State of an optimizer between two steps (saved in the checkpoints). The
+ * buffers have the layout of the model parameters. */
+struct OptimizerState {
+    std::vector<ftype> values = {};
+    std::vector<Parameters> buffers = {};
 };
 
 struct OptimizeFunction {
-    virtual void execute(Model *model, GradW const &grads_w,
-                         GradB const &grads_b, ftype learning_rate) = 0;
+    /* grads has the layout of the model parameters */
+    virtual void execute(Model *model, Parameters const &grads,
+                         ftype learning_rate) = 0;
+
+    /* Threads that the optimizer may use (set by the trainer). The optimizer
+     * does not keep the pool alive: it runs on the calling thread once the
+     * pool is destroyed. */
+    virtual void pool(std::shared_ptr<ThreadPool> const &) {}
+
+    /* Copy the state into out (the buffers of out are reused) and restore it.
+     * restore_state returns false when the state does not match the
+     * optimizer. By default, the optimizer has no state. */
+    virtual void save_state(OptimizerState &out) const {
+        out.values.clear();
+        out.buffers.clear();
+    }
+    virtual bool restore_state(OptimizerState const &state) {
+        return state.values.empty() && state.buffers.empty();
+    }
 };
 
+/* The trainer can be specialized on the concrete function types (which are
+ * final), so the calls are resolved at compile time and can be inlined. */
+template <typename F>
+concept CostFunctionType = std::derived_from<F, CostFunction>;
+
+template <typename F>
+concept ActivationFunctionType = std::derived_from<F, ActivationFunction>;
+
+template <typename F>
+concept OptimizeFunctionType = std::derived_from<F, OptimizeFunction>;
+
 /******************************************************************************/
 /*                              implementations                               */
 /******************************************************************************/
 
-struct QuadraticLoss : CostFunction {
+struct QuadraticLoss final : CostFunction {
     ftype execute(ftype ground_truth, ftype output) override {
         ftype diff = ground_truth - output;
         return 0.5 * diff * diff;
@@ -37,136 +129,159 @@ struct QuadraticLoss : CostFunction {
     ftype derivative(ftype ground_truth, ftype output) override {
         return output - ground_truth;
     }
+
+    void execute(std::span<ftype const> ground_truth,
+                 std::span<ftype const> output,
+                 std::span<ftype> out) override {
+        assert(ground_truth.size() == out.size());
+        assert(output.size() == out.size());
+        for (size_t i = 0; i < out.size(); ++i) {
+            ftype diff = ground_truth[i] - output[i];
+            out[i] = 0.5 * diff * diff;
+        }
+    }
+
+    void derivative(std::span<ftype const> ground_truth,
+                    std::span<ftype const> output,
+                    std::span<ftype> out) override {
+        assert(ground_truth.size() == out.size());
+        assert(output.size() == out.size());
+        for (size_t i = 0; i < out.size(); ++i) {
+            out[i] = output[i] - ground_truth[i];
+        }
+    }
 };
 
-struct Sigmoid : ActivationFunction {
+/* The span versions use the SIMD kernels (see kernels.hpp). */
+struct Sigmoid final : ActivationFunction {
     ftype execute(ftype x) override { return 1.0 / (1.0 + std::exp(-x)); }
 
     ftype derivative(ftype x) override {
-        return execute(x) * (1.0 - execute(x));
+        ftype s = execute(x);
+        return s * (1.0 - s);
+    }
+
+    void execute(std::span<ftype const> in, std::span<ftype> out) override {
+        sigmoid(in, out);
+    }
+
+    void derivative(std::span<ftype const> in, std::span<ftype> out) override {
+        sigmoid_derivative(in, out);
+    }
+
+    void execute_and_derivative(std::span<ftype const> in,
+                                std::span<ftype> out,
+                                std::span<ftype> out_prime) override {
+        sigmoid_and_derivative(in, out, out_prime);
     }
 };
 
-struct SGD : OptimizeFunction {
-    void execute(Model *model, GradW const &grads_w, GradB const &grads_b,
+/* The updates run over the flat parameters (see Parameters). */
+struct SGD final : OptimizeFunction {
+    void execute(Model *model, Parameters const &grads,
                  ftype learning_rate) override {
-        for (size_t l = 0; l < model->layers.size(); ++l) {
-            assert(grads_w[l].rows == model->layers[l].nb_nodes &&
-                   grads_w[l].cols == model->layers[l].nb_inputs);
-            assert(grads_b[l].size == model->layers[l].nb_nodes);
+        std::span<ftype> params = model->parameters().flat();
 
-            model->layers[l].weights -= learning_rate * grads_w[l];
-            model->layers[l].biases -= learning_rate * grads_b[l];
-        }
+        assert(grads.same_layout(model->parameters()));
+        axpy<ftype>(params.size(), -learning_rate, grads.flat().data(), 1,
+                    params.data(), 1);
     }
 };
 
-struct Adam : OptimizeFunction {
+struct Adam final : OptimizeFunction {
     /* Create m and v and set the memory to 0 */
-    void init(GradW const &grads_w, GradB const &grads_b) {
-        m_w.resize(grads_w.size());
-        v_w.resize(grads_w.size());
-        m_b.resize(grads_b.size());
-        v_b.resize(grads_b.size());
-
-        for (size_t l = 0; l < grads_w.size(); ++l) {
-            m_w[l] = Matrix(grads_w[l].rows, grads_w[l].cols);
-            memset(m_w[l].mem, 0,
-                   grads_w[l].rows * grads_w[l].cols * sizeof(*grads_w[l].mem));
-            v_w[l] = Matrix(grads_w[l].rows, grads_w[l].cols);
-            memset(v_w[l].mem, 0,
-                   grads_w[l].rows * grads_w[l].cols * sizeof(*grads_w[l].mem));
-        }
-
-        for (size_t l = 0; l < grads_b.size(); ++l) {
-            m_b[l] = Vector(grads_b[l].size);
-            memset(m_b[l].mem, 0, grads_b[l].size * sizeof(*grads_b[l].mem));
-            v_b[l] = Vector(grads_b[l].size);
-            memset(v_b[l].mem, 0, grads_b[l].size * sizeof(*grads_b[l].mem));
-        }
+    void init(Parameters const &grads) {
+        m = Parameters::zeros_like(grads);
+        v = Parameters::zeros_like(grads);
         b1_t = b1;
         b2_t = b2;
         is_init = true;
     }
 
-    // m = b1 * m + (1 - b1) * grads
-    // v = b2 * v + (1 - b2) * grads * grads
-    void compute_mv(GradW const &grads_w, GradB const &grads_b) {
-        for (size_t l = 0; l < grads_w.size(); ++l) {
-            ftype *mw = m_w[l].mem;
-            ftype *vw = v_w[l].mem;
-            ftype const *gw = grads_w[l].mem;
-
-            for (size_t i = 0; i < grads_w[l].rows * grads_w[l].cols; ++i) {
-                mw[i] = b1 * mw[i] + (1 - b1) * gw[i];
-                vw[i] = b2 * vw[i] + (1 - b2) * gw[i] * gw[i];
-            }
-        }
-
-        for (size_t l = 0; l < grads_b.size(); ++l) {
-            ftype *mb = m_b[l].mem;
-            ftype *vb = v_b[l].mem;
-            ftype const *gb = grads_b[l].mem;
-
-            for (size_t i = 0; i < grads_b[l].size; ++i) {
-                mb[i] = b1 * mb[i] + (1 - b1) * gb[i];
-                vb[i] = b2 * vb[i] + (1 - b2) * gb[i] * gb[i];
-            }
-        }
-    }
-
-    // m_ = m / (1 - b1_t)
-    // v_ = v / (1 - b2_t)
-    // w -= learning_rate * m_ / (sqrt(v_) + sigma)
-    // b -= learning_rate * m_ / (sqrt(v_) + sigma)
-    void update_model(Model *model, GradW const &grads_w, GradB const &grads_b,
+    // Fused update of m, v and the parameters (see adam_update). When a pool
+    // is set and the model is large enough, every thread updates a contiguous
+    // chunk of the parameters (aligned on a cache line).
+    void update_model(Model *model, Parameters const &grads,
                       ftype learning_rate) {
-        for (size_t l = 0; l < grads_w.size(); ++l) {
-            ftype *w = model->layers[l].weights.mem;
-            ftype const *mw = m_w[l].mem;
-            ftype const *vw = v_w[l].mem;
-
-            for (size_t i = 0; i < grads_w[l].rows * grads_w[l].cols; ++i) {
-                ftype mm = mw[i] / (1 - b1_t);
-                ftype vv = vw[i] / (1 - b2_t);
-                w[i] -= learning_rate * mm / (std::sqrt(vv) + sigma);
-            }
-        }
+        AdamStep step = {b1, b2, 1 / (1 - b1_t), 1 / (1 - b2_t),
+                         learning_rate, sigma};
+        std::span<ftype> params = model->parameters().flat();
+        size_t size = params.size();
+        std::shared_ptr<ThreadPool> pool =
+            size >= PARALLEL_THRESHOLD ? pool_.lock() : nullptr;
+        size_t nb_chunks = pool ? pool->size() : 1;
 
-        for (size_t l = 0; l < grads_b.size(); ++l) {
-            ftype *b = model->layers[l].biases.mem;
-            ftype const *mb = m_b[l].mem;
-            ftype const *vb = v_b[l].mem;
-
-            for (size_t i = 0; i < grads_b[l].size; ++i) {
-                ftype mm = mb[i] / (1 - b1_t);
-                ftype vv = vb[i] / (1 - b2_t);
-                b[i] -= learning_rate * mm / (std::sqrt(vv) + sigma);
-            }
+        assert(grads.same_layout(model->parameters()));
+        auto task = [&](size_t id) {
+            constexpr size_t step_size = Parameters::ALIGNMENT / sizeof(ftype);
+            size_t first = id * size / nb_chunks / step_size * step_size;
+            size_t last = id + 1 == nb_chunks
+                              ? size
+                              : (id + 1) * size / nb_chunks / step_size *
+                                    step_size;
+            adam_update(step, params.subspan(first, last - first),
+                        m.flat().subspan(first, last - first),
+                        v.flat().subspan(first, last - first),
+                        grads.flat().subspan(first, last - first));
+        };
+        if (nb_chunks > 1) {
+            pool->run(task);
+        } else {
+            task(0);
         }
     }
 
-    void execute(Model *model, GradW const &grads_w, GradB const &grads_b,
+    void execute(Model *model, Parameters const &grads,
                  ftype learning_rate) override {
         if (is_init == false) [[unlikely]] {
-            init(grads_w, grads_b);
+            init(grads);
         }
-        compute_mv(grads_w, grads_b);
-        update_model(model, grads_w, grads_b, learning_rate);
+        update_model(model, grads, learning_rate);
         b1_t *= b1;
         b2_t *= b2;
     }
 
+    // values: is_init, b1_t, b2_t, buffers: m and v (once initialized)
+    void save_state(OptimizerState &out) const override {
+        out.values.assign({ftype(is_init), b1_t, b2_t});
+        out.buffers.resize(is_init ? 2 : 0);
+        if (is_init) {
+            out.buffers[0] = m;
+            out.buffers[1] = v;
+        }
+    }
+
+    bool restore_state(OptimizerState const &state) override {
+        if (state.values.size() != 3 ||
+            state.buffers.size() != (state.values[0] != 0 ? 2 : 0)) {
+            return false;
+        }
+        is_init = state.values[0] != 0;
+        b1_t = state.values[1];
+        b2_t = state.values[2];
+        if (is_init) {
+            m = state.buffers[0];
+            v = state.buffers[1];
+        }
+        return true;
+    }
+
     bool is_init = false;
     ftype b1 = 0.9;
     ftype b2 = 0.999;
     ftype b1_t = 0.9;
     ftype b2_t = 0.999;
     ftype sigma = 1e-8;
-    std::vector<Matrix> m_w;
-    std::vector<Vector> m_b;
-    std::vector<Matrix> v_w;
-    std::vector<Vector> v_b;
+    Parameters m;
+    Parameters v;
+
+    void pool(std::shared_ptr<ThreadPool> const &pool) override {
+        pool_ = pool;
+    }
+
+  private:
+    static constexpr size_t PARALLEL_THRESHOLD = 1 << 16;
+    std::weak_ptr<ThreadPool> pool_ = {};
 };
 
 /******************************************************************************/
@@ -178,4 +293,51 @@ Vector map_derivative(ActivationFunction *act, Vector const &v);
 Vector map(CostFunction *cost, Vector const &v1, Vector const &v2);
 Vector map_derivative(CostFunction *cost, Vector const &v1, Vector const &v2);
 
+/* in place versions (result may alias the input) */
+template <ActivationFunctionType Act>
+void map(Act *act, Matrix const &m, Matrix &result) {
+    assert(m.rows == result.rows && m.cols == result.cols);
+    act->execute(std::span<ftype const>(m.mem, m.rows * m.cols),
+                 std::span<ftype>(result.mem, result.rows * result.cols));
+}
+
+template <ActivationFunctionType Act>
+void map_derivative(Act *act, Matrix const &m, Matrix &result) {
+    assert(m.rows == result.rows && m.cols == result.cols);
+    act->derivative(std::span<ftype const>(m.mem, m.rows * m.cols),
+                    std::span<ftype>(result.mem, result.rows * result.cols));
+}
+
+/* result = act(m) and result_prime = act'(m) */
+template <ActivationFunctionType Act>
+void map_and_derivative(Act *act, Matrix const &m, Matrix &result,
+                        Matrix &result_prime) {
+    assert(m.rows == result.rows && m.cols == result.cols);
+    assert(m.rows == result_prime.rows && m.cols == result_prime.cols);
+    act->execute_and_derivative(
+        std::span<ftype const>(m.mem, m.rows * m.cols),
+        std::span<ftype>(result.mem, result.rows * result.cols),
+        std::span<ftype>(result_prime.mem,
+                         result_prime.rows * result_prime.cols));
+}
+
+template <CostFunctionType Cost>
+void map(Cost *cost, Matrix const &m1, Matrix const &m2, Matrix &result) {
+    assert(m1.rows == m2.rows && m1.cols == m2.cols);
+    assert(m1.rows == result.rows && m1.cols == result.cols);
+    cost->execute(std::span<ftype const>(m1.mem, m1.rows * m1.cols),
+                  std::span<ftype const>(m2.mem, m2.rows * m2.cols),
+                  std::span<ftype>(result.mem, result.rows * result.cols));
+}
+
+template <CostFunctionType Cost>
+void map_derivative(Cost *cost, Matrix const &m1, Matrix const &m2,
+                    Matrix &result) {
+    assert(m1.rows == m2.rows && m1.cols == m2.cols);
+    assert(m1.rows == result.rows && m1.cols == result.cols);
+    cost->derivative(std::span<ftype const>(m1.mem, m1.rows * m1.cols),
+                     std::span<ftype const>(m2.mem, m2.rows * m2.cols),
+                     std::span<ftype>(result.mem, result.rows * result.cols));
+}
+
 #endif
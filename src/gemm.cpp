@@ -0,0 +1,926 @@
+#include "gemm.hpp"
+#include "kernels.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include <utility>
+#include <vector>
+
+/******************************************************************************/
+/*                                  backend                                   */
+/******************************************************************************/
+
+static std::atomic<GemmBackend> &current_backend() {
+    static std::atomic<GemmBackend> backend = []() {
+#ifdef NN_OPENBLAS
+        char const *env = std::getenv("NN_GEMM");
+
+        if (!env || std::strcmp(env, "native") != 0) {
+            return GemmBackend::OpenBLAS;
+        }
+#endif
+        return GemmBackend::Native;
+    }();
+    return backend;
+}
+
+GemmBackend gemm_backend() {
+    return current_backend().load(std::memory_order_relaxed);
+}
+
+void gemm_backend(GemmBackend backend) {
+#ifndef NN_OPENBLAS
+    assert(backend == GemmBackend::Native);
+#endif
+    current_backend().store(backend, std::memory_order_relaxed);
+}
+
+char const *gemm_backend_name(GemmBackend backend) {
+    switch (backend) {
+    case GemmBackend::OpenBLAS:
+        return "openblas";
+    default:
+        return "native";
+    }
+}
+
+/******************************************************************************/
+/*                                  kernels                                   */
+/******************************************************************************/
+
+// The kernels compute a MR x NR tile of C from MR rows of A and NR columns of
+// B: A(r, p) is a[r * rsa + p * csa] (a packed panel or the matrix itself) and
+// the row p of B is the NR values at b + p * ldb.
+// C = alpha * A * B + beta * C, C is read only when beta != 0.
+using Kernel = void (*)(size_t kc, float const *a, size_t rsa, size_t csa,
+                        float const *b, size_t ldb, float alpha, float beta,
+                        float *c, size_t ldc);
+
+// The dot kernels compute a DR x DQ tile of C from DR rows of A and DQ
+// columns of B of k contiguous values (a + i * lda and b + j * ldb), for the
+// products with few rows or columns and a long k. The rows and columns
+// beyond m and n are clamped to the last ones, computed and not stored.
+using DotKernel = void (*)(size_t k, float const *a, size_t lda, size_t m,
+                           float const *b, size_t ldb, size_t n, float alpha,
+                           float beta, float *c, size_t ldc);
+
+static inline float update(float alpha, float value, float beta, float c) {
+    return beta == 0 ? alpha * value : alpha * value + beta * c;
+}
+
+static void kernel_scalar(size_t kc, float const *a, size_t rsa, size_t csa,
+                          float const *b, size_t ldb, float alpha, float beta,
+                          float *c, size_t ldc) {
+    constexpr size_t MR = 4, NR = 8;
+    float acc[MR][NR] = {};
+
+    for (size_t p = 0; p < kc; ++p, a += csa, b += ldb) {
+        for (size_t r = 0; r < MR; ++r) {
+            for (size_t j = 0; j < NR; ++j) {
+                acc[r][j] += a[r * rsa] * b[j];
+            }
+        }
+    }
+    for (size_t r = 0; r < MR; ++r) {
+        for (size_t j = 0; j < NR; ++j) {
+            c[r * ldc + j] = update(alpha, acc[r][j], beta, c[r * ldc + j]);
+        }
+    }
+}
+
+// 12 accumulators, 2 registers for B and 1 for the broadcast of A
+__attribute__((target("avx2,fma"))) static void
+kernel_avx2(size_t kc, float const *a, size_t rsa, size_t csa, float const *b,
+            size_t ldb, float alpha, float beta, float *c, size_t ldc) {
+    constexpr size_t MR = 6;
+    __m256 acc[MR][2];
+
+#pragma GCC unroll 6
+    for (size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm256_setzero_ps();
+        acc[r][1] = _mm256_setzero_ps();
+    }
+    for (size_t p = 0; p < kc; ++p, a += csa, b += ldb) {
+        __m256 b0 = _mm256_loadu_ps(b);
+        __m256 b1 = _mm256_loadu_ps(b + 8);
+#pragma GCC unroll 6
+        for (size_t r = 0; r < MR; ++r) {
+            __m256 ar = _mm256_broadcast_ss(a + r * rsa);
+            acc[r][0] = _mm256_fmadd_ps(ar, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(ar, b1, acc[r][1]);
+        }
+    }
+    __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta);
+#pragma GCC unroll 6
+    for (size_t r = 0; r < MR; ++r) {
+        for (size_t h = 0; h < 2; ++h) {
+            float *dst = c + r * ldc + 8 * h;
+            __m256 v = _mm256_mul_ps(va, acc[r][h]);
+            if (beta != 0) {
+                v = _mm256_fmadd_ps(vb, _mm256_loadu_ps(dst), v);
+            }
+            _mm256_storeu_ps(dst, v);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma"))) static inline float
+reduce_avx2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v),
+                            _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+// dst[j * ld + p] = src[p * rs + j] for p < rows and j < cols, by blocks of
+// 8 x 8 transposed in registers (unpack, shuffle and permute of the lanes)
+__attribute__((target("avx2"))) static void
+transpose_avx2(float const *src, size_t rs, size_t rows, size_t cols,
+               float *dst, size_t ld) {
+    size_t rows8 = rows - rows % 8, cols8 = cols - cols % 8;
+
+    for (size_t j = 0; j < cols8; j += 8) {
+        for (size_t p = 0; p < rows8; p += 8) {
+            __m256 r[8], t[8], u[8];
+            for (size_t i = 0; i < 8; ++i) {
+                r[i] = _mm256_loadu_ps(src + (p + i) * rs + j);
+            }
+            for (size_t i = 0; i < 8; i += 2) {
+                t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+                t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+            }
+            for (size_t i = 0; i < 8; i += 4) {
+                u[i] = _mm256_shuffle_ps(t[i], t[i + 2], 0x44);
+                u[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], 0xee);
+                u[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0x44);
+                u[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0xee);
+            }
+            for (size_t i = 0; i < 4; ++i) {
+                _mm256_storeu_ps(dst + (j + i) * ld + p,
+                                 _mm256_permute2f128_ps(u[i], u[i + 4], 0x20));
+                _mm256_storeu_ps(dst + (j + i + 4) * ld + p,
+                                 _mm256_permute2f128_ps(u[i], u[i + 4], 0x31));
+            }
+        }
+        for (size_t p = rows8; p < rows; ++p) {
+            for (size_t i = 0; i < 8; ++i) {
+                dst[(j + i) * ld + p] = src[p * rs + j + i];
+            }
+        }
+    }
+    for (size_t j = cols8; j < cols; ++j) {
+        for (size_t p = 0; p < rows; ++p) {
+            dst[j * ld + p] = src[p * rs + j];
+        }
+    }
+}
+
+// 2 x 4 tiles: 8 accumulators, 4 registers for B and 1 for A, the tail of k
+// is masked
+__attribute__((target("avx2,fma"))) static void
+dot_kernel_avx2(size_t k, float const *a, size_t lda, size_t m, float const *b,
+                size_t ldb, size_t n, float alpha, float beta, float *c,
+                size_t ldc) {
+    constexpr size_t DR = 2, DQ = 4;
+    alignas(32) static int32_t const masks[16] = {-1, -1, -1, -1, -1, -1,
+                                                  -1, -1, 0,  0,  0,  0,
+                                                  0,  0,  0,  0};
+    float const *rows[DR], *cols[DQ];
+    __m256 acc[DR][DQ];
+    size_t k8 = k - k % 8;
+
+    for (size_t r = 0; r < DR; ++r) {
+        rows[r] = a + std::min(r, m - 1) * lda;
+    }
+    for (size_t q = 0; q < DQ; ++q) {
+        cols[q] = b + std::min(q, n - 1) * ldb;
+    }
+    for (size_t r = 0; r < DR; ++r) {
+        for (size_t q = 0; q < DQ; ++q) {
+            acc[r][q] = _mm256_setzero_ps();
+        }
+    }
+    for (size_t p = 0; p < k8; p += 8) {
+        __m256 vb[DQ];
+        for (size_t q = 0; q < DQ; ++q) {
+            vb[q] = _mm256_loadu_ps(cols[q] + p);
+        }
+        for (size_t r = 0; r < DR; ++r) {
+            __m256 va = _mm256_loadu_ps(rows[r] + p);
+            for (size_t q = 0; q < DQ; ++q) {
+                acc[r][q] = _mm256_fmadd_ps(va, vb[q], acc[r][q]);
+            }
+        }
+    }
+    if (k8 < k) {
+        __m256i tail = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(masks + 8 - k % 8));
+        __m256 vb[DQ];
+        for (size_t q = 0; q < DQ; ++q) {
+            vb[q] = _mm256_maskload_ps(cols[q] + k8, tail);
+        }
+        for (size_t r = 0; r < DR; ++r) {
+            __m256 va = _mm256_maskload_ps(rows[r] + k8, tail);
+            for (size_t q = 0; q < DQ; ++q) {
+                acc[r][q] = _mm256_fmadd_ps(va, vb[q], acc[r][q]);
+            }
+        }
+    }
+    for (size_t r = 0; r < std::min(DR, m); ++r) {
+        for (size_t q = 0; q < std::min(DQ, n); ++q) {
+            float &dst = c[r * ldc + q];
+            dst = update(alpha, reduce_avx2(acc[r][q]), beta, dst);
+        }
+    }
+}
+
+// the unpack intrinsics of GCC 12 warn about their undefined operand
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+// 16 accumulators, a tile of 8 rows fits the small batches
+__attribute__((target("avx512f"))) static void
+kernel_avx512(size_t kc, float const *a, size_t rsa, size_t csa,
+              float const *b, size_t ldb, float alpha, float beta, float *c,
+              size_t ldc) {
+    constexpr size_t MR = 8;
+    __m512 acc[MR][2];
+
+#pragma GCC unroll 8
+    for (size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm512_setzero_ps();
+        acc[r][1] = _mm512_setzero_ps();
+    }
+    for (size_t p = 0; p < kc; ++p, a += csa, b += ldb) {
+        __m512 b0 = _mm512_loadu_ps(b);
+        __m512 b1 = _mm512_loadu_ps(b + 16);
+#pragma GCC unroll 8
+        for (size_t r = 0; r < MR; ++r) {
+            __m512 ar = _mm512_set1_ps(a[r * rsa]);
+            acc[r][0] = _mm512_fmadd_ps(ar, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(ar, b1, acc[r][1]);
+        }
+    }
+    __m512 va = _mm512_set1_ps(alpha), vb = _mm512_set1_ps(beta);
+#pragma GCC unroll 8
+    for (size_t r = 0; r < MR; ++r) {
+        for (size_t h = 0; h < 2; ++h) {
+            float *dst = c + r * ldc + 16 * h;
+            __m512 v = _mm512_mul_ps(va, acc[r][h]);
+            if (beta != 0) {
+                v = _mm512_fmadd_ps(vb, _mm512_loadu_ps(dst), v);
+            }
+            _mm512_storeu_ps(dst, v);
+        }
+    }
+}
+
+// The sums of 16 registers in one: the registers are added in pairs after
+// interleaving them (unpack, then 128 bits shuffles), lane t is the sum of
+// acc[t / 4][t % 4].
+__attribute__((target("avx512f"))) static inline __m512
+reduce_avx512(__m512 const (&acc)[4][4]) {
+    __m512 x[8], y[4], z[2];
+
+    for (size_t t = 0; t < 8; ++t) {
+        __m512 a = acc[t / 2][t % 2 * 2], b = acc[t / 2][t % 2 * 2 + 1];
+        x[t] = _mm512_add_ps(_mm512_unpacklo_ps(a, b),
+                             _mm512_unpackhi_ps(a, b));
+    }
+    for (size_t t = 0; t < 4; ++t) {
+        __m512d a = _mm512_castps_pd(x[2 * t]);
+        __m512d b = _mm512_castps_pd(x[2 * t + 1]);
+        y[t] = _mm512_add_ps(_mm512_castpd_ps(_mm512_unpacklo_pd(a, b)),
+                             _mm512_castpd_ps(_mm512_unpackhi_pd(a, b)));
+    }
+    for (size_t t = 0; t < 2; ++t) {
+        z[t] = _mm512_add_ps(
+            _mm512_shuffle_f32x4(y[2 * t], y[2 * t + 1], 0x88),
+            _mm512_shuffle_f32x4(y[2 * t], y[2 * t + 1], 0xdd));
+    }
+    return _mm512_add_ps(_mm512_shuffle_f32x4(z[0], z[1], 0x88),
+                         _mm512_shuffle_f32x4(z[0], z[1], 0xdd));
+}
+
+// the rows of a 4 x 4 tile are the 128 bits lanes of sums
+__attribute__((target("avx512f"))) static inline void
+store_dot_avx512(__m512 sums, size_t m, size_t n, float alpha, float beta,
+                 float *c, size_t ldc) {
+    if (m >= 4 && n >= 4) {
+        sums = _mm512_mul_ps(_mm512_set1_ps(alpha), sums);
+        __m128 rows[4] = {_mm512_extractf32x4_ps(sums, 0),
+                          _mm512_extractf32x4_ps(sums, 1),
+                          _mm512_extractf32x4_ps(sums, 2),
+                          _mm512_extractf32x4_ps(sums, 3)};
+        for (size_t r = 0; r < 4; ++r) {
+            __m128 v = rows[r];
+            if (beta != 0) {
+                __m128 old = _mm_loadu_ps(c + r * ldc);
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(beta), old));
+            }
+            _mm_storeu_ps(c + r * ldc, v);
+        }
+        return;
+    }
+    alignas(64) float tile[16];
+    _mm512_store_ps(tile, sums);
+    for (size_t r = 0; r < std::min<size_t>(4, m); ++r) {
+        for (size_t q = 0; q < std::min<size_t>(4, n); ++q) {
+            float &dst = c[r * ldc + q];
+            dst = update(alpha, tile[r * 4 + q], beta, dst);
+        }
+    }
+}
+
+// 4 x 4 tiles: 16 accumulators, 4 registers for B and 1 for A, the tail of k
+// is masked
+__attribute__((target("avx512f"))) static void
+dot_kernel_avx512(size_t k, float const *a, size_t lda, size_t m,
+                  float const *b, size_t ldb, size_t n, float alpha,
+                  float beta, float *c, size_t ldc) {
+    constexpr size_t DR = 4, DQ = 4;
+    float const *rows[DR], *cols[DQ];
+    __m512 acc[DR][DQ];
+    size_t k16 = k - k % 16;
+
+    for (size_t r = 0; r < DR; ++r) {
+        rows[r] = a + std::min(r, m - 1) * lda;
+    }
+    for (size_t q = 0; q < DQ; ++q) {
+        cols[q] = b + std::min(q, n - 1) * ldb;
+    }
+    for (size_t r = 0; r < DR; ++r) {
+        for (size_t q = 0; q < DQ; ++q) {
+            acc[r][q] = _mm512_setzero_ps();
+        }
+    }
+    for (size_t p = 0; p < k16; p += 16) {
+        __m512 vb[DQ];
+        for (size_t q = 0; q < DQ; ++q) {
+            vb[q] = _mm512_loadu_ps(cols[q] + p);
+        }
+        for (size_t r = 0; r < DR; ++r) {
+            __m512 va = _mm512_loadu_ps(rows[r] + p);
+            for (size_t q = 0; q < DQ; ++q) {
+                acc[r][q] = _mm512_fmadd_ps(va, vb[q], acc[r][q]);
+            }
+        }
+    }
+    if (k16 < k) {
+        __mmask16 tail = (1u << (k % 16)) - 1;
+        __m512 vb[DQ];
+        for (size_t q = 0; q < DQ; ++q) {
+            vb[q] = _mm512_maskz_loadu_ps(tail, cols[q] + k16);
+        }
+        for (size_t r = 0; r < DR; ++r) {
+            __m512 va = _mm512_maskz_loadu_ps(tail, rows[r] + k16);
+            for (size_t q = 0; q < DQ; ++q) {
+                acc[r][q] = _mm512_fmadd_ps(va, vb[q], acc[r][q]);
+            }
+        }
+    }
+    store_dot_avx512(reduce_avx512(acc), m, n, alpha, beta, c, ldc);
+}
+
+#pragma GCC diagnostic pop
+
+/******************************************************************************/
+/*                                   gemm                                     */
+/******************************************************************************/
+
+namespace {
+
+// element (i, j) of a matrix is mem[i * rs + j * cs]
+struct Operand {
+    float const *mem;
+    size_t rs;
+    size_t cs;
+
+    Operand transposed() const { return {mem, cs, rs}; }
+};
+
+size_t round_up(size_t x, size_t multiple) {
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+// dst[p * ld + i] = x(i0 + i, p0 + p), the rows up to ld are zeros
+void pack(Operand const &x, size_t i0, size_t rows, size_t p0, size_t cols,
+          size_t ld, float *dst) {
+    float const *src = x.mem + i0 * x.rs + p0 * x.cs;
+
+    if (rows < ld) {
+        std::fill(dst, dst + cols * ld, 0.0f);
+    }
+    if (x.rs == 1) {
+        for (size_t p = 0; p < cols; ++p) {
+            std::memcpy(dst + p * ld, src + p * x.cs, rows * sizeof(float));
+        }
+    } else if (x.cs == 1) {
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t p = 0; p < cols; ++p) {
+                dst[p * ld + i] = src[i * x.rs + p];
+            }
+        }
+    } else {
+        for (size_t p = 0; p < cols; ++p) {
+            for (size_t i = 0; i < rows; ++i) {
+                dst[p * ld + i] = src[i * x.rs + p * x.cs];
+            }
+        }
+    }
+}
+
+// Returns size floats of the buffer aligned on a cache line. The buffers only
+// grow, so a warm product does not allocate.
+float *reserve(std::vector<float> &buffer, size_t size) {
+    constexpr size_t LINE = 64 / sizeof(float);
+
+    if (buffer.size() < size + LINE) {
+        buffer.resize(size + LINE);
+    }
+    size_t misalignment = reinterpret_cast<uintptr_t>(buffer.data()) % 64;
+    return buffer.data() + (LINE - misalignment / sizeof(float)) % LINE;
+}
+
+void scale(size_t m, size_t n, float beta, float *c, size_t ldc) {
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            c[i * ldc + j] = beta == 0 ? 0 : beta * c[i * ldc + j];
+        }
+    }
+}
+
+} // namespace
+
+// Blocked product (the loops of BLIS) over blocks of KC values of k, MC rows
+// of A and NC columns of B. The kernel reads the rows of A in place, and the
+// rows of B when they are contiguous (a panel of B stays in L1 over the rows
+// of a block), otherwise the panels of B are packed once per block. Only the
+// partial panels at the edges are packed with zeros. The full tiles are
+// written directly in C, the edges and the transposed C through a tile
+// buffer. The problem is transposed (C^T = B^T A^T) when the tiles waste
+// much less of it: the small batches are then spread along the vectors.
+template <size_t MR, size_t NR, Kernel kernel>
+static void gemm_blocked(size_t m, size_t n, size_t k, float alpha,
+                         Operand a, Operand b, float beta, float *c,
+                         size_t ldc) {
+    constexpr size_t KC = 256, MC = MR * 16, NC = NR * 64;
+    thread_local std::vector<float> pack_a, pack_b;
+    size_t area = round_up(m, MR) * round_up(n, NR);
+    size_t transposed_area = round_up(n, MR) * round_up(m, NR);
+    size_t rsc = ldc, csc = 1;
+
+    if (4 * transposed_area < 3 * area) {
+        std::swap(m, n);
+        std::swap(rsc, csc);
+        a = a.transposed();
+        b = b.transposed();
+        std::swap(a, b);
+    }
+    bool direct_b = b.cs == 1;
+    size_t kc_max = std::min(KC, k);
+    float *panel_a = reserve(pack_a, kc_max * MR);
+    size_t nc_max = direct_b ? NR : std::min(NC, round_up(n, NR));
+    float *panels_b = reserve(pack_b, kc_max * nc_max);
+
+    Operand bt = b.transposed();
+    for (size_t jc = 0; jc < n; jc += NC) {
+        size_t nc = std::min(NC, n - jc);
+        for (size_t pc = 0; pc < k; pc += KC) {
+            size_t kc = std::min(KC, k - pc);
+            float beta_pc = pc == 0 ? beta : 1;
+            for (size_t j = 0; j < nc; j += NR) {
+                if (!direct_b || nc - j < NR) {
+                    pack(bt, jc + j, std::min(NR, nc - j), pc, kc, NR,
+                         panels_b + (direct_b ? 0 : j * kc));
+                }
+            }
+            for (size_t ic = 0; ic < m; ic += MC) {
+                size_t mc = std::min(MC, m - ic);
+                if (mc % MR != 0) {
+                    pack(a, ic + mc - mc % MR, mc % MR, pc, kc, MR, panel_a);
+                }
+                for (size_t j = 0; j < nc; j += NR) {
+                    size_t nr = std::min(NR, nc - j);
+                    float const *pb = panels_b + (direct_b ? 0 : j * kc);
+                    size_t ldb = NR;
+                    if (direct_b && nr == NR) {
+                        pb = b.mem + pc * b.rs + jc + j;
+                        ldb = b.rs;
+                    }
+                    for (size_t i = 0; i < mc; i += MR) {
+                        size_t mr = std::min(MR, mc - i);
+                        float const *pa = a.mem + (ic + i) * a.rs + pc * a.cs;
+                        size_t rsa = a.rs, csa = a.cs;
+                        float *tile_c = c + (ic + i) * rsc + (jc + j) * csc;
+
+                        if (mr < MR) {
+                            pa = panel_a;
+                            rsa = 1;
+                            csa = MR;
+                        }
+                        if (csc == 1 && mr == MR && nr == NR) {
+                            kernel(kc, pa, rsa, csa, pb, ldb, alpha, beta_pc,
+                                   tile_c, rsc);
+                            continue;
+                        }
+                        alignas(64) float tile[MR * NR];
+                        kernel(kc, pa, rsa, csa, pb, ldb, 1, 0, tile, NR);
+                        // the inner loop follows the contiguous dimension
+                        if (csc == 1) {
+                            for (size_t r = 0; r < mr; ++r) {
+                                for (size_t q = 0; q < nr; ++q) {
+                                    float &dst = tile_c[r * rsc + q];
+                                    dst = update(alpha, tile[r * NR + q],
+                                                 beta_pc, dst);
+                                }
+                            }
+                        } else {
+                            for (size_t q = 0; q < nr; ++q) {
+                                for (size_t r = 0; r < mr; ++r) {
+                                    float &dst = tile_c[q * csc + r];
+                                    dst = update(alpha, tile[r * NR + q],
+                                                 beta_pc, dst);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Product as dot products of the rows of A and the columns of B, which are
+// packed when their k values are not contiguous. It is used when m or n is
+// small (the batches of a few samples) and k is long: the outer products
+// would waste most of the tile, or pack the large operand for little reuse.
+template <size_t DR, size_t DQ, DotKernel kernel>
+static void gemm_dot(size_t m, size_t n, size_t k, float alpha, Operand a,
+                     Operand b, float beta, float *c, size_t ldc) {
+    thread_local std::vector<float> pack_a, pack_b;
+    float const *rows = a.mem, *cols = b.mem;
+    size_t lda = a.rs, ldb = b.cs;
+    size_t ld = round_up(k, 16); // the packed rows start on a cache line
+
+    // the transpositions of the operands are written with 8 x 8 blocks
+    if (a.cs != 1) {
+        float *dst = reserve(pack_a, m * ld);
+        if (a.rs == 1) {
+            transpose_avx2(a.mem, a.cs, k, m, dst, ld);
+        } else {
+            pack(a.transposed(), 0, k, 0, m, ld, dst);
+        }
+        rows = dst;
+        lda = ld;
+    }
+    if (b.rs != 1) {
+        float *dst = reserve(pack_b, n * ld);
+        if (b.cs == 1) {
+            transpose_avx2(b.mem, b.rs, k, n, dst, ld);
+        } else {
+            pack(b, 0, k, 0, n, ld, dst);
+        }
+        cols = dst;
+        ldb = ld;
+    }
+    for (size_t i = 0; i < m; i += DR) {
+        for (size_t j = 0; j < n; j += DQ) {
+            kernel(k, rows + i * lda, lda, m - i, cols + j * ldb, ldb, n - j,
+                   alpha, beta, c + i * ldc + j, ldc);
+        }
+    }
+}
+
+// the dot products need a long k, and the large operand in place
+static bool use_dot(size_t m, size_t n, size_t k, Operand const &a,
+                    Operand const &b, size_t max_small) {
+    return k >= 64 && ((n <= max_small && a.cs == 1) ||
+                       (m <= max_small && b.rs == 1));
+}
+
+void sgemm_native(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+                  float alpha, float const *a, size_t lda, float const *b,
+                  size_t ldb, float beta, float *c, size_t ldc) {
+    Operand op_a = trans_a ? Operand{a, 1, lda} : Operand{a, lda, 1};
+    Operand op_b = trans_b ? Operand{b, 1, ldb} : Operand{b, ldb, 1};
+
+    if (m == 0 || n == 0) {
+        return;
+    }
+    if (k == 0 || alpha == 0) {
+        return scale(m, n, beta, c, ldc);
+    }
+    switch (simd_level()) {
+    case SimdLevel::AVX512:
+        if (use_dot(m, n, k, op_a, op_b, 16)) {
+            return gemm_dot<4, 4, dot_kernel_avx512>(m, n, k, alpha, op_a,
+                                                     op_b, beta, c, ldc);
+        }
+        return gemm_blocked<8, 32, kernel_avx512>(m, n, k, alpha, op_a, op_b,
+                                                  beta, c, ldc);
+    case SimdLevel::AVX2:
+        if (use_dot(m, n, k, op_a, op_b, 8)) {
+            return gemm_dot<2, 4, dot_kernel_avx2>(m, n, k, alpha, op_a, op_b,
+                                                   beta, c, ldc);
+        }
+        return gemm_blocked<6, 16, kernel_avx2>(m, n, k, alpha, op_a, op_b,
+                                                beta, c, ldc);
+    default:
+        return gemm_blocked<4, 8, kernel_scalar>(m, n, k, alpha, op_a, op_b,
+                                                 beta, c, ldc);
+    }
+}
+
+/******************************************************************************/
+/*                                   gemv                                     */
+/******************************************************************************/
+
+// The rows are dot products with x (4 rows at a time, x is read once for
+// them), the columns are sums of the rows scaled by x (a strip of columns is
+// accumulated in registers over all the rows).
+
+static void gemv_scalar(size_t m, size_t n, float alpha, float const *a,
+                        size_t lda, float const *x, float beta, float *y) {
+    for (size_t i = 0; i < m; ++i) {
+        float sum = 0;
+        for (size_t j = 0; j < n; ++j) {
+            sum += a[i * lda + j] * x[j];
+        }
+        y[i] = update(alpha, sum, beta, y[i]);
+    }
+}
+
+static void gemv_t_scalar(size_t m, size_t n, float alpha, float const *a,
+                          size_t lda, float const *x, float beta, float *y) {
+    constexpr size_t STRIP = 64;
+
+    for (size_t j0 = 0; j0 < n; j0 += STRIP) {
+        size_t width = std::min(STRIP, n - j0);
+        float acc[STRIP] = {};
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < width; ++j) {
+                acc[j] += a[i * lda + j0 + j] * x[i];
+            }
+        }
+        for (size_t j = 0; j < width; ++j) {
+            y[j0 + j] = update(alpha, acc[j], beta, y[j0 + j]);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma"))) static void
+gemv_avx2(size_t m, size_t n, float alpha, float const *a, size_t lda,
+          float const *x, float beta, float *y) {
+    size_t n8 = n - n % 8;
+    size_t i = 0;
+
+    for (; i + 4 <= m; i += 4) {
+        float const *row = a + i * lda;
+        __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(),
+                         _mm256_setzero_ps(), _mm256_setzero_ps()};
+        for (size_t j = 0; j < n8; j += 8) {
+            __m256 v = _mm256_loadu_ps(x + j);
+            for (size_t r = 0; r < 4; ++r) {
+                acc[r] = _mm256_fmadd_ps(_mm256_loadu_ps(row + r * lda + j),
+                                         v, acc[r]);
+            }
+        }
+        for (size_t r = 0; r < 4; ++r) {
+            float sum = reduce_avx2(acc[r]);
+            for (size_t j = n8; j < n; ++j) {
+                sum += row[r * lda + j] * x[j];
+            }
+            y[i + r] = update(alpha, sum, beta, y[i + r]);
+        }
+    }
+    for (; i < m; ++i) {
+        float const *row = a + i * lda;
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t j = 0; j < n8; j += 8) {
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(row + j),
+                                  _mm256_loadu_ps(x + j), acc);
+        }
+        float sum = reduce_avx2(acc);
+        for (size_t j = n8; j < n; ++j) {
+            sum += row[j] * x[j];
+        }
+        y[i] = update(alpha, sum, beta, y[i]);
+    }
+}
+
+__attribute__((target("avx2,fma"))) static void
+gemv_t_avx2(size_t m, size_t n, float alpha, float const *a, size_t lda,
+            float const *x, float beta, float *y) {
+    __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta);
+    size_t j = 0;
+
+    // strips of 32 columns, then of 8 columns
+    for (; j + 32 <= n; j += 32) {
+        __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(),
+                         _mm256_setzero_ps(), _mm256_setzero_ps()};
+        for (size_t i = 0; i < m; ++i) {
+            __m256 xi = _mm256_broadcast_ss(x + i);
+            for (size_t v = 0; v < 4; ++v) {
+                acc[v] = _mm256_fmadd_ps(
+                    _mm256_loadu_ps(a + i * lda + j + 8 * v), xi, acc[v]);
+            }
+        }
+        for (size_t v = 0; v < 4; ++v) {
+            __m256 r = _mm256_mul_ps(va, acc[v]);
+            if (beta != 0) {
+                r = _mm256_fmadd_ps(vb, _mm256_loadu_ps(y + j + 8 * v), r);
+            }
+            _mm256_storeu_ps(y + j + 8 * v, r);
+        }
+    }
+    for (; j + 8 <= n; j += 8) {
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t i = 0; i < m; ++i) {
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i * lda + j),
+                                  _mm256_broadcast_ss(x + i), acc);
+        }
+        __m256 r = _mm256_mul_ps(va, acc);
+        if (beta != 0) {
+            r = _mm256_fmadd_ps(vb, _mm256_loadu_ps(y + j), r);
+        }
+        _mm256_storeu_ps(y + j, r);
+    }
+    if (j < n) {
+        gemv_t_scalar(m, n - j, alpha, a + j, lda, x, beta, y + j);
+    }
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// the tails are masked
+__attribute__((target("avx512f"))) static void
+gemv_avx512(size_t m, size_t n, float alpha, float const *a, size_t lda,
+            float const *x, float beta, float *y) {
+    size_t n16 = n - n % 16;
+    __mmask16 tail = (1u << (n % 16)) - 1;
+    size_t i = 0;
+
+    for (; i + 4 <= m; i += 4) {
+        float const *row = a + i * lda;
+        __m512 acc[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(),
+                         _mm512_setzero_ps(), _mm512_setzero_ps()};
+        for (size_t j = 0; j < n16; j += 16) {
+            __m512 v = _mm512_loadu_ps(x + j);
+            for (size_t r = 0; r < 4; ++r) {
+                acc[r] = _mm512_fmadd_ps(_mm512_loadu_ps(row + r * lda + j),
+                                         v, acc[r]);
+            }
+        }
+        if (tail) {
+            __m512 v = _mm512_maskz_loadu_ps(tail, x + n16);
+            for (size_t r = 0; r < 4; ++r) {
+                acc[r] = _mm512_fmadd_ps(
+                    _mm512_maskz_loadu_ps(tail, row + r * lda + n16), v,
+                    acc[r]);
+            }
+        }
+        for (size_t r = 0; r < 4; ++r) {
+            y[i + r] = update(alpha, _mm512_reduce_add_ps(acc[r]), beta,
+                              y[i + r]);
+        }
+    }
+    for (; i < m; ++i) {
+        float const *row = a + i * lda;
+        __m512 acc = _mm512_setzero_ps();
+        for (size_t j = 0; j < n16; j += 16) {
+            acc = _mm512_fmadd_ps(_mm512_loadu_ps(row + j),
+                                  _mm512_loadu_ps(x + j), acc);
+        }
+        acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail, row + n16),
+                              _mm512_maskz_loadu_ps(tail, x + n16), acc);
+        y[i] = update(alpha, _mm512_reduce_add_ps(acc), beta, y[i]);
+    }
+}
+
+__attribute__((target("avx512f"))) static void
+gemv_t_avx512(size_t m, size_t n, float alpha, float const *a, size_t lda,
+              float const *x, float beta, float *y) {
+    __m512 va = _mm512_set1_ps(alpha), vb = _mm512_set1_ps(beta);
+
+    for (size_t j = 0; j < n; j += 64) {
+        __mmask16 masks[4];
+        __m512 acc[4];
+        for (size_t v = 0; v < 4; ++v) {
+            size_t first = j + 16 * v;
+            size_t count = first < n ? std::min<size_t>(16, n - first) : 0;
+            masks[v] = (uint32_t(1) << count) - 1;
+            acc[v] = _mm512_setzero_ps();
+        }
+        for (size_t i = 0; i < m; ++i) {
+            __m512 xi = _mm512_set1_ps(x[i]);
+            for (size_t v = 0; v < 4; ++v) {
+                acc[v] = _mm512_fmadd_ps(
+                    _mm512_maskz_loadu_ps(masks[v], a + i * lda + j + 16 * v),
+                    xi, acc[v]);
+            }
+        }
+        for (size_t v = 0; v < 4; ++v) {
+            __m512 r = _mm512_mul_ps(va, acc[v]);
+            if (beta != 0) {
+                r = _mm512_fmadd_ps(
+                    vb, _mm512_maskz_loadu_ps(masks[v], y + j + 16 * v), r);
+            }
+            _mm512_mask_storeu_ps(y + j + 16 * v, masks[v], r);
+        }
+    }
+}
+
+#pragma GCC diagnostic pop
+
+void sgemv_native(bool trans, size_t m, size_t n, float alpha, float const *a,
+                  size_t lda, float const *x, int incx, float beta, float *y,
+                  int incy) {
+    size_t size_x = trans ? m : n, size_y = trans ? n : m;
+
+    if (incx != 1 || incy != 1) {
+        // strided vectors: through the gemm (x is a column of B, y of C)
+        assert(incx > 0 && incy > 0);
+        if (trans) {
+            return sgemm_native(true, false, n, 1, m, alpha, a, lda, x, incx,
+                                beta, y, incy);
+        }
+        return sgemm_native(false, false, m, 1, n, alpha, a, lda, x, incx,
+                            beta, y, incy);
+    }
+    if (size_y == 0) {
+        return;
+    }
+    if (size_x == 0 || alpha == 0) {
+        return scale(1, size_y, beta, y, size_y);
+    }
+    switch (simd_level()) {
+    case SimdLevel::AVX512:
+        return trans ? gemv_t_avx512(m, n, alpha, a, lda, x, beta, y)
+                     : gemv_avx512(m, n, alpha, a, lda, x, beta, y);
+    case SimdLevel::AVX2:
+        return trans ? gemv_t_avx2(m, n, alpha, a, lda, x, beta, y)
+                     : gemv_avx2(m, n, alpha, a, lda, x, beta, y);
+    default:
+        return trans ? gemv_t_scalar(m, n, alpha, a, lda, x, beta, y)
+                     : gemv_scalar(m, n, alpha, a, lda, x, beta, y);
+    }
+}
+
+/******************************************************************************/
+/*                              16 bits weights                               */
+/******************************************************************************/
+
+// floats of the decoded blocks: a gemm block stays in L2 while the kernels
+// read it, a gemv block in L1
+static constexpr size_t GEMM_HALF_BLOCK = 128 * 1024;
+static constexpr size_t GEMV_HALF_BLOCK = 8 * 1024;
+
+// decode the rows [i0, i0 + rows) of A in a thread local buffer, with a row
+// stride of ld
+static float *decode_rows(Precision precision, uint16_t const *a, size_t lda,
+                          size_t i0, size_t rows, size_t k, size_t ld) {
+    thread_local std::vector<float> decoded;
+    float *dst = reserve(decoded, rows * ld);
+
+    for (size_t i = 0; i < rows; ++i) {
+        from_half(precision, std::span(a + (i0 + i) * lda, k),
+                  std::span(dst + i * ld, k));
+    }
+    return dst;
+}
+
+void sgemm_native_half(Precision precision, bool trans_b, size_t m, size_t n,
+                       size_t k, float alpha, uint16_t const *a, size_t lda,
+                       float const *b, size_t ldb, float beta, float *c,
+                       size_t ldc) {
+    size_t ld = round_up(std::max<size_t>(k, 1), 16);
+    size_t block = std::max<size_t>(16, GEMM_HALF_BLOCK / ld / 16 * 16);
+
+    for (size_t i0 = 0; i0 < m; i0 += block) {
+        size_t rows = std::min(block, m - i0);
+        float const *rows_a = decode_rows(precision, a, lda, i0, rows, k, ld);
+        sgemm_native(false, trans_b, rows, n, k, alpha, rows_a, ld, b, ldb,
+                     beta, c + i0 * ldc, ldc);
+    }
+}
+
+void sgemv_native_half(Precision precision, size_t m, size_t n, float alpha,
+                       uint16_t const *a, size_t lda, float const *x,
+                       float beta, float *y) {
+    size_t ld = round_up(std::max<size_t>(n, 1), 16);
+    size_t block = std::max<size_t>(1, GEMV_HALF_BLOCK / ld);
+
+    for (size_t i0 = 0; i0 < m; i0 += block) {
+        size_t rows = std::min(block, m - i0);
+        float const *rows_a = decode_rows(precision, a, lda, i0, rows, n, ld);
+        sgemv_native(false, rows, n, alpha, rows_a, ld, x, 1, beta, y + i0, 1);
+    }
+}
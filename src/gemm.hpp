@@ -0,0 +1,57 @@
+#ifndef GEMM_H
+#define GEMM_H
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Backends of the gemm and gemv helpers of math.hpp. OpenBLAS is used when the
+ * library is built with it (NN_OPENBLAS), otherwise and on request the native
+ * kernels below are used. The backend can be chosen with the NN_GEMM
+ * environment variable (openblas or native) or with the setter.
+ */
+enum class GemmBackend { OpenBLAS, Native };
+
+GemmBackend gemm_backend();
+/* the OpenBLAS backend is only available with NN_OPENBLAS */
+void gemm_backend(GemmBackend backend);
+char const *gemm_backend_name(GemmBackend backend);
+
+/*
+ * Native single precision products on row major matrices, with the same
+ * semantics as cblas_sgemm and cblas_sgemv (beta = 0 does not read C or y).
+ * The product is blocked for the caches and computed by AVX-512, AVX2 or
+ * scalar register tiles selected like the kernels of kernels.hpp (NN_SIMD).
+ * The operands are read in place when their layout allows it, otherwise
+ * packed in thread local buffers. The skinny products of the layers (a batch
+ * of a few samples against a long k) are computed as dot products, and the
+ * outer products are transposed when the tiles waste less of the problem.
+ * The kernels are single threaded.
+ */
+
+/* C = alpha * op(A) * op(B) + beta * C, op(A) is m x k and op(B) is k x n */
+void sgemm_native(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+                  float alpha, float const *a, size_t lda, float const *b,
+                  size_t ldb, float beta, float *c, size_t ldc);
+/* y = alpha * op(A) * x + beta * y, A is m x n */
+void sgemv_native(bool trans, size_t m, size_t n, float alpha, float const *a,
+                  size_t lda, float const *x, int incx, float beta, float *y,
+                  int incy);
+
+/*
+ * Same products with A (not transposed) stored in bf16 or fp16 (see
+ * Precision in kernels.hpp). The rows of A are decoded by blocks that stay in
+ * the caches and multiplied by the native fp32 kernels, so A is read once
+ * from memory in 16 bits and the sums are accumulated in fp32. Both backends
+ * use these kernels for the 16 bits weights.
+ */
+enum class Precision;
+
+void sgemm_native_half(Precision precision, bool trans_b, size_t m, size_t n,
+                       size_t k, float alpha, uint16_t const *a, size_t lda,
+                       float const *b, size_t ldb, float beta, float *c,
+                       size_t ldc);
+void sgemv_native_half(Precision precision, size_t m, size_t n, float alpha,
+                       uint16_t const *a, size_t lda, float const *x,
+                       float beta, float *y);
+
+#endif
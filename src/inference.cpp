@@ -0,0 +1,118 @@
+#include "inference.hpp"
+#include <algorithm>
+#include <cassert>
+#include <memory>
+
+template <ActivationFunctionType Act>
+BasicInferenceSession<Act>::BasicInferenceSession(Model const *model,
+                                                  Act *activation,
+                                                  size_t max_batch)
+    : model_(model), activation_(activation), max_batch_(max_batch) {
+    size_t max_width = 0;
+
+    assert(!model_->layers.empty() && max_batch > 0);
+    for (auto const &layer : model_->layers) {
+        max_width = std::max(max_width, layer.nb_nodes);
+    }
+    ping_.resize(max_width * max_batch);
+    pong_.resize(max_width * max_batch);
+    input_.resize(nb_inputs() * max_batch);
+}
+
+template <ActivationFunctionType Act>
+std::span<ftype const>
+BasicInferenceSession<Act>::predict(std::span<ftype const> input) {
+    assert(input.size() == nb_inputs());
+    size_t L = model_->layers.size();
+    ftype const *a = input.data();
+    ftype *z = ping_.data();
+
+    for (size_t l = 0; l < L; ++l) {
+        Layer const &layer = model_->layers[l];
+
+        std::copy_n(layer.biases.mem, layer.nb_nodes, z);
+        if (uint16_t const *w = model_->half_weights(l)) {
+            sgemv_native_half(model_->half_precision(), layer.nb_nodes,
+                              layer.nb_inputs, 1.0, w, layer.nb_inputs, a,
+                              1.0, z);
+        } else {
+            gemv<ftype>(CblasNoTrans, layer.nb_nodes, layer.nb_inputs, 1.0,
+                        layer.weights.mem, layer.nb_inputs, a, 1, 1.0, z, 1);
+        }
+        activation_->execute(std::span<ftype const>(z, layer.nb_nodes),
+                             std::span<ftype>(z, layer.nb_nodes));
+        if (l + 1 == L) {
+            break;
+        }
+        a = z;
+        z = z == ping_.data() ? pong_.data() : ping_.data();
+    }
+    return {z, nb_outputs()};
+}
+
+template <ActivationFunctionType Act>
+Label BasicInferenceSession<Act>::classify(std::span<ftype const> input) {
+    std::span<ftype const> y = predict(input);
+    return std::max_element(y.begin(), y.end()) - y.begin();
+}
+
+template <ActivationFunctionType Act>
+Matrix const &
+BasicInferenceSession<Act>::predict_batch(std::span<ftype const> inputs) {
+    size_t n = inputs.size() / nb_inputs();
+    size_t L = model_->layers.size();
+    ftype const *a = nullptr;
+    ftype *z = ping_.data();
+
+    assert(n > 0 && n <= max_batch_ && n * nb_inputs() == inputs.size());
+    for (size_t l = 0; l < L; ++l) {
+        Layer const &layer = model_->layers[l];
+
+        for (size_t r = 0; r < layer.nb_nodes; ++r) {
+            std::fill(z + r * n, z + (r + 1) * n, layer.biases[r]);
+        }
+        // the rows of the inputs are the transposed input
+        bool trans_b = l == 0;
+        ftype const *b = l == 0 ? inputs.data() : a;
+        size_t ldb = l == 0 ? layer.nb_inputs : n;
+
+        if (uint16_t const *w = model_->half_weights(l)) {
+            sgemm_native_half(model_->half_precision(), trans_b,
+                              layer.nb_nodes, n, layer.nb_inputs, 1.0, w,
+                              layer.nb_inputs, b, ldb, 1.0, z, n);
+        } else {
+            gemm<ftype>(CblasNoTrans, trans_b ? CblasTrans : CblasNoTrans,
+                        layer.nb_nodes, n, layer.nb_inputs, 1.0,
+                        layer.weights.mem, layer.nb_inputs, b, ldb, 1.0, z, n);
+        }
+        activation_->execute(std::span<ftype const>(z, layer.nb_nodes * n),
+                             std::span<ftype>(z, layer.nb_nodes * n));
+        if (l + 1 == L) {
+            break;
+        }
+        a = z;
+        z = z == ping_.data() ? pong_.data() : ping_.data();
+    }
+
+    // the output is rebuilt in place, assigning to a view would copy into it
+    std::destroy_at(&output_);
+    std::construct_at(&output_, Matrix::view(z, nb_outputs(), n));
+    return output_;
+}
+
+template <ActivationFunctionType Act>
+Matrix const &BasicInferenceSession<Act>::predict_batch(DataSet const &ds,
+                                                        size_t first,
+                                                        size_t count) {
+    assert(ds.nb_inputs() == nb_inputs() && count <= max_batch_);
+    if (ds.is_encoded()) {
+        std::span<ftype> inputs(input_.data(), count * nb_inputs());
+        ds.inputs(first, count, inputs);
+        return predict_batch(inputs);
+    }
+    return predict_batch(std::span<ftype const>(ds.input(first).data(),
+                                                count * nb_inputs()));
+}
+
+template class BasicInferenceSession<ActivationFunction>;
+template class BasicInferenceSession<Sigmoid>;
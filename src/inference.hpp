@@ -0,0 +1,57 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+#include "functions.hpp"
+#include "model.hpp"
+#include "types.hpp"
+#include <span>
+#include <vector>
+
+/*
+ * Inference only forward pass of a model. The activations go through two
+ * buffers (ping and pong) sized for the widest layer and max_batch samples,
+ * which are allocated once, so the predictions do not allocate. The model is
+ * only read: the sessions of several threads can share it. A session itself
+ * is used by one thread at a time.
+ *
+ * One sample is computed with one gemv per layer, and a batch with one gemm
+ * per layer (the samples are the columns of the activations). When the model
+ * has a 16 bits copy of its weights, the products read it (see
+ * Model::half_precision). The results are views on the buffers of the
+ * session, valid until its next prediction.
+ */
+template <ActivationFunctionType Act>
+class BasicInferenceSession {
+  public:
+    BasicInferenceSession(Model const *model, Act *activation,
+                          size_t max_batch = 1);
+
+  public:
+    size_t nb_inputs() const { return model_->layers.front().nb_inputs; }
+    size_t nb_outputs() const { return model_->layers.back().nb_nodes; }
+    size_t max_batch() const { return max_batch_; }
+
+    /* activations of the output layer for one input */
+    std::span<ftype const> predict(std::span<ftype const> input);
+    /* class of one input (first maximum of the outputs) */
+    Label classify(std::span<ftype const> input);
+
+    /* (outputs x n) activations for the n inputs stored as (n x inputs) rows,
+     * n <= max_batch */
+    Matrix const &predict_batch(std::span<ftype const> inputs);
+    /* same for the samples [first, first + count) of the dataset (the raw
+     * and 16 bits inputs are decoded first) */
+    Matrix const &predict_batch(DataSet const &ds, size_t first, size_t count);
+
+  private:
+    Model const *model_ = nullptr;
+    Act *activation_ = nullptr;
+    size_t max_batch_ = 1;
+    std::vector<ftype> ping_ = {};
+    std::vector<ftype> pong_ = {};
+    std::vector<ftype> input_ = {}; // decoded inputs of the datasets
+    Matrix output_ = {};            // view on ping_ or pong_
+};
+
+using InferenceSession = BasicInferenceSession<ActivationFunction>;
+
+#endif
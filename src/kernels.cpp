@@ -0,0 +1,817 @@
+#include "kernels.hpp"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include <type_traits>
+
+/******************************************************************************/
+/*                                 fast exp                                   */
+/******************************************************************************/
+
+// exp(x) = 2^n * exp(r) with n = round(x / ln2) and r = x - n * ln2
+static constexpr float EXP_MIN = -87.0f;
+static constexpr float EXP_MAX = 88.0f;
+static constexpr float LOG2E = 1.44269504088896341f;
+static constexpr float LN2_HI = 0.693359375f;
+static constexpr float LN2_LO = -2.12194440e-4f;
+static constexpr float P0 = 1.0f;
+static constexpr float P1 = 1.0f;
+static constexpr float P2 = 1.0f / 2;
+static constexpr float P3 = 1.0f / 6;
+static constexpr float P4 = 1.0f / 24;
+static constexpr float P5 = 1.0f / 120;
+static constexpr float P6 = 1.0f / 720;
+
+// Scalar version of the approximation, used for the tails of the SIMD loops so
+// the result of an element does not depend on its position.
+static float fast_exp(float x) {
+    x = std::fmin(std::fmax(x, EXP_MIN), EXP_MAX);
+    float n = std::nearbyint(x * LOG2E);
+    float r = std::fma(-n, LN2_LO, std::fma(-n, LN2_HI, x));
+    float p = P6;
+
+    p = std::fma(p, r, P5);
+    p = std::fma(p, r, P4);
+    p = std::fma(p, r, P3);
+    p = std::fma(p, r, P2);
+    p = std::fma(p, r, P1);
+    p = std::fma(p, r, P0);
+
+    int32_t bits = (static_cast<int32_t>(n) + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+static float fast_sigmoid(float x) { return 1.0f / (1.0f + fast_exp(-x)); }
+
+/******************************************************************************/
+/*                                   Adam                                     */
+/******************************************************************************/
+
+// Also used for the tails of the SIMD loops.
+template <typename T>
+static void adam_update_scalar(AdamStep const &step, T *w, T *m, T *v,
+                               T const *g, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        T mi = step.b1 * m[i] + (1 - step.b1) * g[i];
+        T vi = step.b2 * v[i] + (1 - step.b2) * g[i] * g[i];
+        m[i] = mi;
+        v[i] = vi;
+        w[i] -= step.learning_rate * (mi * step.c1) /
+                (std::sqrt(vi * step.c2) + step.sigma);
+    }
+}
+
+/******************************************************************************/
+/*                                 normalize                                  */
+/******************************************************************************/
+
+// Also used for the tails of the SIMD loops. The conversion of a byte is exact,
+// so all the versions give the same result.
+template <typename T>
+static void normalize_scalar(uint8_t const *in, T scale, T *out, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        out[i] = (T)in[i] * scale;
+    }
+}
+
+/******************************************************************************/
+/*                              half precision                                */
+/******************************************************************************/
+
+// Round to the nearest even bf16. Like the AVX-512 BF16 instruction, the NaNs
+// are made quiet and the subnormal inputs are flushed to zero, so all the
+// versions give the same result.
+static uint16_t to_bf16_scalar(float x) {
+    uint32_t u = std::bit_cast<uint32_t>(x);
+
+    if ((u & 0x7fffffff) > 0x7f800000) {
+        return (uint16_t)((u >> 16) | 0x40);
+    }
+    if ((u & 0x7f800000) == 0) {
+        return (uint16_t)((u >> 16) & 0x8000);
+    }
+    return (uint16_t)((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+}
+
+// The conversions of _Float16 are exact or rounded to the nearest even, as
+// with F16C.
+template <typename T>
+static void to_half_scalar(Precision precision, T const *in, uint16_t *out,
+                           size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        out[i] = precision == Precision::BF16
+                     ? to_bf16_scalar((float)in[i])
+                     : std::bit_cast<uint16_t>((_Float16)in[i]);
+    }
+}
+
+template <typename T>
+static void from_half_scalar(Precision precision, uint16_t const *in, T *out,
+                             size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        out[i] = precision == Precision::BF16
+                     ? (T)std::bit_cast<float>((uint32_t)in[i] << 16)
+                     : (T)std::bit_cast<_Float16>(in[i]);
+    }
+}
+
+/******************************************************************************/
+/*                              int8 dot product                              */
+/******************************************************************************/
+
+// The values are clamped before the conversion (NaN -> 0), which rounds to the
+// nearest even like the SIMD conversions.
+template <typename T>
+static void quantize_scalar(T const *in, T scale, uint8_t *out, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        T x = in[i] * scale;
+        x = x > 0 ? x : 0;
+        out[i] = (uint8_t)std::nearbyint(std::min<T>(x, 255));
+    }
+}
+
+static void gemv_s8u8_scalar(int8_t const *w, size_t stride, uint8_t const *a,
+                             int32_t *out, size_t nb_rows) {
+    for (size_t r = 0; r < nb_rows; ++r) {
+        int32_t sum = 0;
+        for (size_t k = 0; k < stride; ++k) {
+            sum += (int32_t)w[r * stride + k] * (int32_t)a[k];
+        }
+        out[r] = sum;
+    }
+}
+
+/******************************************************************************/
+/*                                   AVX2                                     */
+/******************************************************************************/
+
+__attribute__((target("avx2"))) static void
+normalize_avx2(uint8_t const *in, float scale, float *out, size_t size) {
+    __m256 s = _mm256_set1_ps(scale);
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m128i bytes =
+            _mm_loadl_epi64(reinterpret_cast<__m128i const *>(in + i));
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(x, s));
+    }
+    normalize_scalar(in + i, scale, out + i, size - i);
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256
+exp_avx2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)),
+                      _mm256_set1_ps(EXP_MAX));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)),
+                               _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_HI), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_LO), r);
+
+    __m256 p = _mm256_set1_ps(P6);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P5));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(P0));
+
+    __m256i bits = _mm256_slli_epi32(
+        _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256
+sigmoid_avx2(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 e = exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), x));
+    return _mm256_div_ps(one, _mm256_add_ps(one, e));
+}
+
+__attribute__((target("avx2,fma"))) static void
+sigmoid_and_derivative_avx2(float const *in, float *out, float *out_prime,
+                            size_t size) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m256 s = sigmoid_avx2(_mm256_loadu_ps(in + i));
+        if (out) {
+            _mm256_storeu_ps(out + i, s);
+        }
+        if (out_prime) {
+            _mm256_storeu_ps(out_prime + i,
+                             _mm256_mul_ps(s, _mm256_sub_ps(one, s)));
+        }
+    }
+    for (; i < size; ++i) {
+        float s = fast_sigmoid(in[i]);
+        if (out) {
+            out[i] = s;
+        }
+        if (out_prime) {
+            out_prime[i] = s * (1.0f - s);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma"))) static void
+adam_update_avx2(AdamStep const &step, float *w, float *m, float *v,
+                 float const *g, size_t size) {
+    __m256 b1 = _mm256_set1_ps(step.b1);
+    __m256 b2 = _mm256_set1_ps(step.b2);
+    __m256 one_b1 = _mm256_set1_ps(1 - step.b1);
+    __m256 one_b2 = _mm256_set1_ps(1 - step.b2);
+    __m256 c1 = _mm256_set1_ps(step.c1);
+    __m256 c2 = _mm256_set1_ps(step.c2);
+    __m256 lr = _mm256_set1_ps(step.learning_rate);
+    __m256 sigma = _mm256_set1_ps(step.sigma);
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m256 gi = _mm256_loadu_ps(g + i);
+        __m256 mi = _mm256_mul_ps(one_b1, gi);
+        __m256 vi = _mm256_mul_ps(_mm256_mul_ps(one_b2, gi), gi);
+        mi = _mm256_fmadd_ps(b1, _mm256_loadu_ps(m + i), mi);
+        vi = _mm256_fmadd_ps(b2, _mm256_loadu_ps(v + i), vi);
+        _mm256_storeu_ps(m + i, mi);
+        _mm256_storeu_ps(v + i, vi);
+
+        __m256 den =
+            _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(vi, c2)), sigma);
+        __m256 delta = _mm256_div_ps(_mm256_mul_ps(lr, _mm256_mul_ps(mi, c1)),
+                                     den);
+        _mm256_storeu_ps(w + i, _mm256_sub_ps(_mm256_loadu_ps(w + i), delta));
+    }
+    adam_update_scalar(step, w + i, m + i, v + i, g + i, size - i);
+}
+
+__attribute__((target("avx2"))) static inline __m128i
+to_bf16_avx2(__m256 x) {
+    __m256i u = _mm256_castps_si256(x);
+    __m256i abs = _mm256_and_si256(u, _mm256_set1_epi32(0x7fffffff));
+    __m256i exponent = _mm256_and_si256(u, _mm256_set1_epi32(0x7f800000));
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(u, 16),
+                                   _mm256_set1_epi32(1));
+    __m256i rounded = _mm256_srli_epi32(
+        _mm256_add_epi32(u, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff))),
+        16);
+    __m256i nan = _mm256_or_si256(_mm256_srli_epi32(u, 16),
+                                  _mm256_set1_epi32(0x40));
+    __m256i zero = _mm256_and_si256(_mm256_srli_epi32(u, 16),
+                                    _mm256_set1_epi32(0x8000));
+    __m256i r = _mm256_blendv_epi8(
+        rounded, zero,
+        _mm256_cmpeq_epi32(exponent, _mm256_setzero_si256()));
+    r = _mm256_blendv_epi8(
+        r, nan, _mm256_cmpgt_epi32(abs, _mm256_set1_epi32(0x7f800000)));
+    // pack the 32 bits lanes (< 2^16) into 16 bits
+    __m256i packed = _mm256_packus_epi32(r, r);
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, 0x08));
+}
+
+__attribute__((target("avx2,f16c"))) static void
+to_half_avx2(Precision precision, float const *in, uint16_t *out,
+             size_t size) {
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m256 x = _mm256_loadu_ps(in + i);
+        __m128i h = precision == Precision::BF16
+                        ? to_bf16_avx2(x)
+                        : _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT |
+                                                 _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), h);
+    }
+    to_half_scalar(precision, in + i, out + i, size - i);
+}
+
+__attribute__((target("avx2,f16c"))) static void
+from_half_avx2(Precision precision, uint16_t const *in, float *out,
+               size_t size) {
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i));
+        __m256 x = precision == Precision::BF16
+                       ? _mm256_castsi256_ps(
+                             _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16))
+                       : _mm256_cvtph_ps(h);
+        _mm256_storeu_ps(out + i, x);
+    }
+    from_half_scalar(precision, in + i, out + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void
+quantize_avx2(float const *in, float scale, uint8_t *out, size_t size) {
+    __m256 s = _mm256_set1_ps(scale);
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_loadu_ps(in + i), s);
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()),
+                          _mm256_set1_ps(255));
+        __m256i q = _mm256_cvtps_epi32(x);
+        __m128i q16 = _mm_packus_epi32(_mm256_castsi256_si128(q),
+                                       _mm256_extracti128_si256(q, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i),
+                         _mm_packus_epi16(q16, q16));
+    }
+    quantize_scalar(in + i, scale, out + i, size - i);
+}
+
+// The bytes are widened to 16 bits: maddubs would saturate on 255 * 127 * 2.
+__attribute__((target("avx2"))) static void
+gemv_s8u8_avx2(int8_t const *w, size_t stride, uint8_t const *a, int32_t *out,
+               size_t nb_rows) {
+    for (size_t r = 0; r < nb_rows; ++r) {
+        int8_t const *row = w + r * stride;
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t k = 0; k < stride; k += 16) {
+            __m256i x = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128(reinterpret_cast<__m128i const *>(a + k)));
+            __m256i y = _mm256_cvtepi8_epi16(
+                _mm_loadu_si128(reinterpret_cast<__m128i const *>(row + k)));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, y));
+        }
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                    _mm256_extracti128_si256(acc, 1));
+        sum = _mm_hadd_epi32(sum, sum);
+        sum = _mm_hadd_epi32(sum, sum);
+        out[r] = _mm_cvtsi128_si32(sum);
+    }
+}
+
+/******************************************************************************/
+/*                                  AVX-512                                   */
+/******************************************************************************/
+
+// GCC 12 reports the undefined registers used in the avx512 intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f"))) static inline __m512 exp_avx512(__m512 x) {
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_MIN)),
+                      _mm512_set1_ps(EXP_MAX));
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(LOG2E)),
+                                    _MM_FROUND_TO_NEAREST_INT |
+                                        _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_HI), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_LO), r);
+
+    __m512 p = _mm512_set1_ps(P6);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P5));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(P0));
+
+    __m512i bits = _mm512_slli_epi32(
+        _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(bits));
+}
+
+__attribute__((target("avx512f"))) static void
+sigmoid_and_derivative_avx512(float const *in, float *out, float *out_prime,
+                              size_t size) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m512 x = _mm512_loadu_ps(in + i);
+        __m512 e = exp_avx512(_mm512_sub_ps(_mm512_setzero_ps(), x));
+        __m512 s = _mm512_div_ps(one, _mm512_add_ps(one, e));
+        if (out) {
+            _mm512_storeu_ps(out + i, s);
+        }
+        if (out_prime) {
+            _mm512_storeu_ps(out_prime + i,
+                             _mm512_mul_ps(s, _mm512_sub_ps(one, s)));
+        }
+    }
+    for (; i < size; ++i) {
+        float s = fast_sigmoid(in[i]);
+        if (out) {
+            out[i] = s;
+        }
+        if (out_prime) {
+            out_prime[i] = s * (1.0f - s);
+        }
+    }
+}
+
+__attribute__((target("avx512f"))) static void
+normalize_avx512(uint8_t const *in, float scale, float *out, size_t size) {
+    __m512 s = _mm512_set1_ps(scale);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes =
+            _mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i));
+        __m512 x = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes));
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(x, s));
+    }
+    normalize_scalar(in + i, scale, out + i, size - i);
+}
+
+__attribute__((target("avx512f"))) static void
+adam_update_avx512(AdamStep const &step, float *w, float *m, float *v,
+                   float const *g, size_t size) {
+    __m512 b1 = _mm512_set1_ps(step.b1);
+    __m512 b2 = _mm512_set1_ps(step.b2);
+    __m512 one_b1 = _mm512_set1_ps(1 - step.b1);
+    __m512 one_b2 = _mm512_set1_ps(1 - step.b2);
+    __m512 c1 = _mm512_set1_ps(step.c1);
+    __m512 c2 = _mm512_set1_ps(step.c2);
+    __m512 lr = _mm512_set1_ps(step.learning_rate);
+    __m512 sigma = _mm512_set1_ps(step.sigma);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m512 gi = _mm512_loadu_ps(g + i);
+        __m512 mi = _mm512_mul_ps(one_b1, gi);
+        __m512 vi = _mm512_mul_ps(_mm512_mul_ps(one_b2, gi), gi);
+        mi = _mm512_fmadd_ps(b1, _mm512_loadu_ps(m + i), mi);
+        vi = _mm512_fmadd_ps(b2, _mm512_loadu_ps(v + i), vi);
+        _mm512_storeu_ps(m + i, mi);
+        _mm512_storeu_ps(v + i, vi);
+
+        __m512 den =
+            _mm512_add_ps(_mm512_sqrt_ps(_mm512_mul_ps(vi, c2)), sigma);
+        __m512 delta = _mm512_div_ps(_mm512_mul_ps(lr, _mm512_mul_ps(mi, c1)),
+                                     den);
+        _mm512_storeu_ps(w + i, _mm512_sub_ps(_mm512_loadu_ps(w + i), delta));
+    }
+    adam_update_scalar(step, w + i, m + i, v + i, g + i, size - i);
+}
+
+__attribute__((target("avx512f"))) static inline __m256i
+to_bf16_avx512(__m512 x) {
+    __m512i u = _mm512_castps_si512(x);
+    __m512i shifted = _mm512_srli_epi32(u, 16);
+    __m512i lsb = _mm512_and_si512(shifted, _mm512_set1_epi32(1));
+    __m512i r = _mm512_srli_epi32(
+        _mm512_add_epi32(u, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7fff))),
+        16);
+    __mmask16 zero = _mm512_testn_epi32_mask(u, _mm512_set1_epi32(0x7f800000));
+    __mmask16 nan = _mm512_cmpgt_epi32_mask(
+        _mm512_and_si512(u, _mm512_set1_epi32(0x7fffffff)),
+        _mm512_set1_epi32(0x7f800000));
+    r = _mm512_mask_and_epi32(r, zero, shifted, _mm512_set1_epi32(0x8000));
+    r = _mm512_mask_or_epi32(r, nan, shifted, _mm512_set1_epi32(0x40));
+    return _mm512_cvtepi32_epi16(r);
+}
+
+__attribute__((target("avx512f"))) static void
+to_half_avx512(Precision precision, float const *in, uint16_t *out,
+               size_t size) {
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m512 x = _mm512_loadu_ps(in + i);
+        __m256i h = precision == Precision::BF16
+                        ? to_bf16_avx512(x)
+                        : _mm512_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT |
+                                                 _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), h);
+    }
+    to_half_scalar(precision, in + i, out + i, size - i);
+}
+
+// Native conversion of the CPUs with AVX-512 BF16 (same results).
+__attribute__((target("avx512f,avx512bf16"))) static void
+to_bf16_avx512bf16(float const *in, uint16_t *out, size_t size) {
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(in + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                            reinterpret_cast<__m256i &>(h));
+    }
+    to_half_scalar(Precision::BF16, in + i, out + i, size - i);
+}
+
+__attribute__((target("avx512f"))) static void
+from_half_avx512(Precision precision, uint16_t const *in, float *out,
+                 size_t size) {
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m256i h =
+            _mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + i));
+        __m512 x = precision == Precision::BF16
+                       ? _mm512_castsi512_ps(
+                             _mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16))
+                       : _mm512_cvtph_ps(h);
+        _mm512_storeu_ps(out + i, x);
+    }
+    from_half_scalar(precision, in + i, out + i, size - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void
+gemv_s8u8_avx512(int8_t const *w, size_t stride, uint8_t const *a,
+                 int32_t *out, size_t nb_rows) {
+    for (size_t r = 0; r < nb_rows; ++r) {
+        int8_t const *row = w + r * stride;
+        __m512i acc = _mm512_setzero_si512();
+        for (size_t k = 0; k < stride; k += 32) {
+            __m512i x = _mm512_cvtepu8_epi16(
+                _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + k)));
+            __m512i y = _mm512_cvtepi8_epi16(
+                _mm256_loadu_si256(reinterpret_cast<__m256i const *>(row + k)));
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(x, y));
+        }
+        out[r] = _mm512_reduce_add_epi32(acc);
+    }
+}
+
+__attribute__((target("avx512f"))) static void
+quantize_avx512(float const *in, float scale, uint8_t *out, size_t size) {
+    __m512 s = _mm512_set1_ps(scale);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m512 x = _mm512_mul_ps(_mm512_loadu_ps(in + i), s);
+        x = _mm512_min_ps(_mm512_max_ps(x, _mm512_setzero_ps()),
+                          _mm512_set1_ps(255));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                         _mm512_cvtusepi32_epi8(_mm512_cvtps_epi32(x)));
+    }
+    quantize_scalar(in + i, scale, out + i, size - i);
+}
+
+// vpdpbusd: 4 products u8 * s8 accumulated in each int32 lane
+__attribute__((target("avx512f,avx512vnni"))) static void
+gemv_s8u8_avx512vnni(int8_t const *w, size_t stride, uint8_t const *a,
+                     int32_t *out, size_t nb_rows) {
+    for (size_t r = 0; r < nb_rows; ++r) {
+        int8_t const *row = w + r * stride;
+        __m512i acc = _mm512_setzero_si512();
+        for (size_t k = 0; k < stride; k += 64) {
+            acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a + k),
+                                      _mm512_loadu_si512(row + k));
+        }
+        out[r] = _mm512_reduce_add_epi32(acc);
+    }
+}
+
+#pragma GCC diagnostic pop
+
+/******************************************************************************/
+/*                                  dispatch                                  */
+/******************************************************************************/
+
+// The NN_SIMD environment variable (avx512, avx2 or scalar) can be used to
+// limit the instruction set.
+SimdLevel simd_level() {
+    static SimdLevel const level = []() {
+        SimdLevel max_level = SimdLevel::AVX512;
+        char const *env = std::getenv("NN_SIMD");
+
+        if (env && std::strcmp(env, "avx2") == 0) {
+            max_level = SimdLevel::AVX2;
+        } else if (env && std::strcmp(env, "scalar") == 0) {
+            max_level = SimdLevel::Scalar;
+        }
+        __builtin_cpu_init();
+        if (max_level >= SimdLevel::AVX512 &&
+            __builtin_cpu_supports("avx512f")) {
+            return SimdLevel::AVX512;
+        }
+        if (max_level >= SimdLevel::AVX2 && __builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("fma")) {
+            return SimdLevel::AVX2;
+        }
+        return SimdLevel::Scalar;
+    }();
+    return level;
+}
+
+char const *simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX512:
+        return "avx512";
+    case SimdLevel::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+static void sigmoid_and_derivative_scalar(ftype const *in, ftype *out,
+                                          ftype *out_prime, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        ftype s = 1.0 / (1.0 + std::exp(-in[i]));
+        if (out) {
+            out[i] = s;
+        }
+        if (out_prime) {
+            out_prime[i] = s * (1.0 - s);
+        }
+    }
+}
+
+// out and out_prime can be null
+template <typename T>
+static void sigmoid_dispatch(T const *in, T *out, T *out_prime, size_t size) {
+    if constexpr (std::is_same_v<T, float>) {
+        switch (simd_level()) {
+        case SimdLevel::AVX512:
+            return sigmoid_and_derivative_avx512(in, out, out_prime, size);
+        case SimdLevel::AVX2:
+            return sigmoid_and_derivative_avx2(in, out, out_prime, size);
+        default:
+            break;
+        }
+    }
+    sigmoid_and_derivative_scalar(in, out, out_prime, size);
+}
+
+void sigmoid(std::span<ftype const> in, std::span<ftype> out) {
+    assert(in.size() == out.size());
+    sigmoid_dispatch<ftype>(in.data(), out.data(), nullptr, in.size());
+}
+
+void sigmoid_and_derivative(std::span<ftype const> in, std::span<ftype> out,
+                            std::span<ftype> out_prime) {
+    assert(in.size() == out.size() && in.size() == out_prime.size());
+    sigmoid_dispatch<ftype>(in.data(), out.data(), out_prime.data(),
+                            in.size());
+}
+
+void sigmoid_derivative(std::span<ftype const> in, std::span<ftype> out) {
+    assert(in.size() == out.size());
+    sigmoid_dispatch<ftype>(in.data(), nullptr, out.data(), in.size());
+}
+
+template <typename T>
+static void adam_update_dispatch(AdamStep const &step, T *w, T *m, T *v,
+                                 T const *g, size_t size) {
+    if constexpr (std::is_same_v<T, float>) {
+        switch (simd_level()) {
+        case SimdLevel::AVX512:
+            return adam_update_avx512(step, w, m, v, g, size);
+        case SimdLevel::AVX2:
+            return adam_update_avx2(step, w, m, v, g, size);
+        default:
+            break;
+        }
+    }
+    adam_update_scalar(step, w, m, v, g, size);
+}
+
+void adam_update(AdamStep const &step, std::span<ftype> w, std::span<ftype> m,
+                 std::span<ftype> v, std::span<ftype const> g) {
+    assert(w.size() == m.size() && w.size() == v.size());
+    assert(w.size() == g.size());
+    adam_update_dispatch<ftype>(step, w.data(), m.data(), v.data(), g.data(),
+                                w.size());
+}
+
+template <typename T>
+static void normalize_dispatch(uint8_t const *in, T scale, T *out,
+                               size_t size) {
+    if constexpr (std::is_same_v<T, float>) {
+        switch (simd_level()) {
+        case SimdLevel::AVX512:
+            return normalize_avx512(in, scale, out, size);
+        case SimdLevel::AVX2:
+            return normalize_avx2(in, scale, out, size);
+        default:
+            break;
+        }
+    }
+    normalize_scalar(in, scale, out, size);
+}
+
+void normalize(std::span<uint8_t const> in, ftype scale, std::span<ftype> out) {
+    assert(in.size() == out.size());
+    normalize_dispatch<ftype>(in.data(), scale, out.data(), in.size());
+}
+
+char const *precision_name(Precision precision) {
+    switch (precision) {
+    case Precision::BF16:
+        return "bf16";
+    case Precision::FP16:
+        return "fp16";
+    default:
+        return "fp32";
+    }
+}
+
+static bool has_avx512_bf16() {
+    static bool const supported = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512bf16");
+    }();
+    return supported;
+}
+
+template <typename T>
+static void to_half_dispatch(Precision precision, T const *in, uint16_t *out,
+                             size_t size) {
+    if constexpr (std::is_same_v<T, float>) {
+        switch (simd_level()) {
+        case SimdLevel::AVX512:
+            if (precision == Precision::BF16 && has_avx512_bf16()) {
+                return to_bf16_avx512bf16(in, out, size);
+            }
+            return to_half_avx512(precision, in, out, size);
+        case SimdLevel::AVX2:
+            return to_half_avx2(precision, in, out, size);
+        default:
+            break;
+        }
+    }
+    to_half_scalar(precision, in, out, size);
+}
+
+template <typename T>
+static void from_half_dispatch(Precision precision, uint16_t const *in, T *out,
+                               size_t size) {
+    if constexpr (std::is_same_v<T, float>) {
+        switch (simd_level()) {
+        case SimdLevel::AVX512:
+            return from_half_avx512(precision, in, out, size);
+        case SimdLevel::AVX2:
+            return from_half_avx2(precision, in, out, size);
+        default:
+            break;
+        }
+    }
+    from_half_scalar(precision, in, out, size);
+}
+
+void to_half(Precision precision, std::span<ftype const> in,
+             std::span<uint16_t> out) {
+    assert(precision != Precision::FP32 && in.size() == out.size());
+    to_half_dispatch<ftype>(precision, in.data(), out.data(), in.size());
+}
+
+void from_half(Precision precision, std::span<uint16_t const> in,
+               std::span<ftype> out) {
+    assert(precision != Precision::FP32 && in.size() == out.size());
+    from_half_dispatch<ftype>(precision, in.data(), out.data(), in.size());
+}
+
+template <typename T>
+static void quantize_dispatch(T const *in, T scale, uint8_t *out,
+                              size_t size) {
+    if constexpr (std::is_same_v<T, float>) {
+        switch (simd_level()) {
+        case SimdLevel::AVX512:
+            return quantize_avx512(in, scale, out, size);
+        case SimdLevel::AVX2:
+            return quantize_avx2(in, scale, out, size);
+        default:
+            break;
+        }
+    }
+    quantize_scalar(in, scale, out, size);
+}
+
+void quantize(std::span<ftype const> in, ftype scale, std::span<uint8_t> out) {
+    assert(in.size() == out.size());
+    quantize_dispatch<ftype>(in.data(), scale, out.data(), in.size());
+}
+
+static void gemv_s8u8_dispatch(int8_t const *w, size_t stride,
+                               uint8_t const *a, int32_t *out,
+                               size_t nb_rows) {
+    static bool const has_vnni = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512vnni");
+    }();
+    static bool const has_bw = __builtin_cpu_supports("avx512bw");
+
+    switch (simd_level()) {
+    case SimdLevel::AVX512:
+        if (has_vnni) {
+            return gemv_s8u8_avx512vnni(w, stride, a, out, nb_rows);
+        }
+        if (has_bw) {
+            return gemv_s8u8_avx512(w, stride, a, out, nb_rows);
+        }
+        return gemv_s8u8_avx2(w, stride, a, out, nb_rows);
+    case SimdLevel::AVX2:
+        return gemv_s8u8_avx2(w, stride, a, out, nb_rows);
+    default:
+        return gemv_s8u8_scalar(w, stride, a, out, nb_rows);
+    }
+}
+
+void gemv_s8u8(std::span<int8_t const> w, size_t stride,
+               std::span<uint8_t const> a, std::span<int32_t> out) {
+    assert(stride % 64 == 0 && a.size() >= stride);
+    assert(w.size() >= out.size() * stride);
+    gemv_s8u8_dispatch(w.data(), stride, a.data(), out.data(), out.size());
+}
@@ -0,0 +1,74 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+#include "math.hpp"
+#include <cstdint>
+#include <span>
+
+/*
+ * Vectorized element wise kernels. The implementation (AVX-512, AVX2 or
+ * scalar) is selected at runtime from the features of the CPU, and can be
+ * limited with the NN_SIMD environment variable.
+ *
+ * The SIMD versions use an approximation of exp (range reduction to
+ * [-ln2/2, ln2/2] and a degree 6 polynomial) with a relative error below
+ * 3e-7 on [-87, 88]. The inputs are clamped to this range, and the sigmoid has
+ * an absolute error below 2e-7.
+ */
+
+enum class SimdLevel { Scalar, AVX2, AVX512 };
+
+SimdLevel simd_level();
+char const *simd_level_name(SimdLevel level);
+
+/* out = sigmoid(in) */
+void sigmoid(std::span<ftype const> in, std::span<ftype> out);
+/* out = sigmoid(in) and out_prime = sigmoid'(in), out_prime may alias in */
+void sigmoid_and_derivative(std::span<ftype const> in, std::span<ftype> out,
+                            std::span<ftype> out_prime);
+/* out = sigmoid'(in) */
+void sigmoid_derivative(std::span<ftype const> in, std::span<ftype> out);
+
+/* out = in * scale, used to normalize the raw bytes of the datasets */
+void normalize(std::span<uint8_t const> in, ftype scale, std::span<ftype> out);
+
+/* Storage formats. The 16 bits formats (bf16: 8 bits exponent, fp16: 5 bits
+ * exponent) halve the memory traffic, the computations are done in fp32. */
+enum class Precision { FP32, BF16, FP16 };
+
+char const *precision_name(Precision precision);
+
+/* out = in rounded to the nearest even bf16 or fp16 (F16C / AVX-512 BF16 when
+ * available), the bf16 conversion flushes the subnormals to zero */
+void to_half(Precision precision, std::span<ftype const> in,
+             std::span<uint16_t> out);
+/* out = in (exact) */
+void from_half(Precision precision, std::span<uint16_t const> in,
+               std::span<ftype> out);
+
+/* out = round(in * scale) saturated to [0, 255], the inverse of normalize */
+void quantize(std::span<ftype const> in, ftype scale, std::span<uint8_t> out);
+
+/* out[r] = sum_k w[r * stride + k] * a[k] for r < out.size(), exact in int32
+ * (VNNI when available). The stride is a multiple of 64 and the rows and a
+ * are padded with zeros up to it. */
+void gemv_s8u8(std::span<int8_t const> w, size_t stride,
+               std::span<uint8_t const> a, std::span<int32_t> out);
+
+/* Parameters of one Adam step, the bias corrections are computed once */
+struct AdamStep {
+    ftype b1;
+    ftype b2;
+    ftype c1; // 1 / (1 - b1^t)
+    ftype c2; // 1 / (1 - b2^t)
+    ftype learning_rate;
+    ftype sigma;
+};
+
+/* Update m, v and w in one pass:
+ * m = b1 * m + (1 - b1) * g
+ * v = b2 * v + (1 - b2) * g * g
+ * w -= learning_rate * (m * c1) / (sqrt(v * c2) + sigma) */
+void adam_update(AdamStep const &step, std::span<ftype> w, std::span<ftype> m,
+                 std::span<ftype> v, std::span<ftype const> g);
+
+#endif
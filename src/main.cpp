@@ -1,31 +1,41 @@
+#include "alloc_counter.hpp"
+#include "inference.hpp"
 #include "math.hpp"
 #include "mnist/minist_loader.hpp"
 #include "model.hpp"
+#include "model_file.hpp"
+#include "prefetcher.hpp"
+#include "quantized_model.hpp"
+#include "thread_budget.hpp"
 #include "tracer.hpp"
 #include "trainer.hpp"
+#include <bit>
 #include <chrono>
 #include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <random>
+#include <thread>
 
-DataSet OR_train = {
-    {{0, 0}, {0}},
-    {{0, 1}, {1}},
-    {{1, 0}, {1}},
-    {{1, 1}, {1}},
-};
-DataSet AND_train = {
-    {{0, 0}, {0}},
-    {{0, 1}, {0}},
-    {{1, 0}, {0}},
-    {{1, 1}, {1}},
-};
-DataSet XOR_train = {
-    {{0, 0}, {0}},
-    {{0, 1}, {1}},
-    {{1, 0}, {1}},
-    {{1, 1}, {0}},
-};
+DataSet OR_train =
+    DataSet::from_rows({{0, 0}, {0, 1}, {1, 0}, {1, 1}}, {{0}, {1}, {1}, {1}});
+DataSet AND_train =
+    DataSet::from_rows({{0, 0}, {0, 1}, {1, 0}, {1, 1}}, {{0}, {0}, {0}, {1}});
+DataSet XOR_train =
+    DataSet::from_rows({{0, 0}, {0, 1}, {1, 0}, {1, 1}}, {{0}, {1}, {1}, {0}});
+
+Vector input(DataSet const &ds, size_t i) {
+    Vector result(ds.nb_inputs());
+    ds.input(i, std::span(result.mem, result.size));
+    return result;
+}
+
+Vector ground_truth(DataSet const &ds, size_t i) {
+    Vector result(ds.nb_outputs());
+    ds.ground_truth(i, result.mem);
+    return result;
+}
 
 template <typename Cost, typename Act, typename Opt>
 void train_eval(DataSet const &ds, size_t nb_epochs, ftype l_rate) {
@@ -33,22 +43,22 @@ void train_eval(DataSet const &ds, size_t nb_epochs, ftype l_rate) {
     Cost quadratic_loss;
     Act sigmoid;
     Opt sgd;
-    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
+    BasicTrainer t(&m, &quadratic_loss, &sigmoid, &sgd);
 
     std::cout << "start value:" << std::endl;
-    for (auto const &elt : ds) {
-        auto [as, zs] = t.feedforward(elt.input);
+    for (size_t i = 0; i < ds.size(); ++i) {
+        auto [as, zs] = t.feedforward(input(ds, i));
         std::cout << "found: " << as.back()[0]
-                  << "; expected: " << elt.ground_truth[0] << std::endl;
+                  << "; expected: " << ds.target(i)[0] << std::endl;
     }
 
     t.train_minibatch(ds, 4, nb_epochs, l_rate);
 
     std::cout << "after train:" << std::endl;
-    for (auto const &elt : ds) {
-        auto [as, zs] = t.feedforward(elt.input);
+    for (size_t i = 0; i < ds.size(); ++i) {
+        auto [as, zs] = t.feedforward(input(ds, i));
         std::cout << "found: " << as.back()[0]
-                  << "; expected: " << elt.ground_truth[0] << std::endl;
+                  << "; expected: " << ds.target(i)[0] << std::endl;
     }
 
     std::cout << "evaluation: " << t.evaluate_cost(ds) << std::endl;
@@ -60,6 +70,17 @@ void train_logic_gate() {
     train_eval<QuadraticLoss, Sigmoid, SGD>(XOR_train, 100'000, 0.004);
 }
 
+int get_label(Vector const &v) {
+    int max_idx = 0;
+
+    for (size_t i = 0; i < v.size; ++i) {
+        if (v[i] > v[max_idx]) {
+            max_idx = i;
+        }
+    }
+    return max_idx;
+}
+
 void test_vector() {
     Vector v1 = {1, 2};
     assert(1 == v1[0]);
@@ -74,6 +95,313 @@ void test_vector() {
     assert(v3[1] == v1[1]);
 }
 
+void test_sigmoid_kernels() {
+    Sigmoid sigmoid;
+    Vector x(1000), s(1000), s_prime(1000);
+
+    for (size_t i = 0; i < x.size; ++i) {
+        x[i] = -100 + 0.2 * i;
+    }
+    sigmoid.execute_and_derivative(std::span<ftype const>(x.mem, x.size),
+                                   std::span<ftype>(s.mem, s.size),
+                                   std::span<ftype>(s_prime.mem, s.size));
+    for (size_t i = 0; i < x.size; ++i) {
+        ftype expected = 1.0 / (1.0 + std::exp(-x[i]));
+        assert(std::abs(s[i] - expected) < 1e-6);
+        assert(std::abs(s_prime[i] - expected * (1 - expected)) < 1e-6);
+    }
+
+    // in place
+    sigmoid.derivative(std::span<ftype const>(x.mem, x.size),
+                       std::span<ftype>(x.mem, x.size));
+    for (size_t i = 0; i < x.size; ++i) {
+        assert(x[i] == s_prime[i]);
+    }
+}
+
+// the native products against a reference in double precision, on sizes on
+// the edges of the tiles and larger than the blocks
+void test_native_gemm() {
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> dist(-1, 1);
+    auto random = [&](size_t size) {
+        std::vector<float> v(size);
+        for (float &x : v) {
+            x = dist(gen);
+        }
+        return v;
+    };
+    size_t const sizes[] = {1, 7, 16, 33, 300};
+
+    for (int trans : {0, 1, 2, 3}) {
+        bool trans_a = trans & 1, trans_b = trans & 2;
+        for (size_t m : sizes) {
+            for (size_t n : sizes) {
+                for (size_t k : sizes) {
+                    size_t lda = (trans_a ? m : k) + 3;
+                    size_t ldb = (trans_b ? k : n) + 1;
+                    size_t ldc = n + 2;
+                    auto a = random((trans_a ? k : m) * lda);
+                    auto b = random((trans_b ? n : k) * ldb);
+                    auto c = random(m * ldc);
+                    auto expected = c;
+                    float beta = m == n ? 0 : 0.5;
+
+                    if (beta == 0) {
+                        std::fill(c.begin(), c.end(), std::nanf(""));
+                    }
+                    for (size_t i = 0; i < m; ++i) {
+                        for (size_t j = 0; j < n; ++j) {
+                            double sum = 0;
+                            for (size_t p = 0; p < k; ++p) {
+                                sum += double(trans_a ? a[p * lda + i]
+                                                      : a[i * lda + p]) *
+                                       (trans_b ? b[j * ldb + p]
+                                                : b[p * ldb + j]);
+                            }
+                            expected[i * ldc + j] =
+                                2 * sum + beta * expected[i * ldc + j];
+                        }
+                    }
+                    sgemm_native(trans_a, trans_b, m, n, k, 2, a.data(), lda,
+                                 b.data(), ldb, beta, c.data(), ldc);
+                    for (size_t i = 0; i < m; ++i) {
+                        for (size_t j = 0; j < n; ++j) {
+                            assert(std::abs(c[i * ldc + j] -
+                                            expected[i * ldc + j]) < 1e-3);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (bool trans : {false, true}) {
+        for (size_t m : sizes) {
+            for (size_t n : sizes) {
+                for (int inc : {1, 2}) {
+                    size_t size_x = trans ? m : n, size_y = trans ? n : m;
+                    auto a = random(m * (n + 1));
+                    auto x = random(size_x * inc);
+                    auto y = random(size_y * inc);
+                    auto expected = y;
+
+                    for (size_t i = 0; i < size_y; ++i) {
+                        double sum = 0;
+                        for (size_t j = 0; j < size_x; ++j) {
+                            sum += double(trans ? a[j * (n + 1) + i]
+                                                : a[i * (n + 1) + j]) *
+                                   x[j * inc];
+                        }
+                        expected[i * inc] = sum + 0.5 * expected[i * inc];
+                    }
+                    sgemv_native(trans, m, n, 1, a.data(), n + 1, x.data(),
+                                 inc, 0.5, y.data(), inc);
+                    for (size_t i = 0; i < size_y; ++i) {
+                        assert(std::abs(y[i * inc] - expected[i * inc]) <
+                               1e-3);
+                    }
+                }
+            }
+        }
+    }
+
+    // 16 bits A, on several decoded blocks of rows, against the fp32 product
+    // of the decoded values
+    for (Precision precision : {Precision::BF16, Precision::FP16}) {
+        size_t m = 300, n = 19, k = 1000;
+        auto a = random(m * k);
+        auto b = random(k * n);
+        std::vector<uint16_t> a16(m * k);
+        to_half(precision, a, a16);
+        from_half(precision, a16, a);
+
+        for (bool trans_b : {false, true}) {
+            auto c = random(m * n);
+            auto expected = c;
+            sgemm_native(false, trans_b, m, n, k, 1, a.data(), k, b.data(),
+                         trans_b ? k : n, 0.5, expected.data(), n);
+            sgemm_native_half(precision, trans_b, m, n, k, 1, a16.data(), k,
+                              b.data(), trans_b ? k : n, 0.5, c.data(), n);
+            for (size_t i = 0; i < m * n; ++i) {
+                assert(std::abs(c[i] - expected[i]) < 1e-3);
+            }
+        }
+        auto y = random(m);
+        auto expected = y;
+        sgemv_native(false, m, k, 2, a.data(), k, b.data(), 1, 0.5,
+                     expected.data(), 1);
+        sgemv_native_half(precision, m, k, 2, a16.data(), k, b.data(), 0.5,
+                          y.data());
+        for (size_t i = 0; i < m; ++i) {
+            assert(std::abs(y[i] - expected[i]) < 1e-3);
+        }
+    }
+}
+
+void test_adam() {
+    Model m;
+    Adam adam;
+    auto pool = std::make_shared<ThreadPool>(3);
+    std::mt19937_64 gen(0);
+    std::normal_distribution<ftype> dist(0, 1);
+
+    m.input(300);
+    m.add_layer(250);
+    m.add_layer(10);
+    m.init(0);
+    Model expected = m;
+    Parameters grads = Parameters::zeros_like(m.parameters());
+    Parameters mm = Parameters::zeros_like(m.parameters());
+    Parameters vv = Parameters::zeros_like(m.parameters());
+
+    // reference: two passes over the parameters
+    auto reference_step = [&](std::span<ftype> w, ftype b1_t, ftype b2_t) {
+        std::span<ftype const> g = grads.flat();
+        for (size_t i = 0; i < w.size(); ++i) {
+            mm.flat()[i] = adam.b1 * mm.flat()[i] + (1 - adam.b1) * g[i];
+            vv.flat()[i] = adam.b2 * vv.flat()[i] + (1 - adam.b2) * g[i] * g[i];
+        }
+        for (size_t i = 0; i < w.size(); ++i) {
+            ftype m_ = mm.flat()[i] / (1 - b1_t);
+            ftype v_ = vv.flat()[i] / (1 - b2_t);
+            w[i] -= 0.01 * m_ / (std::sqrt(v_) + adam.sigma);
+        }
+    };
+
+    adam.pool(pool);
+    ftype b1_t = adam.b1, b2_t = adam.b2;
+    for (size_t step = 0; step < 5; ++step) {
+        for (size_t l = 0; l < grads.nb_layers(); ++l) {
+            Matrix &g_w = grads.weights(l);
+            for (size_t i = 0; i < g_w.rows * g_w.cols; ++i) {
+                g_w.mem[i] = dist(gen);
+            }
+            for (size_t i = 0; i < grads.biases(l).size; ++i) {
+                grads.biases(l)[i] = dist(gen);
+            }
+        }
+        reference_step(expected.parameters().flat(), b1_t, b2_t);
+        if (step == 3) {
+            pool = nullptr; // the last steps run on the calling thread
+        }
+        adam.execute(&m, grads, 0.01);
+        b1_t *= adam.b1;
+        b2_t *= adam.b2;
+    }
+
+    for (size_t i = 0; i < m.parameters().size(); ++i) {
+        assert(std::abs(m.parameters().flat()[i] -
+                        expected.parameters().flat()[i]) < 1e-5);
+    }
+}
+
+/* The layers are views into one aligned buffer */
+void test_parameters() {
+    Model m;
+
+    m.input(3);
+    m.add_layer(5);
+    m.init(0);
+    Matrix first = m.layers[0].weights;
+    m.add_layer(2);
+    for (size_t i = 0; i < first.rows * first.cols; ++i) {
+        assert(m.layers[0].weights.mem[i] == first.mem[i]);
+    }
+    m.init(1);
+    m.layers[1].biases[0] = 42;
+
+    Parameters const &params = m.parameters();
+    assert(params.nb_layers() == 2);
+    for (size_t l = 0; l < m.layers.size(); ++l) {
+        Layer const &layer = m.layers[l];
+        assert(layer.weights.is_view() && layer.biases.is_view());
+        assert(layer.weights.mem == params.weights(l).mem);
+        assert(layer.biases.mem == params.biases(l).mem);
+        assert((uintptr_t)layer.weights.mem % Parameters::ALIGNMENT == 0);
+        assert((uintptr_t)layer.biases.mem % Parameters::ALIGNMENT == 0);
+        assert(layer.weights.mem >= params.flat().data() &&
+               layer.biases.mem + layer.biases.size <=
+                   params.flat().data() + params.size());
+    }
+
+    // a copy owns its buffer
+    Model copy = m;
+    assert(copy.layers[1].biases[0] == 42);
+    assert(copy.layers[0].weights.mem != m.layers[0].weights.mem);
+    assert(copy.layers[0].weights.mem == copy.parameters().weights(0).mem);
+    copy.layers[1].biases[0] = 0;
+    assert(m.layers[1].biases[0] == 42);
+
+    // the copy between models of the same layout does not move the buffer
+    ftype *mem = copy.parameters().flat().data();
+    copy = m;
+    assert(copy.parameters().flat().data() == mem);
+    assert(copy.layers[1].biases[0] == 42);
+
+    Parameters sum = Parameters::zeros_like(params);
+    sum += params;
+    sum += params;
+    for (size_t i = 0; i < params.size(); ++i) {
+        assert(sum.flat()[i] == 2 * params.flat()[i]);
+    }
+}
+
+void test_allocator() {
+    PoolAllocator &pool = PoolAllocator::instance();
+    AlignedAllocator aligned;
+
+    pool.trim();
+    AllocatorStats before = pool.stats();
+    ftype *mem = nullptr;
+    {
+        Matrix m(30, 17);
+        Vector v(7);
+        assert((uintptr_t)m.mem % Allocator::ALIGNMENT == 0);
+        assert((uintptr_t)v.mem % Allocator::ALIGNMENT == 0);
+        mem = m.mem;
+    }
+    AllocatorStats stats = pool.stats();
+    assert(stats.nb_allocations == before.nb_allocations + 2);
+    assert(stats.bytes_in_use == before.bytes_in_use);
+    assert(stats.bytes_cached > 0);
+    {
+        // same size class: the buffer is recycled
+        Matrix m(32, 16);
+        assert(m.mem == mem);
+        assert(pool.stats().nb_reused == stats.nb_reused + 1);
+    }
+    pool.trim();
+    assert(pool.stats().bytes_cached == 0);
+
+    // the buffers above 1 MiB are not pooled, and a thread caches at most
+    // MAX_CACHED_BYTES
+    {
+        Matrix large(1024, 1024);
+    }
+    assert(pool.stats().bytes_cached == 0);
+    {
+        std::vector<Matrix> buffers;
+        for (size_t i = 0; i < 12; ++i) {
+            buffers.emplace_back(256, 1024);
+        }
+    }
+    assert(pool.stats().bytes_cached == PoolAllocator::MAX_CACHED_BYTES);
+    pool.trim();
+
+    default_allocator(&aligned);
+    {
+        Vector v = {1, 2, 3};
+        Vector copy = v;
+        assert((uintptr_t)copy.mem % Allocator::ALIGNMENT == 0);
+        assert(aligned.stats().bytes_in_use == 2 * 3 * sizeof(ftype));
+    }
+    assert(aligned.stats().nb_allocations == 2);
+    assert(aligned.stats().bytes_in_use == 0);
+    default_allocator(nullptr);
+    assert(default_allocator() == &pool);
+}
+
 void test_compute_z() {
     Model m;
     Sigmoid sigmoid;
@@ -100,27 +428,1002 @@ void test_compute_z() {
     assert(432 == z[1]);
 }
 
-int get_label(Vector const &v) {
-    int max_idx = 0;
+void test_batched_backpropagate() {
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
 
-    for (size_t i = 0; i < v.size; ++i) {
-        if (v[i] > v[max_idx]) {
-            max_idx = i;
+    m.input(2);
+    m.add_layer(3);
+    m.add_layer(1);
+    m.init(0);
+
+    TrainingWorkspace ws(m, XOR_train.size());
+    for (size_t i = 0; i < XOR_train.size(); ++i) {
+        ws.inputs()[0][i] = XOR_train.input(i)[0];
+        ws.inputs()[1][i] = XOR_train.input(i)[1];
+        ws.ground_truths[0][i] = XOR_train.target(i)[0];
+    }
+    t.feedforward(ws);
+    Vector outputs = {ws.outputs()[0][0], ws.outputs()[0][1],
+                      ws.outputs()[0][2], ws.outputs()[0][3]};
+    t.backpropagate(ws);
+
+    for (size_t i = 0; i < XOR_train.size(); ++i) {
+        auto [as, zs] = t.feedforward(input(XOR_train, i));
+        assert(std::abs(as.back()[0] - outputs[i]) < 1e-6);
+        Parameters grads =
+            t.backpropagate(ground_truth(XOR_train, i), as, zs);
+        for (size_t l = 0; l < m.layers.size(); ++l) {
+            ws.grads.weights(l) -= 1.0 * grads.weights(l);
+            ws.grads.biases(l) -= 1.0 * grads.biases(l);
         }
     }
-    return max_idx;
+    for (size_t i = 0; i < ws.grads.size(); ++i) {
+        assert(std::abs(ws.grads.flat()[i]) < 1e-5);
+    }
+}
+
+void test_training_step_does_not_allocate() {
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    Adam adam;
+    Trainer t(&m, &quadratic_loss, &sigmoid, &adam);
+    MinibatchGenerator minibatch(XOR_train, 3, 0); // batches of 3 and 1
+
+    m.input(2);
+    m.add_layer(3);
+    m.add_layer(1);
+    m.init(0);
+
+    minibatch.generate();
+    t.update_minibatch(minibatch, 0.1); // warm-up
+    size_t count = AllocCounter::count();
+    for (size_t i = 0; i < 100; ++i) {
+        minibatch.generate();
+        t.update_minibatch(minibatch, 0.1);
+    }
+    assert(AllocCounter::count() == count);
+
+    t.update(XOR_train, 0.1); // warm-up
+    count = AllocCounter::count();
+    t.update(XOR_train, 0.1);
+    t.update(XOR_train, 0.1);
+    assert(AllocCounter::count() == count);
+}
+
+DataSet create_random_ds(size_t size, size_t nb_inputs, size_t nb_outputs,
+                         uint64_t seed) {
+    std::mt19937_64 gen(seed);
+    std::uniform_real_distribution<ftype> dist(0, 1);
+    DataSet ds = DataSet::with_targets(size, nb_inputs, nb_outputs);
+
+    for (size_t s = 0; s < size; ++s) {
+        for (ftype &x : ds.input(s)) {
+            x = dist(gen);
+        }
+        for (ftype &gt : ds.target(s)) {
+            gt = dist(gen) > 0.5;
+        }
+    }
+    return ds;
+}
+
+template <typename TrainerType = Trainer>
+Model train_random_model(DataSet const &ds, size_t nb_threads,
+                         size_t nb_prefetchers = 0) {
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    TrainerType t(&m, &quadratic_loss, &sigmoid, &sgd);
+
+    m.input(ds.nb_inputs());
+    m.add_layer(16);
+    m.add_layer(ds.nb_outputs());
+    m.init(0);
+    t.threads(nb_threads);
+    t.prefetch(nb_prefetchers);
+    t.train_minibatch(ds, 40, 50, 0.5);
+    if (nb_prefetchers > 0) {
+        assert(t.prefetch_stats().nb_batches == 50);
+        assert(t.prefetch_stats().nb_waits <= 50);
+    }
+    return m;
+}
+
+void test_parallel_minibatch() {
+    DataSet ds = create_random_ds(200, 8, 3, 0);
+    Model sequential = train_random_model(ds, 1);
+    Model parallel1 = train_random_model(ds, 3);
+    Model parallel2 = train_random_model(ds, 3);
+
+    for (size_t l = 0; l < sequential.layers.size(); ++l) {
+        Matrix const &w = sequential.layers[l].weights;
+        Matrix const &w1 = parallel1.layers[l].weights;
+        Matrix const &w2 = parallel2.layers[l].weights;
+        assert(memcmp(w1.mem, w2.mem, w.rows * w.cols * sizeof(ftype)) == 0);
+        for (size_t i = 0; i < w.rows * w.cols; ++i) {
+            assert(std::abs(w.mem[i] - w1.mem[i]) < 1e-4);
+        }
+    }
+}
+
+void test_minibatch_generator() {
+    DataSet ds = create_random_ds(10, 20, 2, 0);
+    auto epoch = [](MinibatchGenerator &minibatch) {
+        std::vector<size_t> sizes, indexes;
+        while (minibatch.next()) {
+            sizes.push_back(minibatch.size());
+            for (size_t i = 0; i < minibatch.size(); ++i) {
+                indexes.push_back(minibatch.index(i));
+            }
+        }
+        return std::make_pair(sizes, indexes);
+    };
+
+    // every sample once per epoch, with a smaller last minibatch
+    MinibatchGenerator partial(ds, 4, 0);
+    for (size_t e = 0; e < 2; ++e) {
+        auto [sizes, indexes] = epoch(partial);
+        assert(partial.epoch() == e);
+        assert((sizes == std::vector<size_t>{4, 4, 2}));
+        std::sort(indexes.begin(), indexes.end());
+        for (size_t i = 0; i < ds.size(); ++i) {
+            assert(indexes[i] == i);
+        }
+    }
+    MinibatchGenerator drop(ds, 4, 0, LastBatch::Drop);
+    assert(drop.nb_batches() == 2);
+    assert((epoch(drop).first == std::vector<size_t>{4, 4}));
+    MinibatchGenerator fill(ds, 4, 0, LastBatch::Fill);
+    auto [sizes, indexes] = epoch(fill);
+    assert((sizes == std::vector<size_t>{4, 4, 4}));
+    assert(indexes[10] == indexes[0] && indexes[11] == indexes[1]);
+
+    // a shard smaller than a minibatch is filled with its own samples
+    std::vector<size_t> filled;
+    for (size_t s = 0; s < 3; ++s) {
+        MinibatchGenerator shard(ds, 8, 0, LastBatch::Fill, s, 3);
+        auto [sizes, indexes] = epoch(shard);
+        assert((sizes == std::vector<size_t>{8}));
+        for (size_t i = 0; i < indexes.size(); ++i) {
+            assert(indexes[i] == indexes[i % shard.shard_size()]);
+        }
+        filled.insert(filled.end(), indexes.begin(),
+                      indexes.begin() + shard.shard_size());
+    }
+    std::sort(filled.begin(), filled.end());
+    for (size_t i = 0; i < ds.size(); ++i) {
+        assert(filled[i] == i);
+    }
+
+    // the shards are disjoint and cover the dataset at each epoch
+    for (size_t e = 0; e < 2; ++e) {
+        std::vector<size_t> all;
+        for (size_t s = 0; s < 3; ++s) {
+            MinibatchGenerator shard(ds, 2, 7, LastBatch::Partial, s, 3);
+            for (size_t k = 0; k < e; ++k) {
+                epoch(shard);
+            }
+            auto indexes = epoch(shard).second;
+            assert(indexes.size() == shard.shard_size());
+            all.insert(all.end(), indexes.begin(), indexes.end());
+        }
+        std::sort(all.begin(), all.end());
+        for (size_t i = 0; i < ds.size(); ++i) {
+            assert(all[i] == i);
+        }
+    }
+
+    // packing by tiles, with float and raw inputs
+    auto bytes = std::make_shared<std::vector<uint8_t>>(40 * 70);
+    for (size_t i = 0; i < bytes->size(); ++i) {
+        (*bytes)[i] = (uint8_t)(i * 7);
+    }
+    DataSet raw = DataSet::with_raw_inputs(*bytes, 70, 1 / 255., bytes, 10);
+    DataSet normalized = raw.normalized();
+    MinibatchGenerator raw_minibatch(raw, 19, 3);
+    MinibatchGenerator float_minibatch(normalized, 19, 3);
+    Matrix inputs(70, 19), raw_inputs(70, 19);
+    Matrix ground_truths(10, 19), raw_ground_truths(10, 19);
+
+    raw_minibatch.generate();
+    float_minibatch.generate();
+    raw_minibatch.pack(raw_inputs, raw_ground_truths);
+    float_minibatch.pack(inputs, ground_truths);
+    for (size_t i = 0; i < 19; ++i) {
+        size_t idx = raw_minibatch.index(i);
+        for (size_t r = 0; r < 70; ++r) {
+            assert(inputs[r][i] == normalized.input(idx)[r]);
+            assert(raw_inputs[r][i] == inputs[r][i]);
+        }
+        assert(ground_truths[raw.label(idx)][i] == 1);
+    }
+    assert(memcmp(ground_truths.mem, raw_ground_truths.mem,
+                  10 * 19 * sizeof(ftype)) == 0);
+}
+
+void test_prefetcher() {
+    DataSet ds = create_random_ds(200, 8, 3, 0);
+    MinibatchGenerator minibatch(ds, 30, 1);
+    MinibatchPrefetcher prefetcher(minibatch, 3, 4);
+
+    // same sequence of batches as the generator, over several epochs
+    for (size_t k = 0; k < 20; ++k) {
+        PackedBatch const &batch = prefetcher.next();
+        minibatch.generate();
+        Matrix inputs(8, minibatch.size()), ground_truths(3, minibatch.size());
+        minibatch.pack(inputs, ground_truths);
+        assert(batch.size() == minibatch.size());
+        assert(batch.epoch == minibatch.epoch());
+        assert(memcmp(batch.inputs.mem, inputs.mem,
+                      inputs.rows * inputs.cols * sizeof(ftype)) == 0);
+        assert(memcmp(batch.ground_truths.mem, ground_truths.mem,
+                      3 * inputs.cols * sizeof(ftype)) == 0);
+    }
+    assert(prefetcher.stats().nb_batches == 20);
+
+    // the training results do not depend on the prefetching
+    Model sequential = train_random_model(ds, 1);
+    Model prefetched = train_random_model(ds, 1, 2);
+    Model parallel = train_random_model(ds, 3);
+    Model parallel_prefetched = train_random_model(ds, 3, 1);
+    for (size_t l = 0; l < sequential.layers.size(); ++l) {
+        Matrix const &w = sequential.layers[l].weights;
+        size_t size = w.rows * w.cols * sizeof(ftype);
+        assert(memcmp(w.mem, prefetched.layers[l].weights.mem, size) == 0);
+        assert(memcmp(parallel.layers[l].weights.mem,
+                      parallel_prefetched.layers[l].weights.mem, size) == 0);
+    }
+}
+
+// Adam training of a random model on nb_steps minibatches, with optional
+// checkpoints and resume
+Model train_with_checkpoints(DataSet const &ds, size_t nb_steps,
+                             std::string const &checkpoint = "",
+                             size_t interval = 0, bool resume = false,
+                             size_t nb_prefetchers = 0) {
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    Adam adam;
+    BasicTrainer t(&m, &quadratic_loss, &sigmoid, &adam);
+
+    m.input(8);
+    m.add_layer(6);
+    m.add_layer(3);
+    m.init(1);
+    t.prefetch(nb_prefetchers);
+    t.checkpoint(checkpoint, interval);
+    if (resume) {
+        assert(t.resume(checkpoint));
+    }
+    t.train_minibatch(ds, 16, nb_steps, 0.05, 3);
+    return m;
+}
+
+// the leases count the threads, and the share of BLAS is only set by the
+// training thread
+void test_thread_budget() {
+    size_t budget = ThreadBudget::budget();
+    size_t blas_threads = ThreadBudget::config().blas_threads;
+
+    ThreadBudget::budget(4);
+    {
+        ThreadBudget::Lease training(Activity::Training);
+        ThreadBudget::BlasShare share(1);
+        assert(ThreadBudget::config().blas_threads == 4);
+        {
+            // the caller of the pool is one of the workers
+            ThreadBudget::Lease workers(Activity::Workers, 4);
+            ThreadBudget::BlasShare workers_share(4);
+            ThreadConfig config = ThreadBudget::config();
+            assert(config.nb_active == 4 && config.blas_threads == 1);
+            assert(config.activities[size_t(Activity::Training)] == 0);
+#ifdef NN_OPENBLAS
+            assert(openblas_get_num_threads() == 1);
+#endif
+        }
+        std::thread evaluation([]() {
+            ThreadBudget::Lease lease(Activity::Evaluation);
+            assert(ThreadBudget::config().nb_active == 2);
+            assert(ThreadBudget::config().blas_threads == 4);
+        });
+        evaluation.join();
+        assert(ThreadBudget::config().nb_active == 1);
+    }
+    assert(ThreadBudget::config().blas_threads == blas_threads);
+
+    DataSet ds = create_random_ds(200, 8, 3, 0);
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
+
+    m.input(ds.nb_inputs());
+    m.add_layer(16);
+    m.add_layer(ds.nb_outputs());
+    m.init(0);
+    t.threads(2);
+    t.prefetch(1);
+    t.train_minibatch(ds, 40, 10, 0.5);
+    ThreadConfig config = t.thread_config();
+    assert(config.activities[size_t(Activity::Workers)] == 2);
+    assert(config.activities[size_t(Activity::Prefetch)] == 1);
+    assert(config.nb_active == 3 && config.blas_threads == 1);
+    assert(ThreadBudget::config().nb_active == 0);
+    assert(ThreadBudget::config().blas_threads == blas_threads);
+    ThreadBudget::budget(budget);
+}
+
+void test_checkpoint() {
+    std::string path = std::string(std::filesystem::temp_directory_path()) +
+                       "/nn-test.checkpoint";
+    DataSet ds = create_random_ds(50, 8, 3, 0);
+    Model expected = train_with_checkpoints(ds, 30);
+    size_t size = expected.parameters().size() * sizeof(ftype);
+
+    // the run is stopped in the middle of an epoch, after 11 minibatches,
+    // the restarts continue exactly where it left off
+    train_with_checkpoints(ds, 11, path, 4);
+    Checkpoint checkpoint;
+    assert(load_checkpoint(path, checkpoint) && checkpoint.step == 11);
+    assert(checkpoint.optimizer.buffers.size() == 2);
+    Model resumed = train_with_checkpoints(ds, 30, path, 0, true);
+    assert(memcmp(resumed.parameters().flat().data(),
+                  expected.parameters().flat().data(), size) == 0);
+    Model prefetched = train_with_checkpoints(ds, 30, path, 0, true, 2);
+    assert(memcmp(prefetched.parameters().flat().data(),
+                  expected.parameters().flat().data(), size) == 0);
+
+    // checkpoints of a prefetched run
+    train_with_checkpoints(ds, 11, path, 4, false, 2);
+    resumed = train_with_checkpoints(ds, 30, path, 0, true);
+    assert(memcmp(resumed.parameters().flat().data(),
+                  expected.parameters().flat().data(), size) == 0);
+
+    // truncated file
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    assert(!load_checkpoint(path, checkpoint));
+    std::filesystem::remove(path);
+}
+
+void test_quantized_model() {
+    std::mt19937 gen(0);
+    std::vector<int8_t> w(5 * 128);
+    std::vector<uint8_t> a(128);
+    std::vector<int32_t> out(5);
+
+    for (auto &x : w) {
+        x = (int8_t)(gen() % 255 - 127);
+    }
+    for (auto &x : a) {
+        x = (uint8_t)gen();
+    }
+    gemv_s8u8(w, 128, a, out);
+    for (size_t r = 0; r < 5; ++r) {
+        int32_t expected = 0;
+        for (size_t k = 0; k < 128; ++k) {
+            expected += w[r * 128 + k] * a[k];
+        }
+        assert(out[r] == expected);
+    }
+
+    std::vector<ftype> x = {-1, 0, 0.5f / 255, 1.5f / 255, 0.3f, 1, 2, NAN};
+    for (size_t i = 0; i < 30; ++i) {
+        x.push_back((ftype)i / 29);
+    }
+    std::vector<uint8_t> q(x.size());
+    quantize(x, 255, q);
+    for (size_t i = 0; i < x.size(); ++i) {
+        ftype expected = std::isnan(x[i]) ? 0 : std::clamp<ftype>(x[i], 0, 1);
+        assert(q[i] == std::nearbyint(expected * 255));
+    }
+
+    // the quantized model agrees with the float one
+    DataSet ds = create_random_ds(200, 8, 3, 0);
+    Model m = train_random_model(ds, 1);
+    QuantizedModel quantized(m);
+    QuantizationReport report = compare(m, quantized, ds);
+    assert(report.nb_samples == 200 && report.agreement >= 95);
+    assert(std::abs(report.int8_accuracy - report.fp32_accuracy) <= 5);
+    assert(quantized.evaluate(ds) == report.int8_accuracy);
+
+    // the lookup of the sigmoid is clamped for the non finite biases
+    Model broken = m;
+    broken.layers[0].biases[0] = NAN;
+    broken.layers[0].biases[1] = 1e30;
+    broken.layers[0].biases[2] = -INFINITY;
+    QuantizedModel quantized_broken(broken);
+    QuantizedModel::Buffers broken_buffers = quantized_broken.buffers();
+    for (size_t i = 0; i < ds.size(); ++i) {
+        assert(quantized_broken.predict(ds, i, broken_buffers) < 3);
+    }
+
+    // raw inputs of scale 1 / 255 are used without conversion
+    auto bytes = std::make_shared<std::vector<uint8_t>>(50 * 8);
+    for (auto &x : *bytes) {
+        x = (uint8_t)gen();
+    }
+    DataSet raw = DataSet::with_raw_inputs(*bytes, 8, 1 / 255., bytes, 3);
+    DataSet normalized = raw.normalized();
+    QuantizedModel::Buffers buffers = quantized.buffers();
+    for (size_t i = 0; i < raw.size(); ++i) {
+        assert(quantized.predict(raw, i, buffers) ==
+               quantized.predict(normalized, i, buffers));
+    }
+}
+
+void test_static_trainer() {
+    DataSet ds = create_random_ds(200, 8, 3, 0);
+    Model dynamic = train_random_model<Trainer>(ds, 1);
+    Model specialized =
+        train_random_model<BasicTrainer<QuadraticLoss, Sigmoid, SGD>>(ds, 1);
+
+    for (size_t l = 0; l < dynamic.layers.size(); ++l) {
+        Matrix const &w1 = dynamic.layers[l].weights;
+        Matrix const &w2 = specialized.layers[l].weights;
+        for (size_t i = 0; i < w1.rows * w1.cols; ++i) {
+            assert(std::abs(w1.mem[i] - w2.mem[i]) < 1e-6);
+        }
+    }
+}
+
+void test_hogwild() {
+    DataSet ds = create_random_ds(100, 8, 2, 0);
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
+
+    for (size_t i = 0; i < ds.size(); ++i) {
+        ds.input(i)[0] = ds.input(i)[3] = 0; // sparse inputs
+    }
+    m.input(8);
+    m.add_layer(4);
+    m.add_layer(2);
+    m.init(0);
+    t.threads(2);
+    t.hogwild(true);
+    ftype cost_before = t.evaluate_cost(ds);
+    t.train(ds, 20, 0.5);
+    assert(t.evaluate_cost(ds) < cost_before);
+
+    size_t nb_samples = 0;
+    for (auto const &stats : t.hogwild_stats()) {
+        nb_samples += stats.nb_samples;
+        // 2 null inputs are skipped in the first layer
+        assert(stats.nb_updates == stats.nb_samples * (4 * 7 + 2 * 5));
+    }
+    assert(nb_samples == 20 * ds.size());
+}
+
+void test_evaluate() {
+    DataSet ds = create_random_ds(300, 8, 3, 0);
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
+    ftype cost_sum = 0;
+    size_t count_valid = 0;
+
+    m.input(8);
+    m.add_layer(5);
+    m.add_layer(3);
+    m.init(0);
+
+    for (size_t s = 0; s < ds.size(); ++s) {
+        auto [as, zs] = t.feedforward(input(ds, s));
+        Vector gt = ground_truth(ds, s);
+        ftype sample_cost = 0;
+        for (size_t i = 0; i < gt.size; ++i) {
+            sample_cost += quadratic_loss.execute(gt[i], as.back()[i]);
+        }
+        cost_sum += sample_cost / gt.size;
+        count_valid += get_label(as.back()) == get_label(gt);
+    }
+    ftype expected_cost = cost_sum / ds.size();
+    ftype expected_accuracy = 100 * ((ftype)count_valid / (ftype)ds.size());
+
+    for (size_t nb_threads : {1, 3}) {
+        t.threads(nb_threads);
+        auto [cost, accuracy] = t.evaluate(ds);
+        assert(std::abs(cost - expected_cost) < 1e-5);
+        assert(accuracy == expected_accuracy);
+    }
+}
+
+void test_half_precision() {
+    std::mt19937 gen(0);
+    std::vector<ftype> x = {0,     -0.0f,    1,      -2.5,     65504,
+                            65520, 1e-7f,    1e-40f, -1e-40f,  3.14159f,
+                            1e30f, INFINITY, NAN,    -INFINITY};
+    for (size_t i = 0; i < 1000; ++i) {
+        x.push_back(std::bit_cast<float>((uint32_t)gen()));
+    }
+    std::vector<uint16_t> bf16(x.size()), fp16(x.size());
+    std::vector<ftype> y(x.size());
+
+    // rounding to the nearest even, the same at every SIMD level
+    to_half(Precision::BF16, x, bf16);
+    to_half(Precision::FP16, x, fp16);
+    for (size_t i = 0; i < x.size(); ++i) {
+        uint32_t u = std::bit_cast<uint32_t>(x[i]);
+        uint16_t expected = (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+        if (std::isnan(x[i])) {
+            expected = (u >> 16) | 0x40;
+        } else if ((u & 0x7f800000) == 0) {
+            expected = (u >> 16) & 0x8000;
+        }
+        assert(bf16[i] == expected);
+        assert(fp16[i] == std::bit_cast<uint16_t>((_Float16)x[i]));
+    }
+    from_half(Precision::BF16, bf16, y);
+    for (size_t i = 0; i < x.size(); ++i) {
+        assert(std::bit_cast<uint32_t>(y[i]) == (uint32_t)bf16[i] << 16);
+    }
+    from_half(Precision::FP16, fp16, y);
+    for (size_t i = 0; i < x.size(); ++i) {
+        float expected = (float)std::bit_cast<_Float16>(fp16[i]);
+        assert(std::bit_cast<uint32_t>(y[i]) ==
+               std::bit_cast<uint32_t>(expected));
+    }
+
+    // datasets stored in 16 bits
+    DataSet ds = create_random_ds(300, 40, 3, 0);
+    for (Precision precision : {Precision::BF16, Precision::FP16}) {
+        DataSet half = ds.converted(precision);
+        ftype tolerance = precision == Precision::BF16 ? 1.0 / 256 : 1.0 / 2048;
+        Vector row(40);
+
+        assert(half.is_encoded() && half.precision() == precision);
+        assert(half.converted(precision).half_input(0).data() ==
+               half.half_input(0).data());
+        for (size_t s = 0; s < ds.size(); ++s) {
+            half.input(s, std::span(row.mem, row.size));
+            for (size_t r = 0; r < 40; ++r) {
+                assert(std::abs(row[r] - ds.input(s)[r]) <= tolerance);
+            }
+            assert(half.target(s)[0] == ds.target(s)[0]);
+        }
+        DataSet back = half.normalized();
+        half.slice(10, 5).input(2, 7, std::span(row.mem, 3));
+        assert(row[0] == back.input(12)[7] && row[2] == back.input(12)[9]);
+    }
+
+    // weights stored in 16 bits for the inference, with fp32 accumulation
+    Model m = train_random_model(ds, 1);
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    auto [cost, accuracy] =
+        Evaluator(&m, &quadratic_loss, &sigmoid, nullptr, 64).evaluate(ds);
+    InferenceSession session(&m, &sigmoid);
+    std::vector<ftype> outputs;
+    for (size_t s = 0; s < ds.size(); ++s) {
+        auto y = session.predict(ds.input(s));
+        outputs.insert(outputs.end(), y.begin(), y.end());
+    }
+    for (Precision precision : {Precision::BF16, Precision::FP16}) {
+        Model half = m;
+        ftype tolerance = precision == Precision::BF16 ? 2e-2 : 5e-3;
+
+        assert(half.half_weights(0) == nullptr);
+        half.half_precision(precision);
+        assert(half.half_weights(0) != nullptr);
+        auto [half_cost, half_accuracy] =
+            Evaluator(&half, &quadratic_loss, &sigmoid, nullptr, 64)
+                .evaluate(ds);
+        assert(std::abs(half_cost - cost) < 1e-2);
+        assert(std::abs(half_accuracy - accuracy) <= 2);
+        InferenceSession half_session(&half, &sigmoid);
+        for (size_t s = 0; s < ds.size(); ++s) {
+            auto y = half_session.predict(ds.input(s));
+            for (size_t r = 0; r < y.size(); ++r) {
+                assert(std::abs(y[r] - outputs[s * 3 + r]) <= tolerance);
+            }
+        }
+    }
+
+    // the trainer updates the fp32 parameters and refreshes the copy
+    m.half_precision(Precision::BF16);
+    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
+    t.train_minibatch(ds, 40, 5, 0.5);
+    std::vector<uint16_t> expected(m.parameters().size());
+    to_half(Precision::BF16, m.parameters().flat(), expected);
+    assert(memcmp(m.half_weights(1),
+                  expected.data() + (m.layers[1].weights.mem -
+                                     m.parameters().flat().data()),
+                  m.layers[1].nb_nodes * m.layers[1].nb_inputs * 2) == 0);
+}
+
+void test_inference() {
+    DataSet ds = create_random_ds(50, 8, 3, 0);
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
+
+    m.input(8);
+    m.add_layer(5);
+    m.add_layer(4);
+    m.add_layer(3);
+    m.init(0);
+
+    InferenceSession session(&m, &sigmoid, 16);
+    std::vector<Vector> expected;
+    for (size_t s = 0; s < ds.size(); ++s) {
+        expected.push_back(t.feedforward(input(ds, s)).first.back());
+    }
+
+    // single sample and batches, without allocation
+    size_t count = AllocCounter::count();
+    for (size_t s = 0; s < ds.size(); ++s) {
+        std::span<ftype const> y = session.predict(ds.input(s));
+        for (size_t r = 0; r < 3; ++r) {
+            assert(std::abs(y[r] - expected[s][r]) < 1e-6);
+        }
+        assert(session.classify(ds.input(s)) == get_label(expected[s]));
+    }
+    for (size_t first = 0; first < ds.size(); first += 16) {
+        size_t n = std::min<size_t>(16, ds.size() - first);
+        Matrix const &y = session.predict_batch(ds, first, n);
+        assert(y.rows == 3 && y.cols == n);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t r = 0; r < 3; ++r) {
+                assert(std::abs(y[r][i] - expected[first + i][r]) < 1e-5);
+            }
+        }
+    }
+    assert(AllocCounter::count() == count);
+
+    // concurrent sessions on the same model
+    std::vector<std::thread> threads;
+    std::vector<size_t> nb_errors(4);
+    for (size_t id = 0; id < 4; ++id) {
+        threads.emplace_back([&, id]() {
+            InferenceSession session(&m, &sigmoid);
+            for (size_t k = 0; k < 100; ++k) {
+                size_t s = (id * 100 + k) % ds.size();
+                nb_errors[id] +=
+                    session.classify(ds.input(s)) != get_label(expected[s]);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (size_t errors : nb_errors) {
+        assert(errors == 0);
+    }
+}
+
+void test_model_file() {
+    std::string path =
+        std::string(std::filesystem::temp_directory_path()) + "/nn-test.model";
+    DataSet ds = create_random_ds(20, 8, 3, 0);
+    Model m;
+    Sigmoid sigmoid;
+
+    m.input(8);
+    m.add_layer(5);
+    m.add_layer(3);
+    m.init(0);
+    assert(save_model(path, m));
+
+    // the parameters are used in place in the mapping of the file
+    ActivationType activation;
+    Model loaded = load_model(path, &activation);
+    assert(activation == ActivationType::Sigmoid);
+    assert(loaded.nb_inputs() == 8 && loaded.layers.size() == 2);
+    assert(loaded.layers[0].nb_nodes == 5 && loaded.layers[1].nb_nodes == 3);
+    assert(loaded.parameters().flat().data() != m.parameters().flat().data());
+    assert(reinterpret_cast<uintptr_t>(loaded.parameters().flat().data()) %
+               Parameters::ALIGNMENT == 0);
+    assert(memcmp(loaded.parameters().flat().data(),
+                  m.parameters().flat().data(),
+                  m.parameters().size() * sizeof(ftype)) == 0);
+    InferenceSession expected(&m, &sigmoid), session(&loaded, &sigmoid);
+    for (size_t s = 0; s < ds.size(); ++s) {
+        std::span<ftype const> y = session.predict(ds.input(s));
+        std::span<ftype const> e = expected.predict(ds.input(s));
+        assert(std::equal(y.begin(), y.end(), e.begin()));
+    }
+
+    // the copy on write mapping never modifies the file, and the copies of the
+    // loaded model own their parameters
+    loaded.layers[0].weights.mem[0] += 1;
+    Model copy = loaded;
+    assert(copy.layers[0].weights.mem[0] == loaded.layers[0].weights.mem[0]);
+    assert(load_model(path).layers[0].weights.mem[0] ==
+           m.layers[0].weights.mem[0]);
+
+    // invalid magic number and truncated file
+    std::fstream(path, std::ios::in | std::ios::out | std::ios::binary)
+        .write("X", 1);
+    assert(load_model(path).layers.empty());
+    assert(save_model(path, m));
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+    assert(load_model(path).layers.empty());
+    std::filesystem::remove(path);
 }
 
-void mnist_print_activation(Vector const &activation, Vector const &gt) {
+void test_dataset() {
+    DataSet labelled = DataSet::with_labels(10, 4, 3);
+    DataSet dense = DataSet::with_targets(10, 4, 3);
+
+    for (size_t i = 0; i < labelled.size(); ++i) {
+        for (size_t j = 0; j < 4; ++j) {
+            labelled.input(i)[j] = dense.input(i)[j] = i * 4 + j;
+        }
+        labelled.label(i, i % 3);
+        for (size_t j = 0; j < 3; ++j) {
+            dense.target(i)[j] = j == i % 3;
+        }
+    }
+    assert(labelled.has_labels() && !dense.has_labels());
+    assert(labelled.nb_inputs() == 4 && labelled.nb_outputs() == 3);
+
+    // the rows are contiguous
+    assert(labelled.input(1).data() == labelled.input(0).data() + 4);
+
+    // one-hot ground truth written in a column
+    ftype column[3 * 2];
+    labelled.ground_truth(5, column + 1, 2);
+    assert(column[1] == 0 && column[3] == 0 && column[5] == 1);
+    assert(dense.label(5) == 2);
+
+    // the slices and splits share the samples
+    auto [train, validation] = labelled.split(7);
+    assert(train.size() == 7 && validation.size() == 3);
+    assert(validation.input(0).data() == labelled.input(7).data());
+    assert(validation.label(1) == labelled.label(8));
+    DataSet slice = labelled.slice(2, 3);
+    slice.input(0)[0] = -1;
+    assert(labelled.input(2)[0] == -1);
+
+    // select copies
+    DataSet selected = labelled.select({9, 0});
+    assert(selected.size() == 2 && selected.label(0) == labelled.label(9));
+    assert(selected.input(1)[3] == labelled.input(0)[3]);
+    selected.input(1)[3] = -1;
+    assert(labelled.input(0)[3] == 3);
+
+    // labels and one-hot targets are evaluated the same way
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
+
+    dense.input(2)[0] = -1;
+    m.input(4);
+    m.add_layer(3);
+    m.init(0);
+    assert(t.evaluate(labelled) == t.evaluate(dense));
+    assert(t.evaluate(validation).second ==
+           t.evaluate(labelled.select({7, 8, 9})).second);
+}
+
+void write_idx(std::string const &path, std::vector<uint32_t> const &dims,
+               std::vector<uint8_t> const &data) {
+    std::ofstream fs(path, std::ios::binary);
+    uint8_t magic[4] = {0, 0, 0x08, (uint8_t)dims.size()};
+
+    fs.write(reinterpret_cast<char const *>(magic), 4);
+    for (uint32_t dim : dims) {
+        uint8_t bytes[4] = {uint8_t(dim >> 24), uint8_t(dim >> 16),
+                            uint8_t(dim >> 8), uint8_t(dim)};
+        fs.write(reinterpret_cast<char const *>(bytes), 4);
+    }
+    fs.write(reinterpret_cast<char const *>(data.data()), data.size());
+}
+
+void test_idx_loader() {
+    std::string dir = std::filesystem::temp_directory_path();
+    std::string labels_path = dir + "/nn-test-labels.idx";
+    std::string images_path = dir + "/nn-test-images.idx";
+    std::mt19937_64 gen(0);
+    std::vector<uint8_t> labels(40), pixels(40 * 5 * 5);
+
+    for (size_t i = 0; i < labels.size(); ++i) {
+        labels[i] = gen() % 10;
+    }
+    for (auto &px : pixels) {
+        px = gen() % 256;
+    }
+    write_idx(labels_path, {40}, labels);
+    write_idx(images_path, {40, 5, 5}, pixels);
+
+    MNISTLoader loader;
+    DataSet raw = loader.load_ds(labels_path, images_path);
+    ThreadPool pool(3);
+    DataSet normalized = raw.normalized(&pool);
+
+    assert(raw.is_raw() && !normalized.is_raw());
+    assert(raw.size() == 40 && raw.nb_inputs() == 25);
+    assert(raw.nb_outputs() == 10);
+    Vector x(25);
+    for (size_t i = 0; i < raw.size(); ++i) {
+        assert(raw.label(i) == labels[i]);
+        assert(normalized.label(i) == labels[i]);
+        raw.input(i, std::span(x.mem, x.size));
+        for (size_t j = 0; j < 25; ++j) {
+            assert(raw.raw_input(i)[j] == pixels[i * 25 + j]);
+            assert(x[j] == pixels[i * 25 + j] * ftype(1 / 255.));
+            assert(normalized.input(i)[j] == x[j]);
+        }
+    }
+
+    // the lazy normalization gives the same training and evaluation
+    Model m1, m2;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    Trainer t1(&m1, &quadratic_loss, &sigmoid, &sgd);
+    Trainer t2(&m2, &quadratic_loss, &sigmoid, &sgd);
+
+    m1.input(25);
+    m1.add_layer(10);
+    m1.init(0);
+    m2 = m1;
+    t1.train_minibatch(raw, 8, 10, 0.5);
+    t2.train_minibatch(normalized, 8, 10, 0.5);
+    t1.train(raw.slice(0, 10), 2, 0.5);
+    t2.train(normalized.slice(0, 10), 2, 0.5);
+    assert(memcmp(m1.parameters().flat().data(),
+                  m2.parameters().flat().data(),
+                  m1.parameters().size() * sizeof(ftype)) == 0);
+    assert(t1.evaluate(raw) == t2.evaluate(normalized));
+
+    // invalid magic number
+    write_idx(images_path, {40, 5, 5}, pixels);
+    std::fstream(images_path, std::ios::in | std::ios::out | std::ios::binary)
+        .write("\x01", 1);
+    assert(loader.load_ds(labels_path, images_path).empty());
+    std::filesystem::remove(labels_path);
+    std::filesystem::remove(images_path);
+}
+
+void trace_random_model(Tracer &tracer, bool async) {
+    Model m;
+    Sigmoid sigmoid;
+    QuadraticLoss quadratic_loss;
+    SGD sgd;
+    Trainer t(&m, &quadratic_loss, &sigmoid, &sgd);
+
+    m.input(8);
+    m.add_layer(5);
+    m.add_layer(3);
+    m.init(0);
+    tracer.trace_interval = 4;
+    tracer.sample_size = 50;
+    tracer.async = async;
+    t.tracer(&tracer);
+    t.train_minibatch(tracer.train_ds, 10, 22, 0.5);
+}
+
+void test_async_tracer() {
+    DataSet ds = create_random_ds(100, 8, 3, 0);
+    Tracer sync_tracer(ds, ds);
+    Tracer async_tracer(ds, ds);
+
+    trace_random_model(sync_tracer, false);
+    trace_random_model(async_tracer, true);
+
+    // the epochs 0, 4, ..., 20 and the last one
+    assert(sync_tracer.records.size() == 7);
+    assert(async_tracer.records.size() == 7);
+    for (size_t i = 0; i < 7; ++i) {
+        TraceRecord const &sync_record = sync_tracer.records[i];
+        TraceRecord const &async_record = async_tracer.records[i];
+        assert(sync_record.epoch == std::min<size_t>(4 * i, 21));
+        assert(async_record.epoch == sync_record.epoch);
+        assert(sync_record.cost_train == async_record.cost_train);
+        assert(sync_record.accuracy_test == async_record.accuracy_test);
+    }
+}
+
+void test_trace_file() {
+    std::string path = std::string(std::filesystem::temp_directory_path()) +
+                       "/nn-test.trace";
+    DataSet ds = create_random_ds(100, 8, 3, 0);
+    Tracer tracer(ds, ds);
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+
+    // the records are streamed to the file and not kept in memory
+    tracer.stream_path = path;
+    trace_random_model(tracer, true);
+    assert(tracer.records.empty());
+    assert(read_trace(path, header, records));
+    assert(header.nb_epochs == 22 && header.minibatch_size == 10);
+    assert(header.learning_rate == 0.5f && records.size() == 7);
+
+    Tracer memory_tracer(ds, ds);
+    trace_random_model(memory_tracer, false);
+    for (size_t i = 0; i < records.size(); ++i) {
+        TraceRecord const &expected = memory_tracer.records[i];
+        assert(records[i].epoch == expected.epoch);
+        assert(records[i].cost_test == expected.cost_test);
+        assert(records[i].accuracy_train == expected.accuracy_train);
+        assert(records[i].evaluation_time > 0);
+        assert(i == 0 || records[i].time >= records[i - 1].time);
+    }
+
+    // more records than the buffer of the writer, and an incomplete record
+    {
+        TraceWriter writer(path, header, 8);
+        for (size_t i = 0; i < 100; ++i) {
+            TraceRecord record;
+            record.epoch = i;
+            record.cost_train = i;
+            writer.append(record);
+        }
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    assert(read_trace(path, header, records) && records.size() == 99);
+    for (size_t i = 0; i < records.size(); ++i) {
+        assert(records[i].epoch == i && records[i].cost_train == i);
+        assert(std::isnan(records[i].cost_test));
+    }
+    std::filesystem::remove(path);
+}
+
+void test_profiler() {
+    PhaseProfile profile;
+
+    for (size_t i = 1; i <= 100; ++i) {
+        profile.add(Phase::Data, i * 1e-3);
+        profile.add(Phase::Forward, 1e-3);
+        profile.end_step(2);
+    }
+    PhaseStats data = profile.stats(Phase::Data);
+    assert(profile.nb_steps() == 100 && profile.nb_samples() == 200);
+    assert(std::abs(data.total - 5.05) < 1e-9);
+    assert(std::abs(data.p50 - 0.051) < 1e-6);
+    assert(std::abs(data.p99 - 0.1) < 1e-6);
+    assert(std::abs(profile.total() - 5.15) < 1e-9);
+    assert(profile.stats(Phase::Backward).total == 0);
+    profile.reset();
+    assert(profile.nb_steps() == 0 && profile.total() == 0);
+
+    // the tracer aggregates the profile of the trainer at the traced epochs
+    DataSet ds = create_random_ds(100, 8, 3, 0);
+    Tracer tracer(ds, ds);
+    trace_random_model(tracer, false);
+    assert(tracer.records.size() == 7);
+    for (TraceRecord const &record : tracer.records) {
+        assert(record.evaluation_time > 0);
+#ifdef NN_PROFILE
+        assert(record.samples_per_second > 0);
+        for (size_t p = 0; p < NB_PHASES; ++p) {
+            assert(record.phase_total[p] > 0);
+            assert(record.phase_p50[p] <= record.phase_p99[p]);
+        }
+#endif
+    }
+}
+
+void mnist_print_activation(Vector const &activation, Label expected) {
     std::cout << "activation = [ ";
     for (size_t i = 0; i < activation.size; ++i) {
         std::cout << activation[i] << " ";
     }
-    std::cout << "] expected = " << get_label(gt)
+    std::cout << "] expected = " << expected
               << " found = " << get_label(activation) << std::endl;
 }
 
-void mnist_train_and_eval(Trainer t, DataSet const &train_ds,
+template <typename TrainerType>
+void mnist_train_and_eval(TrainerType t, DataSet const &train_ds,
                           DataSet const &test_ds, size_t nb_epochs,
                           ftype l_rate, size_t minibatch_size) {
     std::mt19937 gen(0);
@@ -136,17 +1439,34 @@ void mnist_train_and_eval(Trainer t, DataSet const &train_ds,
               << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1)
                      .count()
               << std::endl;
+    for (size_t i = 0; i < t.hogwild_stats().size(); ++i) {
+        auto const &stats = t.hogwild_stats()[i];
+        std::cout << "hogwild thread " << i << ": " << stats.nb_samples
+                  << " samples, " << stats.nb_updates << " updates, "
+                  << stats.nb_samples / stats.time << " samples/s"
+                  << std::endl;
+    }
 
 #ifdef PRINT_SAMPLE
     for (size_t i = 0; i < 10; ++i) {
-        auto [as, zs] = t.feedforward(test_ds[i].input);
-        MNISTLoader::print_image(test_ds[i].input, 28, 28);
-        mnist_print_activation(as.back(), test_ds[i].ground_truth);
+        Vector image = input(test_ds, i);
+        auto [as, zs] = t.feedforward(image);
+        MNISTLoader::print_image(std::span(image.mem, image.size), 28, 28);
+        mnist_print_activation(as.back(), test_ds.label(i));
     }
 #endif
     auto eval = t.evaluate(test_ds);
     std::cout << "average cost after training: " << eval.first << std::endl;
     std::cout << "evaluation: " << eval.second << "%" << std::endl;
+
+    QuantizedModel quantized(*t.model());
+    QuantizationReport report = compare(*t.model(), quantized, test_ds);
+    std::cout << "int8 evaluation: " << report.int8_accuracy << "% (fp32 "
+              << report.fp32_accuracy << "%, " << report.agreement
+              << "% agreement), latency: " << report.int8_latency * 1e6
+              << "us (fp32 " << report.fp32_latency * 1e6 << "us), size: "
+              << report.int8_size << " bytes (fp32 " << report.fp32_size
+              << " bytes)" << std::endl;
 }
 
 Model create_mnist_model() {
@@ -166,13 +1486,29 @@ void test_mnist(DataSet const &train_data, DataSet const &test_data,
     Cost cost;
     Act act;
     Opt opt;
-    Trainer t(&m, &cost, &act, &opt);
+    BasicTrainer t(&m, &cost, &act, &opt);
     Tracer tracer(train_data, test_data);
 
     mnist_train_and_eval(t, train_data, test_data, nb_epochs, learning_rate,
                          minibatch_size);
 }
 
+template <typename Cost, typename Act>
+void test_mnist_hogwild(DataSet const &train_data, DataSet const &test_data,
+                        size_t nb_epochs, ftype learning_rate,
+                        size_t nb_threads) {
+    Model m = create_mnist_model();
+    Cost cost;
+    Act act;
+    SGD opt;
+    BasicTrainer t(&m, &cost, &act, &opt);
+
+    t.threads(nb_threads);
+    t.hogwild(true);
+    mnist_train_and_eval(t, train_data, test_data, nb_epochs, learning_rate,
+                         0);
+}
+
 template <typename Cost, typename Act, typename Opt>
 void trace_mnist(DataSet const &train_data, DataSet const &test_data,
                  size_t nb_epochs, ftype learning_rate,
@@ -181,24 +1517,33 @@ void trace_mnist(DataSet const &train_data, DataSet const &test_data,
     Cost cost;
     Act act;
     Opt opt;
-    Trainer t(&m, &cost, &act, &opt);
+    BasicTrainer t(&m, &cost, &act, &opt);
     Tracer tracer(train_data, test_data);
 
+    // the records are written to the trace file during the training
+    std::string cost_function_name = typeid(cost).name();
+    std::string act_function_name = typeid(act).name();
+    std::string opt_function_name = typeid(opt).name();
+    std::ostringstream ss;
+    ss << "train_" << cost_function_name << "_" << act_function_name << "_"
+       << opt_function_name << "_" << nb_epochs << "_" << learning_rate << "_"
+       << (minibatch_size == 0 ? train_data.size() : minibatch_size)
+       << ".out";
+    tracer.stream_path = ss.str();
+
     t.tracer(&tracer);
+    if (minibatch_size != 0) {
+        // one epoch is one minibatch: trace a sample in the background
+        tracer.trace_interval = 10;
+        tracer.sample_size = 10'000;
+        tracer.async = true;
+    }
     if (minibatch_size == 0) {
         t.train(train_data, nb_epochs, learning_rate);
     } else {
         t.train_minibatch(train_data, minibatch_size, nb_epochs, learning_rate);
     }
-
-    // dump results
-    std::string cost_function_name = typeid(cost).name();
-    std::string act_function_name = typeid(act).name();
-    std::string opt_function_name = typeid(opt).name();
-    std::ostringstream ss;
-    ss << "train_" << cost_function_name << "_" << act_function_name << "_"
-       << opt_function_name;
-    tracer.dump(ss.str());
+    tracer.print_profile(std::cout);
 }
 
 int main(void) {
@@ -211,6 +1556,30 @@ int main(void) {
                        "../data/mnist/t10k-images-idx3-ubyte");
     test_compute_z();
     test_vector();
+    test_sigmoid_kernels();
+    test_native_gemm();
+    test_adam();
+    test_parameters();
+    test_allocator();
+    test_batched_backpropagate();
+    test_training_step_does_not_allocate();
+    test_parallel_minibatch();
+    test_minibatch_generator();
+    test_prefetcher();
+    test_thread_budget();
+    test_checkpoint();
+    test_quantized_model();
+    test_static_trainer();
+    test_hogwild();
+    test_evaluate();
+    test_inference();
+    test_model_file();
+    test_dataset();
+    test_half_precision();
+    test_idx_loader();
+    test_async_tracer();
+    test_profiler();
+    test_trace_file();
 
     // trace SGD on minibatch and online learning
     trace_mnist<QuadraticLoss, Sigmoid, SGD>(mnist_train_data, mnist_test_data,
@@ -230,6 +1599,11 @@ int main(void) {
     test_mnist<QuadraticLoss, Sigmoid, Adam>(mnist_train_data, mnist_test_data,
                                              30, 0.01);
 
+    // asynchronous online learning on 30 epochs
+    test_mnist_hogwild<QuadraticLoss, Sigmoid>(
+        mnist_train_data, mnist_test_data, 30, 0.01,
+        std::max(2u, std::thread::hardware_concurrency()));
+
     // minibatch leanring on 1'000 epochs
     test_mnist<QuadraticLoss, Sigmoid, SGD>(mnist_train_data, mnist_test_data,
                                             1'000, 8);
@@ -1,6 +1,5 @@
 #include "math.hpp"
 #include <cassert>
-#include <cblas.h>
 #include <cstring>
 
 /******************************************************************************/
@@ -37,6 +36,53 @@ Vector matmul(T<Matrix> const &weightsT, Vector &err) {
     return result;
 }
 
+void hadamard(Matrix &a, Matrix const &b) {
+    assert(a.rows == b.rows && a.cols == b.cols);
+    for (size_t i = 0; i < a.rows * a.cols; ++i) {
+        a.mem[i] *= b.mem[i];
+    }
+}
+
+// errs is (nodes x batch) and as is (inputs x batch), the result is the
+// gradient of the weights summed over the whole batch (nodes x inputs).
+void matmul(Matrix const &errs, T<Matrix> const &asT, Matrix &result) {
+    Matrix const &as = asT.matrix;
+
+    assert(errs.cols == as.cols);
+    assert(result.rows == errs.rows && result.cols == as.rows);
+    // M = errs.rows, K = batch, N = as.rows
+    gemm<ftype>(CblasNoTrans, CblasTrans, errs.rows, as.rows, errs.cols, 1.0,
+                errs.mem, errs.cols, as.mem, as.cols, 0, result.mem,
+                result.cols);
+}
+
+void matmul(T<Matrix> const &weightsT, Matrix const &errs, Matrix &result) {
+    Matrix const &weights = weightsT.matrix;
+
+    assert(weights.rows == errs.rows);
+    assert(result.rows == weights.cols && result.cols == errs.cols);
+    if (errs.cols == 1) {
+        gemv<ftype>(CblasTrans, weights.rows, weights.cols, 1.0, weights.mem,
+                    weights.cols, errs.mem, 1, 0, result.mem, 1);
+        return;
+    }
+    // M = weights.cols, K = weights.rows, N = batch
+    gemm<ftype>(CblasTrans, CblasNoTrans, weights.cols, errs.cols,
+                weights.rows, 1.0, weights.mem, weights.cols, errs.mem,
+                errs.cols, 0, result.mem, result.cols);
+}
+
+void sum_cols(Matrix const &m, Vector &result) {
+    assert(result.size == m.rows);
+    for (size_t i = 0; i < m.rows; ++i) {
+        ftype sum = 0;
+        for (size_t j = 0; j < m.cols; ++j) {
+            sum += m[i][j];
+        }
+        result[i] = sum;
+    }
+}
+
 /******************************************************************************/
 /*                                 operators                                  */
 /******************************************************************************/
@@ -91,19 +137,3 @@ Matrix const &operator/=(Matrix &m, ftype constant) {
     }
     return m;
 }
-
-GradW const &operator+=(GradW &lhs, GradW const &rhs) {
-    assert(lhs.size() == rhs.size());
-    for (size_t i = 0; i < lhs.size(); ++i) {
-        lhs[i] += rhs[i];
-    }
-    return lhs;
-}
-
-GradB const &operator+=(GradB &lhs, GradB const &rhs) {
-    assert(lhs.size() == rhs.size());
-    for (size_t i = 0; i < lhs.size(); ++i) {
-        lhs[i] += rhs[i];
-    }
-    return lhs;
-}
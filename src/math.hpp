@@ -1,11 +1,19 @@
 #ifndef MATH_H
 #define MATH_H
-#include "cblas.h"
+#include "allocator.hpp"
+#include "gemm.hpp"
+#include <cassert>
 #include <cstddef>
 #include <cstring>
 #include <initializer_list>
 #include <type_traits>
 #include <vector>
+#ifdef NN_OPENBLAS
+#include "cblas.h"
+#else
+/* the transpositions of cblas.h */
+enum CBLAS_TRANSPOSE { CblasNoTrans = 111, CblasTrans = 112 };
+#endif
 
 using ftype = float;
 
@@ -13,14 +21,30 @@ using ftype = float;
 /*                                   types                                    */
 /******************************************************************************/
 
+/* The matrices and vectors own their memory, except the views (see view)
+ * which point into a buffer owned by someone else. Assigning to a view copies
+ * the values into the viewed memory, and copying a view creates an owning
+ * matrix. The memory comes from an Allocator (the default one unless
+ * specified) and is aligned on Allocator::ALIGNMENT bytes. */
 struct Matrix {
     ftype *mem = nullptr;
     size_t rows = 0;
     size_t cols = 0;
 
     Matrix() = default;
-    Matrix(size_t rows, size_t cols)
-        : mem(new ftype[rows * cols]), rows(rows), cols(cols) {}
+    Matrix(size_t rows, size_t cols,
+           Allocator *allocator = default_allocator())
+        : mem(allocate(allocator, rows * cols)), rows(rows), cols(cols),
+          allocator_(allocator) {}
+
+    static Matrix view(ftype *mem, size_t rows, size_t cols) {
+        Matrix m;
+        m.mem = mem;
+        m.rows = rows;
+        m.cols = cols;
+        m.is_view_ = true;
+        return m;
+    }
 
     Matrix(Matrix const &m) : Matrix(m.rows, m.cols) {
         memcpy(mem, m.mem, rows * cols * sizeof(*mem));
@@ -28,9 +52,17 @@ struct Matrix {
     Matrix const &operator=(Matrix const &m) {
         if (&m == this)
             return *this;
+        if (is_view_) {
+            assert(rows == m.rows && cols == m.cols);
+            memcpy(mem, m.mem, rows * cols * sizeof(*mem));
+            return *this;
+        }
         if (rows * cols != m.rows * m.cols) {
-            delete[] mem;
-            mem = new ftype[m.rows * m.cols];
+            deallocate(allocator_, mem, rows * cols);
+            if (allocator_ == nullptr) {
+                allocator_ = default_allocator();
+            }
+            mem = allocate(allocator_, m.rows * m.cols);
         }
         rows = m.rows;
         cols = m.cols;
@@ -38,25 +70,47 @@ struct Matrix {
         return *this;
     }
 
-    Matrix(Matrix &&m) : mem(nullptr), rows(m.rows), cols(m.cols) {
+    Matrix(Matrix &&m) noexcept
+        : mem(nullptr), rows(m.rows), cols(m.cols), allocator_(m.allocator_),
+          is_view_(m.is_view_) {
         std::swap(mem, m.mem);
     }
     Matrix const &operator=(Matrix &&m) {
-        rows = m.rows;
-        cols = m.cols;
+        if (is_view_) {
+            return *this = static_cast<Matrix const &>(m);
+        }
         std::swap(mem, m.mem);
+        std::swap(rows, m.rows);
+        std::swap(cols, m.cols);
+        std::swap(allocator_, m.allocator_);
+        std::swap(is_view_, m.is_view_);
         return *this;
     }
 
     ~Matrix() {
-        delete[] mem;
+        deallocate(allocator_, mem, rows * cols);
         mem = nullptr;
         rows = 0;
         cols = 0;
     }
 
+    bool is_view() const { return is_view_; }
+
     ftype *operator[](size_t idx) { return &mem[idx * cols]; }
     ftype const *operator[](size_t idx) const { return &mem[idx * cols]; }
+
+  private:
+    Allocator *allocator_ = nullptr; // nullptr for the views
+    bool is_view_ = false;
+
+    static ftype *allocate(Allocator *allocator, size_t size) {
+        return static_cast<ftype *>(allocator->allocate(size * sizeof(ftype)));
+    }
+    static void deallocate(Allocator *allocator, ftype *mem, size_t size) {
+        if (allocator) {
+            allocator->deallocate(mem, size * sizeof(ftype));
+        }
+    }
 };
 
 struct Vector {
@@ -64,15 +118,33 @@ struct Vector {
     size_t size = 0;
 
     Vector() = default;
-    explicit Vector(size_t size) : mem(new ftype[size]), size(size) {}
+    explicit Vector(size_t size, Allocator *allocator = default_allocator())
+        : mem(allocate(allocator, size)), size(size), allocator_(allocator) {}
     Vector(std::initializer_list<ftype> init) : Vector(init.size()) {
         memcpy(mem, std::data(init), init.size() * sizeof(*mem));
     }
 
-    Vector(Vector &&v) : mem(nullptr), size(v.size) { std::swap(mem, v.mem); }
+    static Vector view(ftype *mem, size_t size) {
+        Vector v;
+        v.mem = mem;
+        v.size = size;
+        v.is_view_ = true;
+        return v;
+    }
+
+    Vector(Vector &&v) noexcept
+        : mem(nullptr), size(v.size), allocator_(v.allocator_),
+          is_view_(v.is_view_) {
+        std::swap(mem, v.mem);
+    }
     Vector const &operator=(Vector &&v) {
-        size = v.size;
+        if (is_view_) {
+            return *this = static_cast<Vector const &>(v);
+        }
         std::swap(mem, v.mem);
+        std::swap(size, v.size);
+        std::swap(allocator_, v.allocator_);
+        std::swap(is_view_, v.is_view_);
         return *this;
     }
 
@@ -82,9 +154,17 @@ struct Vector {
     Vector const &operator=(Vector const &v) {
         if (&v == this)
             return *this;
+        if (is_view_) {
+            assert(size == v.size);
+            memcpy(mem, v.mem, size * sizeof(*mem));
+            return *this;
+        }
         if (size != v.size) {
-            delete[] mem;
-            mem = new ftype[v.size];
+            deallocate(allocator_, mem, size);
+            if (allocator_ == nullptr) {
+                allocator_ = default_allocator();
+            }
+            mem = allocate(allocator_, v.size);
         }
         size = v.size;
         memcpy(mem, v.mem, size * sizeof(*mem));
@@ -92,11 +172,13 @@ struct Vector {
     }
 
     ~Vector() {
-        delete[] mem;
+        deallocate(allocator_, mem, size);
         mem = nullptr;
         size = 0;
     }
 
+    bool is_view() const { return is_view_; }
+
     Vector clone() const {
         Vector result(size);
         memcpy(result.mem, mem, size * sizeof(*mem));
@@ -105,6 +187,19 @@ struct Vector {
 
     ftype &operator[](size_t idx) { return mem[idx]; }
     ftype const &operator[](size_t idx) const { return mem[idx]; }
+
+  private:
+    Allocator *allocator_ = nullptr; // nullptr for the views
+    bool is_view_ = false;
+
+    static ftype *allocate(Allocator *allocator, size_t size) {
+        return static_cast<ftype *>(allocator->allocate(size * sizeof(ftype)));
+    }
+    static void deallocate(Allocator *allocator, ftype *mem, size_t size) {
+        if (allocator) {
+            allocator->deallocate(mem, size * sizeof(ftype));
+        }
+    }
 };
 
 template <typename MatrixType>
@@ -115,9 +210,6 @@ struct T {
     explicit T(MatrixType const &matrix) : matrix(matrix) {}
 };
 
-using GradW = std::vector<Matrix>;
-using GradB = std::vector<Vector>;
-
 /******************************************************************************/
 /*                                 functions                                  */
 /******************************************************************************/
@@ -126,6 +218,12 @@ Vector matmul(T<Matrix> const &weightsT, Vector &err);
 Matrix matmul(Vector const &err, T<Vector> const &aT);
 Vector hadamard(Vector &&a, Vector const &b);
 
+/* in place versions, the result is written in the last argument */
+void matmul(T<Matrix> const &weightsT, Matrix const &errs, Matrix &result);
+void matmul(Matrix const &errs, T<Matrix> const &asT, Matrix &result);
+void hadamard(Matrix &a, Matrix const &b);
+void sum_cols(Matrix const &m, Vector &result);
+
 /******************************************************************************/
 /*                                 operators                                  */
 /******************************************************************************/
@@ -150,17 +248,25 @@ Matrix const &operator-=(Matrix &m, LazyCMMult const &cvmult);
 Matrix const &operator+=(Matrix &lhs, Matrix const &rhs);
 Matrix const &operator/=(Matrix &m, ftype constant);
 
-GradW const &operator+=(GradW &lhs, GradW const &rhs);
-GradB const &operator+=(GradB &lhs, GradB const &rhs);
-
 /******************************************************************************/
-/*                              helper for cblas                              */
+/*                  helpers for cblas (or the native backend)                 */
 /******************************************************************************/
 
+// The single precision products go to the backend of gemm_backend(), the
+// double precision ones need OpenBLAS.
+
 template <typename T>
 void gemv(CBLAS_TRANSPOSE const trans, int const m, int const n, T const alpha,
           T const *a, int const lda, T const *x, int const incx, T const beta,
           T *y, int const incy) {
+    if constexpr (std::is_same_v<ftype, float>) {
+        if (gemm_backend() == GemmBackend::Native) {
+            sgemv_native(trans == CblasTrans, m, n, alpha, a, lda, x, incx,
+                         beta, y, incy);
+            return;
+        }
+    }
+#ifdef NN_OPENBLAS
     if constexpr (std::is_same_v<ftype, double>) {
         cblas_dgemv(CblasRowMajor, trans, m, n, alpha, a, lda, x, incx, beta, y,
                     incy);
@@ -168,6 +274,25 @@ void gemv(CBLAS_TRANSPOSE const trans, int const m, int const n, T const alpha,
         cblas_sgemv(CblasRowMajor, trans, m, n, alpha, a, lda, x, incx, beta, y,
                     incy);
     }
+#else
+    static_assert(std::is_same_v<ftype, float>, "double requires OpenBLAS");
+#endif
+}
+
+template <typename T>
+void axpy(int const n, T const alpha, T const *x, int const incx, T *y,
+          int const incy) {
+#ifdef NN_OPENBLAS
+    if constexpr (std::is_same_v<ftype, double>) {
+        cblas_daxpy(n, alpha, x, incx, y, incy);
+    } else {
+        cblas_saxpy(n, alpha, x, incx, y, incy);
+    }
+#else
+    for (int i = 0; i < n; ++i) {
+        y[i * incy] += alpha * x[i * incx];
+    }
+#endif
 }
 
 template <typename T>
@@ -175,6 +300,14 @@ void gemm(CBLAS_TRANSPOSE const TransA, CBLAS_TRANSPOSE const TransB,
           int const M, int const N, int const K, T const alpha, T const *A,
           int const lda, T const *B, int const ldb, T const beta, T *C,
           int const ldc) {
+    if constexpr (std::is_same_v<ftype, float>) {
+        if (gemm_backend() == GemmBackend::Native) {
+            sgemm_native(TransA == CblasTrans, TransB == CblasTrans, M, N, K,
+                         alpha, A, lda, B, ldb, beta, C, ldc);
+            return;
+        }
+    }
+#ifdef NN_OPENBLAS
     if constexpr (std::is_same_v<ftype, double>) {
         cblas_dgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
                     ldb, beta, C, ldc);
@@ -182,6 +315,9 @@ void gemm(CBLAS_TRANSPOSE const TransA, CBLAS_TRANSPOSE const TransB,
         cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
                     ldb, beta, C, ldc);
     }
+#else
+    static_assert(std::is_same_v<ftype, float>, "double requires OpenBLAS");
+#endif
 }
 
 #endif
@@ -2,41 +2,225 @@
 #define MINIBATCH_GENERATOR_H
 #include "types.hpp"
 #include <algorithm>
+#include <cassert>
 #include <cstdint>
 #include <random>
+#include <sstream>
+#include <string>
+#include <vector>
 
+/* what to do with the last samples of an epoch when the size of the shard is
+ * not a multiple of the minibatch size */
+enum class LastBatch {
+    Partial, // smaller last minibatch
+    Drop,    // the remaining samples are skipped
+    Fill,    // completed with the first samples of the epoch
+};
+
+/*
+ * Iterate over the samples of a dataset by shuffled minibatches, epoch by
+ * epoch. At each epoch, the whole dataset is shuffled with the generator
+ * seeded with seed, so all the shards of the same seed have the same
+ * permutation, and the shard s of nb_shards takes the contiguous slice
+ * [s * size / nb_shards, (s + 1) * size / nb_shards) of it: the shards are
+ * disjoint and cover the dataset.
+ *
+ * The generator is created before the first minibatch:
+ *
+ *     while (minibatch.next()) { ... } // one epoch
+ *     minibatch.generate();            // next minibatch, any epoch
+ */
 class MinibatchGenerator {
   public:
-    MinibatchGenerator(DataSet const &db, size_t size, uint32_t seed)
-        : dataSet_(&db), size_(size), indexes_(db.size()), gen_(seed),
-          offset_(0) {
+    MinibatchGenerator(DataSet const &db, size_t size, uint32_t seed,
+                       LastBatch last_batch = LastBatch::Partial,
+                       size_t shard = 0, size_t nb_shards = 1)
+        : dataSet_(&db), size_(size), last_batch_(last_batch),
+          first_(shard * db.size() / nb_shards),
+          last_((shard + 1) * db.size() / nb_shards), indexes_(db.size()),
+          gen_(seed) {
+        assert(size > 0 && shard < nb_shards);
         for (size_t i = 0; i < db.size(); ++i) {
             indexes_[i] = i;
         }
-        std::shuffle(indexes_.begin(), indexes_.end(), gen_);
     }
 
-    void generate() {
-        if (offset_ + size_ >= dataSet_->size()) {
+    /* Move to the next minibatch of the epoch. Returns false at the end of
+     * the epoch, and the next call starts a new epoch. */
+    bool next() {
+        if (offset_ == END) {
             offset_ = 0;
+            ++nb_epochs_;
             std::shuffle(indexes_.begin(), indexes_.end(), gen_);
         } else {
             offset_ += size_;
         }
+        size_t remaining = offset_ < shard_size() ? shard_size() - offset_ : 0;
+        if (remaining == 0 ||
+            (remaining < size_ && last_batch_ == LastBatch::Drop)) {
+            offset_ = END;
+            count_ = 0;
+            return false;
+        }
+        count_ = last_batch_ == LastBatch::Partial ? std::min(size_, remaining)
+                                                   : size_;
+        return true;
+    }
+
+    /* next minibatch, the epochs are chained */
+    void generate() {
+        if (!next()) {
+            [[maybe_unused]] bool found = next();
+            assert(found && "the shard is smaller than a minibatch");
+        }
+    }
+
+    /* index in the dataset of the sample idx of the current minibatch */
+    size_t index(size_t idx) const {
+        assert(idx < count_);
+        // LastBatch::Fill wraps around the shard, which can be smaller than
+        // a minibatch
+        size_t i = (offset_ + idx) % shard_size();
+        return indexes_[first_ + i];
+    }
+
+    /* Pack the samples [first, first + inputs.cols) of the current minibatch
+     * into (inputs x n) and (outputs x n) matrices: the column i holds the
+     * sample first + i. The samples are gathered by tiles of TILE samples,
+     * so the rows of the matrices are written by contiguous blocks. */
+    void pack(Matrix &inputs, Matrix &ground_truths, size_t first = 0) const {
+        assert(inputs.cols == ground_truths.cols);
+        assert(first + inputs.cols <= count_);
+        assert(inputs.rows == dataSet_->nb_inputs());
+        assert(ground_truths.rows == dataSet_->nb_outputs());
+        for (size_t i = 0; i < inputs.cols; i += TILE) {
+            size_t n = std::min(TILE, inputs.cols - i);
+            if (dataSet_->is_encoded()) {
+                pack_encoded(inputs, first + i, i, n);
+            } else {
+                pack_tile(inputs, first + i, i, n);
+            }
+        }
+        for (size_t i = 0; i < ground_truths.cols; ++i) {
+            dataSet_->ground_truth(index(first + i), ground_truths.mem + i,
+                                   ground_truths.cols);
+        }
+    }
+
+    /* Position in the sequence of minibatches: the permutation of the
+     * current epoch and the state of the random generator (as text). */
+    struct State {
+        size_t batch_size = 0;
+        size_t nb_epochs = 0;
+        size_t offset = END;
+        size_t count = 0;
+        std::vector<size_t> indexes = {};
+        std::string rng = {};
+    };
+
+    /* the buffers of out are reused */
+    void save(State &out) const {
+        std::ostringstream rng;
+
+        rng << gen_;
+        out.batch_size = size_;
+        out.nb_epochs = nb_epochs_;
+        out.offset = offset_;
+        out.count = count_;
+        out.indexes = indexes_;
+        out.rng = rng.str();
+    }
+
+    /* continue the sequence saved in state, returns false when the state does
+     * not match the dataset or the minibatch size */
+    bool restore(State const &state) {
+        std::istringstream rng(state.rng);
+        std::mt19937 gen;
+
+        if (state.batch_size != size_ || state.count > size_ ||
+            (state.offset != END && state.offset >= shard_size()) ||
+            state.indexes.size() != indexes_.size() ||
+            std::any_of(state.indexes.begin(), state.indexes.end(),
+                        [&](size_t i) { return i >= indexes_.size(); }) ||
+            !(rng >> gen)) {
+            return false;
+        }
+        nb_epochs_ = state.nb_epochs;
+        offset_ = state.offset;
+        count_ = state.count;
+        indexes_ = state.indexes;
+        gen_ = gen;
+        return true;
+    }
+
+    DataSet const &dataset() const { return *dataSet_; }
+    /* size of the current minibatch */
+    size_t size() const { return count_; }
+    size_t batch_size() const { return size_; }
+    size_t shard_size() const { return last_ - first_; }
+    /* number of minibatches per epoch */
+    size_t nb_batches() const {
+        return last_batch_ == LastBatch::Drop
+                   ? shard_size() / size_
+                   : (shard_size() + size_ - 1) / size_;
     }
+    /* current epoch (0 for the first one) */
+    size_t epoch() const { return nb_epochs_ > 0 ? nb_epochs_ - 1 : 0; }
+    /* index of the current minibatch in the epoch */
+    size_t batch() const { return offset_ / size_; }
 
-    DataSetEntry const &get(size_t idx) const {
-        return (*dataSet_)[indexes_[offset_ + idx]];
+  private:
+    static constexpr size_t END = SIZE_MAX;
+    static constexpr size_t TILE = 16;
+    static constexpr size_t CHUNK = 64;
+
+    // transpose the inputs of the samples [src, src + n) of the minibatch in
+    // the columns [dst, dst + n)
+    void pack_tile(Matrix &inputs, size_t src, size_t dst, size_t n) const {
+        ftype const *rows[TILE];
+
+        for (size_t j = 0; j < n; ++j) {
+            rows[j] = dataSet_->input(index(src + j)).data();
+        }
+        for (size_t r = 0; r < inputs.rows; ++r) {
+            ftype *out = inputs[r] + dst;
+            for (size_t j = 0; j < n; ++j) {
+                out[j] = rows[j][r];
+            }
+        }
     }
 
-    size_t size() const { return size_; }
+    // Same as pack_tile for the raw and 16 bits inputs: the tile is decoded
+    // with the SIMD kernels by chunks of CHUNK inputs, in a buffer on the
+    // stack.
+    void pack_encoded(Matrix &inputs, size_t src, size_t dst, size_t n) const {
+        ftype tile[TILE][CHUNK];
+
+        for (size_t r = 0; r < inputs.rows; r += CHUNK) {
+            size_t m = std::min(CHUNK, inputs.rows - r);
+            for (size_t j = 0; j < n; ++j) {
+                dataSet_->input(index(src + j), r, std::span(tile[j], m));
+            }
+            for (size_t k = 0; k < m; ++k) {
+                ftype *out = inputs[r + k] + dst;
+                for (size_t j = 0; j < n; ++j) {
+                    out[j] = tile[j][k];
+                }
+            }
+        }
+    }
 
   private:
     DataSet const *dataSet_ = nullptr;
     size_t size_ = 0;
+    LastBatch last_batch_ = LastBatch::Partial;
+    size_t first_ = 0; // slice of the shard in the permutation
+    size_t last_ = 0;
     std::vector<size_t> indexes_;
     std::mt19937 gen_;
-    size_t offset_ = 0;
+    size_t nb_epochs_ = 0; // number of started epochs
+    size_t offset_ = END;  // first sample of the minibatch in the shard
+    size_t count_ = 0;
 };
 
 #endif
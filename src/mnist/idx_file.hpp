@@ -0,0 +1,109 @@
+#ifndef MNIST_IDX_FILE_H
+#define MNIST_IDX_FILE_H
+#include <cstdint>
+#include <fcntl.h>
+#include <iostream>
+#include <span>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Read only memory mapping of an IDX file (the format of the MNIST files).
+ * The header is validated (magic number, unsigned byte data and size of the
+ * file) and the data is exposed without any copy. The pages are loaded by the
+ * system when they are read.
+ */
+class IDXFile {
+  public:
+    explicit IDXFile(std::string const &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+
+        if (fd < 0) {
+            std::cerr << "error: can't open idx file " << path << std::endl;
+            return;
+        }
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            map_size_ = st.st_size;
+            map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (map_ == MAP_FAILED) {
+            std::cerr << "error: can't map idx file " << path << std::endl;
+            return;
+        }
+        if (!parse_header()) {
+            std::cerr << "error: invalid idx file " << path << std::endl;
+            unmap();
+            return;
+        }
+        madvise(map_, map_size_, MADV_SEQUENTIAL);
+    }
+
+    ~IDXFile() { unmap(); }
+
+    IDXFile(IDXFile const &) = delete;
+    IDXFile const &operator=(IDXFile const &) = delete;
+
+  public:
+    bool is_open() const { return map_ != MAP_FAILED; }
+
+    /* dimensions, the first one is the number of items */
+    std::vector<size_t> const &dims() const { return dims_; }
+    size_t size() const { return dims_.empty() ? 0 : dims_[0]; }
+    size_t item_size() const {
+        return size() == 0 ? 0 : data_.size() / size();
+    }
+
+    std::span<uint8_t const> data() const { return data_; }
+
+  private:
+    // magic: 0x00 0x00 type nb_dims, then nb_dims big endian uint32
+    bool parse_header() {
+        auto bytes = static_cast<uint8_t const *>(map_);
+        size_t nb_dims = 0, header_size = 0, data_size = 1;
+
+        if (map_size_ < 4 || bytes[0] != 0 || bytes[1] != 0 ||
+            bytes[2] != UNSIGNED_BYTE || bytes[3] == 0) {
+            return false;
+        }
+        nb_dims = bytes[3];
+        header_size = 4 + 4 * nb_dims;
+        if (map_size_ < header_size) {
+            return false;
+        }
+        for (size_t i = 0; i < nb_dims; ++i) {
+            uint8_t const *dim = bytes + 4 + 4 * i;
+            dims_.push_back(size_t(dim[0]) << 24 | size_t(dim[1]) << 16 |
+                            size_t(dim[2]) << 8 | size_t(dim[3]));
+            data_size *= dims_.back();
+        }
+        if (map_size_ != header_size + data_size) {
+            return false;
+        }
+        data_ = std::span(bytes + header_size, data_size);
+        return true;
+    }
+
+    void unmap() {
+        if (map_ != MAP_FAILED) {
+            munmap(map_, map_size_);
+            map_ = MAP_FAILED;
+        }
+        dims_.clear();
+        data_ = {};
+    }
+
+  private:
+    static constexpr uint8_t UNSIGNED_BYTE = 0x08;
+
+    void *map_ = MAP_FAILED;
+    size_t map_size_ = 0;
+    std::vector<size_t> dims_ = {};
+    std::span<uint8_t const> data_ = {};
+};
+
+#endif
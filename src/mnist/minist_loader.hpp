@@ -2,105 +2,58 @@
 #define MNIST_MINIST_LOADER_H
 #include "../math.hpp"
 #include "../types.hpp"
-#include <cassert>
-#include <fstream>
+#include "idx_file.hpp"
 #include <iostream>
+#include <memory>
+#include <span>
 #include <string>
-#include <vector>
 
+/*
+ * The MNIST files are memory mapped: the images stay as bytes in the mapping
+ * and are normalized to [0, 1] when the samples are read (see DataSet). Use
+ * DataSet::normalized to convert them once.
+ */
 class MNISTLoader {
   public:
-    using byte = char;
-    using ifstream_type = std::basic_ifstream<byte>;
+    static constexpr size_t NB_CLASSES = 10;
 
   public:
-    unsigned int read_big_endian_uint(ifstream_type &fs) {
-        byte buff[4];
-        fs.read(buff, 4);
-        std::swap(buff[0], buff[3]);
-        std::swap(buff[1], buff[2]);
-        return *reinterpret_cast<uint*>(buff);
-    }
-
-    std::vector<int> load_labels(std::string const &path) {
-        ifstream_type fs(path, std::ios::binary);
-        [[maybe_unused]] unsigned int magic = 0, size = 0;
+    DataSet load_ds(std::string const labels_path,
+                    std::string const images_path) {
+        std::cout << "loading labels " << labels_path << "..." << std::endl;
+        IDXFile labels(labels_path);
+        std::cout << "loading images " << images_path << "..." << std::endl;
+        auto images = std::make_shared<IDXFile>(images_path);
 
-        if (!fs.is_open()) {
-            std::cerr << "error: can't open label file " << path << std::endl;
+        if (!labels.is_open() || !images->is_open()) {
             return {};
         }
-        std::cout << "loading labels " << path << "..." << std::endl;
-
-        magic = read_big_endian_uint(fs);
-        size = read_big_endian_uint(fs);
-
-        std::cout << "magic = " << magic << "; size = " << size << std::endl;
-
-        std::vector<int> labels(size);
-        for (size_t i = 0; i < size; ++i) {
-            byte label;
-            fs.read(&label, 1);
-            labels[i] = int(label);
-        }
-        return labels;
-    }
-
-    std::vector<Vector> load_imgages(std::string const &path) {
-        ifstream_type fs(path, std::ios::binary);
-        [[maybe_unused]] unsigned int magic = 0, size = 0, rows = 0, cols = 0;
-
-        if (!fs.is_open()) {
-            std::cerr << "error: can't open image file " << path << std::endl;
+        if (labels.dims().size() != 1 || images->dims().size() != 3 ||
+            labels.size() != images->size()) {
+            std::cerr << "error: the labels and the images don't match"
+                      << std::endl;
             return {};
         }
-        std::cout << "loading images " << path << "..." << std::endl;
-
-        magic = read_big_endian_uint(fs);
-        size = read_big_endian_uint(fs);
-        rows = read_big_endian_uint(fs);
-        cols = read_big_endian_uint(fs);
-
-        std::cout << "magic = " << magic << "; size = " << size << std::endl;
-        std::cout << "row & cols = " << rows << "x" << cols << std::endl;
-
-        std::vector<Vector> images(size);
-
-        for (size_t i = 0; i < size; ++i) {
-            Vector image(rows * cols);
-            for (size_t px = 0; px < image.size; ++px) {
-                unsigned char px_value;
-                fs.get(reinterpret_cast<byte&>(px_value));
-                assert(0 <= px_value && px_value <= 255);
-                image[px] = (ftype) px_value / 255.;
+        std::cout << "size = " << images->size() << std::endl;
+        std::cout << "row & cols = " << images->dims()[1] << "x"
+                  << images->dims()[2] << std::endl;
+
+        DataSet ds = DataSet::with_raw_inputs(images->data(),
+                                              images->item_size(), 1 / 255.,
+                                              images, NB_CLASSES);
+        for (size_t i = 0; i < labels.size(); ++i) {
+            if (labels.data()[i] >= NB_CLASSES) {
+                std::cerr << "error: invalid label " << int(labels.data()[i])
+                          << " in " << labels_path << std::endl;
+                return {};
             }
-            images[i] = std::move(image);
-        }
-
-        return images;
-    }
-
-    Vector create_output_vector(int label) {
-        Vector result(10);
-        memset(result.mem, 0, result.size * sizeof(*result.mem));
-        result[label] = 1;
-        return result;
-    }
-
-    DataSet load_ds(std::string const labels_path,
-                     std::string const images_path) {
-        auto labels = load_labels(labels_path);
-        auto images = load_imgages(images_path);
-
-        DataSet ds(images.size());
-
-        for (size_t i = 0; i < ds.size(); ++i) {
-            ds[i] = DataSetEntry(images[i], create_output_vector(labels[i]));
+            ds.label(i, labels.data()[i]);
         }
         return ds;
     }
 
-    static void print_image(Vector const &image, size_t rows, size_t cols) {
+    static void print_image(std::span<ftype const> image, size_t rows,
+                            size_t cols) {
         for (size_t i = 0; i < rows; ++i) {
             for (size_t j = 0; j < cols; ++j) {
                 if (image[i * cols + j] == 0) {
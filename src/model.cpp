@@ -1,4 +1,5 @@
 #include "model.hpp"
+#include <cassert>
 #include <iostream>
 #include <random>
 
@@ -22,6 +23,7 @@ void Model::init(uint64_t seed) {
             layer.biases.mem[i] = dist(gen);
         }
     }
+    refresh_half();
 }
 
 void Model::input(size_t nb_inputs) { this->inputs_ = nb_inputs; }
@@ -38,8 +40,81 @@ void Model::add_layer(size_t nb_nodes) {
     if (!this->layers.empty()) {
         nb_inputs = this->layers.back().nb_nodes;
     }
-    this->layers.emplace_back(Matrix(nb_nodes, nb_inputs), Vector(nb_nodes),
-                              nb_nodes, nb_inputs);
+    parameters_.add_layer(nb_nodes, nb_inputs);
+    bind();
 }
 
-void Model::clear() { layers.clear(); }
+void Model::clear() {
+    layers.clear();
+    parameters_.clear();
+    half_.clear();
+}
+
+void Model::half_precision(Precision precision) {
+    half_precision_ = precision;
+    if (precision == Precision::FP32) {
+        half_ = {};
+    }
+    refresh_half();
+}
+
+void Model::refresh_half() {
+    if (half_precision_ == Precision::FP32) {
+        return;
+    }
+    half_.resize(parameters_.size());
+    to_half(half_precision_, parameters_.flat(), half_);
+}
+
+uint16_t const *Model::half_weights(size_t l) const {
+    if (half_precision_ == Precision::FP32) {
+        return nullptr;
+    }
+    assert(half_.size() == parameters_.size() && "refresh_half is missing");
+    size_t offset = parameters_.weights(l).mem - parameters_.flat().data();
+    return half_.data() + offset;
+}
+
+Model::Model(size_t nb_inputs, Parameters parameters)
+    : inputs_(nb_inputs), parameters_(std::move(parameters)) {
+    assert(parameters_.nb_layers() == 0 ||
+           parameters_.weights(0).cols == inputs_);
+    bind();
+}
+
+Model::Model(Model const &other)
+    : inputs_(other.inputs_), parameters_(other.parameters_),
+      half_precision_(other.half_precision_), half_(other.half_) {
+    bind();
+}
+
+// Copying a model with the same layers is one copy of the parameters buffer
+// (and of the 16 bits copy).
+Model &Model::operator=(Model const &other) {
+    if (&other == this) {
+        return *this;
+    }
+    bool rebind = !parameters_.same_layout(other.parameters_);
+    inputs_ = other.inputs_;
+    parameters_ = other.parameters_;
+    half_precision_ = other.half_precision_;
+    half_ = other.half_;
+    if (rebind) {
+        bind();
+    }
+    return *this;
+}
+
+// Recreate the layers from the views of the parameters (the buffer moves when
+// a layer is added).
+void Model::bind() {
+    layers.clear();
+    for (size_t l = 0; l < parameters_.nb_layers(); ++l) {
+        Matrix &weights = parameters_.weights(l);
+        Vector &biases = parameters_.biases(l);
+        layers.emplace_back(Matrix::view(weights.mem, weights.rows,
+                                         weights.cols),
+                            Vector::view(biases.mem, biases.size),
+                            weights.rows, weights.cols);
+    }
+}
@@ -1,14 +1,24 @@
 #ifndef MODEL_H
 #define MODEL_H
+#include "kernels.hpp"
 #include "layer.hpp"
+#include "parameters.hpp"
 #include <cstdint>
 #include <vector>
 
+/* The weights and biases of the layers are views into the parameters, which
+ * store all of them in one contiguous buffer. */
 struct Model {
     std::vector<Layer> layers;
 
   public:
     Model() = default;
+    /* model using existing parameters (ex: mapped from a model file) */
+    Model(size_t nb_inputs, Parameters parameters);
+    Model(Model const &other);
+    Model(Model &&other) = default;
+    Model &operator=(Model const &other);
+    Model &operator=(Model &&other) = default;
 
     ~Model() { clear(); }
 
@@ -18,8 +28,30 @@ struct Model {
     void add_layer(size_t nb_nodes);
     void clear();
 
+    size_t nb_inputs() const { return inputs_; }
+
+    Parameters &parameters() { return parameters_; }
+    Parameters const &parameters() const { return parameters_; }
+
+    /* Optional bf16 or fp16 copy of the parameters, read by the inference
+     * (sessions and evaluators) with fp32 accumulation: the weights move in
+     * 16 bits. The parameters stay the fp32 master copy of the trainer and
+     * the optimizers, and refresh_half converts them again (the trainer calls
+     * it after each update, the other writers of the parameters must call
+     * it). FP32 removes the copy. */
+    void half_precision(Precision precision);
+    Precision half_precision() const { return half_precision_; }
+    void refresh_half();
+    /* weights of the layer l in the 16 bits copy, nullptr without it */
+    uint16_t const *half_weights(size_t l) const;
+
   private:
     size_t inputs_ = 0;
+    Parameters parameters_ = {};
+    Precision half_precision_ = Precision::FP32;
+    std::vector<uint16_t> half_ = {}; // same layout as the parameters
+
+    void bind();
 };
 
 #endif
@@ -0,0 +1,169 @@
+#include "model_file.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr char MAGIC[8] = {'N', 'N', 'M', 'O', 'D', 'E', 'L', '\0'};
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t activation;
+    uint32_t ftype_size;
+    uint32_t nb_layers;
+    uint32_t byte_order;
+    uint32_t reserved;
+    uint64_t nb_inputs;
+    uint64_t parameters_offset;
+    uint64_t nb_parameters;
+    uint64_t reserved2;
+};
+static_assert(sizeof(Header) == 64);
+
+size_t parameters_offset(size_t nb_layers) {
+    size_t size = sizeof(Header) + nb_layers * sizeof(uint64_t);
+    return (size + Parameters::ALIGNMENT - 1) / Parameters::ALIGNMENT *
+           Parameters::ALIGNMENT;
+}
+
+// validates the header and the topology, and computes the shapes of the
+// layers
+bool parse_header(uint8_t const *bytes, size_t file_size,
+                  Parameters::Shapes &shapes) {
+    Header header;
+
+    if (file_size < sizeof(Header)) {
+        return false;
+    }
+    memcpy(&header, bytes, sizeof(Header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.version != VERSION || header.byte_order != BYTE_ORDER_MARK ||
+        header.ftype_size != sizeof(ftype) ||
+        header.activation != uint32_t(ActivationType::Sigmoid) ||
+        header.nb_layers > file_size / sizeof(uint64_t) ||
+        header.parameters_offset != parameters_offset(header.nb_layers) ||
+        header.parameters_offset > file_size ||
+        header.nb_parameters !=
+            (file_size - header.parameters_offset) / sizeof(ftype) ||
+        (file_size - header.parameters_offset) % sizeof(ftype) != 0) {
+        return false;
+    }
+    size_t nb_inputs = header.nb_inputs;
+    for (size_t l = 0; l < header.nb_layers; ++l) {
+        uint64_t nb_nodes;
+        memcpy(&nb_nodes, bytes + sizeof(Header) + l * sizeof(uint64_t),
+               sizeof(nb_nodes));
+        // the sizes are bounded to avoid overflows in the layout size
+        if (nb_nodes == 0 || nb_nodes > file_size || nb_inputs > file_size) {
+            return false;
+        }
+        shapes.emplace_back(nb_nodes, nb_inputs);
+        nb_inputs = nb_nodes;
+    }
+    return Parameters::layout_size(shapes) == header.nb_parameters;
+}
+
+} // namespace
+
+bool save_model(std::string const &path, Model const &model,
+                ActivationType activation) {
+    Parameters const &parameters = model.parameters();
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    Header header = {};
+
+    if (!file) {
+        std::cerr << "error: can't create model file " << tmp_path
+                  << std::endl;
+        return false;
+    }
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.activation = uint32_t(activation);
+    header.ftype_size = sizeof(ftype);
+    header.nb_layers = model.layers.size();
+    header.byte_order = BYTE_ORDER_MARK;
+    header.nb_inputs = model.nb_inputs();
+    header.parameters_offset = parameters_offset(header.nb_layers);
+    header.nb_parameters = parameters.size();
+
+    std::vector<char> padding(header.parameters_offset - sizeof(Header) -
+                              header.nb_layers * sizeof(uint64_t));
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    for (auto const &layer : model.layers) {
+        uint64_t nb_nodes = layer.nb_nodes;
+        file.write(reinterpret_cast<char const *>(&nb_nodes),
+                   sizeof(nb_nodes));
+    }
+    file.write(padding.data(), padding.size());
+    file.write(reinterpret_cast<char const *>(parameters.flat().data()),
+               parameters.size() * sizeof(ftype));
+    file.close();
+    if (!file) {
+        std::cerr << "error: can't write model file " << tmp_path
+                  << std::endl;
+        std::filesystem::remove(tmp_path);
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "error: can't rename model file " << tmp_path << " to "
+                  << path << std::endl;
+        std::filesystem::remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+Model load_model(std::string const &path, ActivationType *activation) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    size_t map_size = 0;
+    void *map = MAP_FAILED;
+
+    if (fd < 0) {
+        std::cerr << "error: can't open model file " << path << std::endl;
+        return {};
+    }
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map_size = st.st_size;
+        // private writable mapping: the pages are shared with the page cache
+        // until the model is modified (copy on write)
+        map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                   0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "error: can't map model file " << path << std::endl;
+        return {};
+    }
+    std::shared_ptr<void> owner(
+        map, [map_size](void *map) { munmap(map, map_size); });
+    auto bytes = static_cast<uint8_t *>(map);
+    Parameters::Shapes shapes;
+
+    if (!parse_header(bytes, map_size, shapes)) {
+        std::cerr << "error: invalid model file " << path << std::endl;
+        return {};
+    }
+    Header header;
+    memcpy(&header, bytes, sizeof(Header));
+    madvise(map, map_size, MADV_WILLNEED);
+    if (activation) {
+        *activation = ActivationType(header.activation);
+    }
+    auto mem = reinterpret_cast<ftype *>(bytes + header.parameters_offset);
+    return Model(header.nb_inputs,
+                 Parameters::wrap(mem, shapes, std::move(owner)));
+}
@@ -0,0 +1,32 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+#include "model.hpp"
+#include <cstdint>
+#include <string>
+
+enum class ActivationType : uint32_t { Sigmoid = 0 };
+
+/*
+ * Binary model format (native byte order):
+ * - header (64 bytes): magic "NNMODEL\0", version, activation type, size of
+ *   ftype, number of layers, byte order mark, number of inputs, offset and
+ *   number of values of the parameters,
+ * - number of nodes of each layer (uint64),
+ * - zero padding up to the offset of the parameters (multiple of 64),
+ * - the buffer of the parameters, with the in memory layout (padded blocks).
+ * Since the parameters are stored as they are in memory, loading a model maps
+ * the file and uses the buffer in place, without any parse or copy step.
+ */
+
+/* writes to a temporary file renamed at the end, so an existing model is
+ * never left half written. Returns false on error. */
+bool save_model(std::string const &path, Model const &model,
+                ActivationType activation = ActivationType::Sigmoid);
+
+/* The parameters of the returned model are the pages of a private mapping of
+ * the file: they are loaded by the system when read and a modification of the
+ * model is never written to the file. The mapping lives as long as the
+ * parameters. Returns an empty model on error. */
+Model load_model(std::string const &path, ActivationType *activation = nullptr);
+
+#endif
@@ -0,0 +1,159 @@
+#include "parameters.hpp"
+#include <cassert>
+
+// number of elements of a block once padded to the alignment
+static size_t padded(size_t size) {
+    constexpr size_t step = Parameters::ALIGNMENT / sizeof(ftype);
+    return (size + step - 1) / step * step;
+}
+
+Parameters::Parameters(Parameters const &other) {
+    allocate(other.size_);
+    memcpy(mem_, other.mem_, size_ * sizeof(*mem_));
+    bind(other.shapes());
+}
+
+Parameters::Parameters(Parameters &&other) noexcept
+    : mem_(other.mem_), size_(other.size_), allocator_(other.allocator_),
+      weights_(std::move(other.weights_)), biases_(std::move(other.biases_)),
+      owner_(std::move(other.owner_)) {
+    other.mem_ = nullptr;
+    other.size_ = 0;
+    other.allocator_ = nullptr;
+    other.weights_.clear();
+    other.biases_.clear();
+}
+
+Parameters &Parameters::operator=(Parameters const &other) {
+    if (&other == this) {
+        return *this;
+    }
+    if (!same_layout(other)) {
+        clear();
+        allocate(other.size_);
+        bind(other.shapes());
+    }
+    memcpy(mem_, other.mem_, size_ * sizeof(*mem_));
+    return *this;
+}
+
+Parameters &Parameters::operator=(Parameters &&other) noexcept {
+    std::swap(mem_, other.mem_);
+    std::swap(size_, other.size_);
+    std::swap(allocator_, other.allocator_);
+    std::swap(weights_, other.weights_);
+    std::swap(biases_, other.biases_);
+    std::swap(owner_, other.owner_);
+    return *this;
+}
+
+Parameters Parameters::zeros_like(Parameters const &other) {
+    Parameters result;
+
+    result.allocate(other.size_);
+    result.bind(other.shapes());
+    return result;
+}
+
+Parameters Parameters::wrap(ftype *mem, Shapes const &shapes,
+                            std::shared_ptr<void> owner) {
+    Parameters result;
+
+    assert(reinterpret_cast<uintptr_t>(mem) % ALIGNMENT == 0);
+    result.mem_ = mem;
+    result.size_ = layout_size(shapes);
+    result.owner_ = std::move(owner);
+    result.bind(shapes);
+    return result;
+}
+
+size_t Parameters::layout_size(Shapes const &shapes) {
+    size_t size = 0;
+
+    for (auto [nb_nodes, nb_inputs] : shapes) {
+        size += padded(nb_nodes * nb_inputs) + padded(nb_nodes);
+    }
+    return size;
+}
+
+void Parameters::add_layer(size_t nb_nodes, size_t nb_inputs) {
+    auto layer_shapes = shapes();
+    ftype *old_mem = mem_;
+    size_t old_size = size_;
+    Allocator *old_allocator = allocator_;
+
+    layer_shapes.emplace_back(nb_nodes, nb_inputs);
+    mem_ = nullptr;
+    allocate(size_ + padded(nb_nodes * nb_inputs) + padded(nb_nodes));
+    memcpy(mem_, old_mem, old_size * sizeof(*mem_));
+    if (old_allocator) {
+        old_allocator->deallocate(old_mem, old_size * sizeof(*mem_));
+    }
+    owner_ = nullptr;
+    bind(layer_shapes);
+}
+
+void Parameters::clear() {
+    weights_.clear();
+    biases_.clear();
+    if (allocator_) {
+        allocator_->deallocate(mem_, size_ * sizeof(*mem_));
+    }
+    mem_ = nullptr;
+    size_ = 0;
+    allocator_ = nullptr;
+    owner_ = nullptr;
+}
+
+void Parameters::fill(ftype value) { std::fill(mem_, mem_ + size_, value); }
+
+bool Parameters::same_layout(Parameters const &other) const {
+    if (nb_layers() != other.nb_layers()) {
+        return false;
+    }
+    for (size_t l = 0; l < nb_layers(); ++l) {
+        if (weights_[l].rows != other.weights_[l].rows ||
+            weights_[l].cols != other.weights_[l].cols) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The buffer is zeroed, so the padding is always 0.
+void Parameters::allocate(size_t size) {
+    assert(mem_ == nullptr);
+    size_ = size;
+    allocator_ = default_allocator();
+    mem_ = static_cast<ftype *>(allocator_->allocate(size * sizeof(ftype)));
+    memset(mem_, 0, size * sizeof(ftype));
+}
+
+void Parameters::bind(Shapes const &shapes) {
+    ftype *mem = mem_;
+
+    weights_.clear();
+    biases_.clear();
+    for (auto [nb_nodes, nb_inputs] : shapes) {
+        weights_.push_back(Matrix::view(mem, nb_nodes, nb_inputs));
+        mem += padded(nb_nodes * nb_inputs);
+        biases_.push_back(Vector::view(mem, nb_nodes));
+        mem += padded(nb_nodes);
+    }
+    assert(mem == mem_ + size_);
+}
+
+Parameters::Shapes Parameters::shapes() const {
+    Shapes result;
+
+    for (auto const &w : weights_) {
+        result.emplace_back(w.rows, w.cols);
+    }
+    return result;
+}
+
+Parameters &operator+=(Parameters &lhs, Parameters const &rhs) {
+    assert(lhs.size() == rhs.size());
+    axpy<ftype>(lhs.size(), 1.0, rhs.flat().data(), 1, lhs.flat().data(), 1);
+    return lhs;
+}
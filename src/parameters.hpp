@@ -0,0 +1,72 @@
+#ifndef PARAMETERS_H
+#define PARAMETERS_H
+#include "math.hpp"
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+/*
+ * Storage with the layout of the parameters of a model: the weights and then
+ * the biases of each layer in one contiguous buffer. The buffer and every
+ * block are aligned on a cache line (the blocks are padded with zeros), and
+ * the weights and biases are views into the buffer. A loop over all the
+ * parameters is a loop over flat(), and a copy is one memcpy. The model, the
+ * gradients and the state of the optimizers use this layout.
+ */
+class Parameters {
+  public:
+    static constexpr size_t ALIGNMENT = Allocator::ALIGNMENT;
+    using Shapes = std::vector<std::pair<size_t, size_t>>; // nodes x inputs
+
+    Parameters() = default;
+    Parameters(Parameters const &other);
+    Parameters(Parameters &&other) noexcept;
+    Parameters &operator=(Parameters const &other);
+    Parameters &operator=(Parameters &&other) noexcept;
+    ~Parameters() { clear(); }
+
+    /* parameters with the same layout as other, set to 0 */
+    static Parameters zeros_like(Parameters const &other);
+    /* parameters stored in memory owned by someone else (ex: a memory mapped
+     * file), which stays valid as long as owner is alive. mem holds
+     * layout_size(shapes) values. */
+    static Parameters wrap(ftype *mem, Shapes const &shapes,
+                           std::shared_ptr<void> owner);
+    /* number of values of the buffer for these layers (with the padding) */
+    static size_t layout_size(Shapes const &shapes);
+
+  public:
+    /* append a layer, the values of the previous layers are kept */
+    void add_layer(size_t nb_nodes, size_t nb_inputs);
+    void clear();
+    void fill(ftype value);
+    bool same_layout(Parameters const &other) const;
+
+    size_t nb_layers() const { return weights_.size(); }
+    Shapes shapes() const;
+    size_t size() const { return size_; }
+    std::span<ftype> flat() { return {mem_, size_}; }
+    std::span<ftype const> flat() const { return {mem_, size_}; }
+
+    Matrix &weights(size_t l) { return weights_[l]; }
+    Matrix const &weights(size_t l) const { return weights_[l]; }
+    Vector &biases(size_t l) { return biases_[l]; }
+    Vector const &biases(size_t l) const { return biases_[l]; }
+
+  private:
+    ftype *mem_ = nullptr;
+    size_t size_ = 0;
+    Allocator *allocator_ = nullptr;
+    std::vector<Matrix> weights_ = {};
+    std::vector<Vector> biases_ = {};
+    std::shared_ptr<void> owner_ = nullptr; // external memory only
+
+    void allocate(size_t size);
+    void bind(Shapes const &shapes);
+};
+
+/* lhs += rhs on the whole buffer */
+Parameters &operator+=(Parameters &lhs, Parameters const &rhs);
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+#include "allocator.hpp"
+#include "minibatch_generator.hpp"
+#include "thread_budget.hpp"
+#include "types.hpp"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+/* A minibatch packed as (inputs x n) and (outputs x n) matrices, which are
+ * views on buffers sized for the full minibatches. */
+struct PackedBatch {
+    Matrix inputs = {};
+    Matrix ground_truths = {};
+    size_t epoch = 0;
+
+    PackedBatch() = default;
+    PackedBatch(size_t nb_inputs, size_t nb_outputs, size_t capacity)
+        : inputs_buffer_(nb_inputs, capacity),
+          ground_truths_buffer_(nb_outputs, capacity) {
+        inputs = Matrix::view(inputs_buffer_.mem, nb_inputs, capacity);
+        ground_truths =
+            Matrix::view(ground_truths_buffer_.mem, nb_outputs, capacity);
+    }
+
+    size_t size() const { return inputs.cols; }
+
+    void resize(size_t size) {
+        assert(size <= inputs_buffer_.cols);
+        inputs.cols = size;
+        ground_truths.cols = size;
+    }
+
+    /* Same as MinibatchGenerator::pack: copy the columns
+     * [first, first + inputs.cols). */
+    void pack(Matrix &inputs, Matrix &ground_truths, size_t first = 0) const {
+        copy_cols(this->inputs, inputs, first);
+        copy_cols(this->ground_truths, ground_truths, first);
+    }
+
+  private:
+    static void copy_cols(Matrix const &src, Matrix &dst, size_t first) {
+        assert(src.rows == dst.rows && first + dst.cols <= src.cols);
+        if (first == 0 && dst.cols == src.cols) {
+            memcpy(dst.mem, src.mem, src.rows * src.cols * sizeof(ftype));
+            return;
+        }
+        for (size_t r = 0; r < src.rows; ++r) {
+            memcpy(dst[r], src[r] + first, dst.cols * sizeof(ftype));
+        }
+    }
+
+  private:
+    Matrix inputs_buffer_ = {};
+    Matrix ground_truths_buffer_ = {};
+};
+
+struct PrefetchStats {
+    size_t nb_batches = 0;
+    size_t nb_waits = 0;  // batches that were not ready when requested
+    double wait_time = 0; // seconds spent by the consumer waiting
+};
+
+/*
+ * Prepare the next minibatches in the background: the producer threads
+ * shuffle, gather and normalize the batches into a bounded ring of packed
+ * buffers while the consumer trains on the current one. The producer p
+ * prepares the batches p, p + nb_producers..., with its own copy of the
+ * generator, so the sequence of batches is the same as the one of the
+ * generator (the batch k is the one after k + 1 calls to generate).
+ *
+ * The ring is lock-free: the slot of the batch k holds a sequence number
+ * which is k when the slot is free for the batch k, and k + 1 when the batch
+ * is ready. The consumer frees the slot for the batch k + capacity when it
+ * requests the next batch. The threads wait on the sequence numbers with
+ * atomic wait / notify.
+ */
+class MinibatchPrefetcher {
+  public:
+    MinibatchPrefetcher(MinibatchGenerator const &generator,
+                        size_t nb_producers = 1, size_t capacity = 0)
+        : slots_(capacity ? capacity : nb_producers + 2) {
+        assert(nb_producers > 0 && slots_.size() >= nb_producers);
+        DataSet const &ds = generator.dataset();
+
+        for (size_t s = 0; s < slots_.size(); ++s) {
+            slots_[s].seq.store(s, std::memory_order_relaxed);
+            slots_[s].batch = PackedBatch(ds.nb_inputs(), ds.nb_outputs(),
+                                          generator.batch_size());
+        }
+        for (size_t p = 0; p < nb_producers; ++p) {
+            producers_.emplace_back([this, generator, p, nb_producers]() {
+                produce(generator, p, nb_producers);
+                PoolAllocator::instance().trim();
+            });
+        }
+    }
+
+    ~MinibatchPrefetcher() {
+        stopping_.store(true);
+        for (auto &slot : slots_) {
+            slot.seq.store(STOP);
+            slot.seq.notify_all();
+        }
+        for (auto &producer : producers_) {
+            producer.join();
+        }
+    }
+
+    MinibatchPrefetcher(MinibatchPrefetcher const &) = delete;
+    MinibatchPrefetcher const &
+    operator=(MinibatchPrefetcher const &) = delete;
+
+  public:
+    /* release the current batch and wait for the next one */
+    PackedBatch const &next() {
+        size_t k = stats_.nb_batches;
+
+        if (k > 0) {
+            Slot &previous = slots_[(k - 1) % slots_.size()];
+            size_t free = k - 1 + slots_.size();
+            previous.seq.store(free, std::memory_order_release);
+            previous.seq.notify_all();
+        }
+        Slot &slot = slots_[k % slots_.size()];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != k + 1) {
+            auto t1 = std::chrono::steady_clock::now();
+            while (seq != k + 1) {
+                slot.seq.wait(seq, std::memory_order_acquire);
+                seq = slot.seq.load(std::memory_order_acquire);
+            }
+            auto t2 = std::chrono::steady_clock::now();
+            stats_.wait_time += std::chrono::duration<double>(t2 - t1).count();
+            ++stats_.nb_waits;
+        }
+        ++stats_.nb_batches;
+        return slot.batch;
+    }
+
+    PrefetchStats const &stats() const { return stats_; }
+
+  private:
+    static constexpr size_t STOP = SIZE_MAX;
+
+    struct alignas(64) Slot {
+        std::atomic<size_t> seq = 0;
+        PackedBatch batch = {};
+    };
+
+    void produce(MinibatchGenerator generator, size_t first,
+                 size_t nb_producers) {
+        size_t generated = 0;
+        ThreadBudget::Lease lease(Activity::Prefetch);
+
+        for (size_t k = first; !stopping_.load(); k += nb_producers) {
+            Slot &slot = slots_[k % slots_.size()];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+
+            while (seq != k) {
+                if (stopping_.load()) {
+                    return;
+                }
+                slot.seq.wait(seq, std::memory_order_acquire);
+                seq = slot.seq.load(std::memory_order_acquire);
+            }
+            for (; generated <= k; ++generated) {
+                generator.generate();
+            }
+            slot.batch.resize(generator.size());
+            slot.batch.epoch = generator.epoch();
+            generator.pack(slot.batch.inputs, slot.batch.ground_truths);
+            slot.seq.store(k + 1, std::memory_order_release);
+            slot.seq.notify_all();
+        }
+    }
+
+  private:
+    std::vector<Slot> slots_;
+    std::vector<std::thread> producers_ = {};
+    std::atomic<bool> stopping_ = false;
+    PrefetchStats stats_ = {};
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+/* phases of a training step */
+enum class Phase { Data, Forward, Backward, Optimizer };
+constexpr size_t NB_PHASES = 4;
+
+inline char const *phase_name(Phase phase) {
+    switch (phase) {
+    case Phase::Data:
+        return "data";
+    case Phase::Forward:
+        return "forward";
+    case Phase::Backward:
+        return "backward";
+    case Phase::Optimizer:
+        return "optimizer";
+    }
+    return "unknown";
+}
+
+/* aggregate of the durations of a phase over a set of steps (seconds) */
+struct PhaseStats {
+    double total = 0;
+    double p50 = 0;
+    double p99 = 0;
+};
+
+/*
+ * Durations of the phases of the training steps since the last reset. The
+ * timers add their time to the current step, and end_step stores the time of
+ * each phase of the step in a ring of the CAPACITY last steps, from which the
+ * percentiles are computed (the totals are exact). The buffers are allocated
+ * once, so recording a step does not allocate.
+ */
+class PhaseProfile {
+  public:
+    static constexpr size_t CAPACITY = 1024;
+
+    PhaseProfile() : steps_(NB_PHASES * CAPACITY) {}
+
+  public:
+    void add(Phase phase, double seconds) { step_[size_t(phase)] += seconds; }
+
+    void end_step(size_t nb_samples) {
+        size_t slot = nb_steps_ % CAPACITY;
+
+        for (size_t p = 0; p < NB_PHASES; ++p) {
+            steps_[p * CAPACITY + slot] = step_[p];
+            totals_[p] += step_[p];
+            step_[p] = 0;
+        }
+        ++nb_steps_;
+        nb_samples_ += nb_samples;
+    }
+
+    size_t nb_steps() const { return nb_steps_; }
+    size_t nb_samples() const { return nb_samples_; }
+
+    /* time of all the phases */
+    double total() const {
+        double result = 0;
+        for (double t : totals_) {
+            result += t;
+        }
+        return result;
+    }
+
+    PhaseStats stats(Phase phase) const {
+        size_t size = std::min(nb_steps_, CAPACITY);
+        auto first = steps_.begin() + size_t(phase) * CAPACITY;
+        std::vector<float> sorted(first, first + size);
+        PhaseStats result = {totals_[size_t(phase)], 0, 0};
+
+        if (size > 0) {
+            std::sort(sorted.begin(), sorted.end());
+            result.p50 = sorted[size / 2];
+            result.p99 = sorted[std::min(size - 1, size * 99 / 100)];
+        }
+        return result;
+    }
+
+    void reset() {
+        step_ = {};
+        totals_ = {};
+        nb_steps_ = 0;
+        nb_samples_ = 0;
+    }
+
+  private:
+    std::array<double, NB_PHASES> step_ = {};
+    std::array<double, NB_PHASES> totals_ = {};
+    std::vector<float> steps_; // NB_PHASES rings of CAPACITY steps
+    size_t nb_steps_ = 0;
+    size_t nb_samples_ = 0;
+};
+
+/*
+ * Add the time of a scope to a phase of the current step of the profile (if
+ * not null). Without NN_PROFILE, the timer is empty and compiled out.
+ */
+class PhaseTimer {
+  public:
+#ifdef NN_PROFILE
+    PhaseTimer(PhaseProfile *profile, Phase phase)
+        : profile_(profile), phase_(phase) {
+        if (profile_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~PhaseTimer() {
+        if (profile_) {
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start_;
+            profile_->add(phase_, elapsed.count());
+        }
+    }
+#else
+    PhaseTimer(PhaseProfile *, Phase) {}
+#endif
+
+    PhaseTimer(PhaseTimer const &) = delete;
+    PhaseTimer &operator=(PhaseTimer const &) = delete;
+
+#ifdef NN_PROFILE
+  private:
+    PhaseProfile *profile_;
+    Phase phase_;
+    std::chrono::steady_clock::time_point start_ = {};
+#endif
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "quantized_model.hpp"
+#include "inference.hpp"
+#include "kernels.hpp"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+static constexpr size_t PADDING = 64;
+
+QuantizedModel::QuantizedModel(Model const &model) {
+    assert(!model.layers.empty());
+    for (auto const &layer : model.layers) {
+        Layer q;
+
+        q.nb_nodes = layer.nb_nodes;
+        q.nb_inputs = layer.nb_inputs;
+        q.stride = (layer.nb_inputs + PADDING - 1) / PADDING * PADDING;
+        q.weights.resize(q.nb_nodes * q.stride);
+        q.scales.resize(q.nb_nodes);
+        q.biases.assign(layer.biases.mem, layer.biases.mem + q.nb_nodes);
+        for (size_t r = 0; r < q.nb_nodes; ++r) {
+            ftype const *w = layer.weights[r];
+            ftype max = 0;
+            for (size_t k = 0; k < q.nb_inputs; ++k) {
+                max = std::max(max, std::abs(w[k]));
+            }
+            ftype scale = max > 0 ? max / 127 : 1;
+            for (size_t k = 0; k < q.nb_inputs; ++k) {
+                q.weights[r * q.stride + k] = (int8_t)std::lrint(w[k] / scale);
+            }
+            q.scales[r] = scale / 255;
+        }
+        layers_.push_back(std::move(q));
+    }
+
+    // quantized sigmoid at the middle of each step
+    for (size_t i = 0; i < SIGMOID_SIZE; ++i) {
+        double z = ((double)i + 0.5) / SIGMOID_STEPS - SIGMOID_MAX;
+        sigmoid_[i] = (uint8_t)std::lrint(255 / (1 + std::exp(-z)));
+    }
+}
+
+size_t QuantizedModel::size() const {
+    size_t size = sizeof(sigmoid_);
+    for (auto const &layer : layers_) {
+        size += layer.weights.size() +
+                (layer.scales.size() + layer.biases.size()) * sizeof(ftype);
+    }
+    return size;
+}
+
+QuantizedModel::Buffers QuantizedModel::buffers() const {
+    size_t max_width = 0, max_nodes = 0;
+    for (auto const &layer : layers_) {
+        max_width = std::max(max_width, layer.stride);
+        max_nodes = std::max(max_nodes, layer.nb_nodes);
+    }
+    max_width = std::max(max_width,
+                         (max_nodes + PADDING - 1) / PADDING * PADDING);
+
+    // the padding of the activations stays null
+    Buffers buffers;
+    buffers.ping.resize(max_width);
+    buffers.pong.resize(max_width);
+    buffers.acc.resize(max_nodes);
+    buffers.input.resize(nb_inputs());
+    return buffers;
+}
+
+Label QuantizedModel::predict(std::span<ftype const> input,
+                              Buffers &buffers) const {
+    assert(input.size() == nb_inputs());
+    quantize(input, 255, std::span(buffers.ping.data(), input.size()));
+    return predict(buffers);
+}
+
+Label QuantizedModel::predict(DataSet const &ds, size_t i,
+                              Buffers &buffers) const {
+    assert(ds.nb_inputs() == nb_inputs());
+    if (ds.is_raw() && std::abs(ds.raw_scale() * 255 - 1) < 1e-6) {
+        std::span<uint8_t const> x = ds.raw_input(i);
+        std::copy(x.begin(), x.end(), buffers.ping.begin());
+        return predict(buffers);
+    }
+    ds.input(i, buffers.input);
+    return predict(buffers.input, buffers);
+}
+
+Label QuantizedModel::predict(Buffers &buffers) const {
+    uint8_t *a = buffers.ping.data();
+    uint8_t *next = buffers.pong.data();
+
+    for (size_t l = 0; l < layers_.size(); ++l) {
+        Layer const &layer = layers_[l];
+        std::span<int32_t> acc(buffers.acc.data(), layer.nb_nodes);
+
+        gemv_s8u8(layer.weights, layer.stride,
+                  std::span<uint8_t const>(a, layer.stride), acc);
+        if (l + 1 == layers_.size()) {
+            break;
+        }
+        for (size_t r = 0; r < layer.nb_nodes; ++r) {
+            ftype z = (ftype)acc[r] * layer.scales[r] + layer.biases[r];
+            ftype x = (z + SIGMOID_MAX) * SIGMOID_STEPS;
+            // clamped before the conversion, NaN gives 0
+            size_t idx =
+                x > 0 ? size_t(std::min<ftype>(x, SIGMOID_SIZE - 1)) : 0;
+            next[r] = sigmoid_[idx];
+        }
+        std::swap(a, next);
+    }
+
+    // output layer: argmax of z
+    Layer const &layer = layers_.back();
+    Label found = 0;
+    ftype found_max = 0;
+    for (size_t r = 0; r < layer.nb_nodes; ++r) {
+        ftype z = (ftype)buffers.acc[r] * layer.scales[r] + layer.biases[r];
+        if (r == 0 || z > found_max) {
+            found_max = z;
+            found = r;
+        }
+    }
+    return found;
+}
+
+ftype QuantizedModel::evaluate(DataSet const &ds, ThreadPool *pool) const {
+    size_t nb_threads = pool ? pool->size() : 1;
+    std::vector<size_t> count_valid(nb_threads);
+
+    auto task = [&](size_t id) {
+        Buffers b = buffers();
+        for (size_t i = id; i < ds.size(); i += nb_threads) {
+            count_valid[id] += predict(ds, i, b) == ds.label(i);
+        }
+    };
+    if (pool) {
+        pool->run(task);
+    } else {
+        task(0);
+    }
+    size_t total = 0;
+    for (size_t count : count_valid) {
+        total += count;
+    }
+    return 100 * ((ftype)total / (ftype)ds.size());
+}
+
+QuantizationReport compare(Model const &model, QuantizedModel const &quantized,
+                           DataSet const &ds) {
+    QuantizationReport report;
+    Sigmoid sigmoid;
+    BasicInferenceSession<Sigmoid> session(&model, &sigmoid);
+    std::vector<ftype> input(ds.nb_inputs());
+    std::vector<Label> fp32(ds.size()), int8(ds.size());
+    QuantizedModel::Buffers buffers = quantized.buffers();
+    size_t fp32_valid = 0, int8_valid = 0, agreements = 0;
+
+    auto t1 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ds.size(); ++i) {
+        ds.input(i, input);
+        fp32[i] = session.classify(input);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ds.size(); ++i) {
+        int8[i] = quantized.predict(ds, i, buffers);
+    }
+    auto t3 = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < ds.size(); ++i) {
+        fp32_valid += fp32[i] == ds.label(i);
+        int8_valid += int8[i] == ds.label(i);
+        agreements += fp32[i] == int8[i];
+    }
+    report.nb_samples = ds.size();
+    report.fp32_accuracy = 100 * ((ftype)fp32_valid / (ftype)ds.size());
+    report.int8_accuracy = 100 * ((ftype)int8_valid / (ftype)ds.size());
+    report.agreement = 100 * ((ftype)agreements / (ftype)ds.size());
+    report.fp32_latency =
+        std::chrono::duration<double>(t2 - t1).count() / ds.size();
+    report.int8_latency =
+        std::chrono::duration<double>(t3 - t2).count() / ds.size();
+    report.fp32_size = model.parameters().size() * sizeof(ftype);
+    report.int8_size = quantized.size();
+    return report;
+}
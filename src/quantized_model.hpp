@@ -0,0 +1,86 @@
+#ifndef QUANTIZED_MODEL_H
+#define QUANTIZED_MODEL_H
+#include "model.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/*
+ * Post-training int8 quantization of a sigmoid model, for the inference only.
+ * The weights of each row are quantized symmetrically with their own scale
+ * (w = scale * q, q in [-127, 127]). The activations are in [0, 1], so they
+ * are quantized as bytes with a fixed scale of 1 / 255, like the raw inputs
+ * of the datasets. Each layer is an int8 x uint8 -> int32 product (gemv_s8u8),
+ * rescaled in float, and the sigmoid is a lookup table which returns the
+ * quantized activation directly. The output layer is not activated (the
+ * sigmoid does not change the class).
+ */
+class QuantizedModel {
+  public:
+    /* buffers of one caller, so concurrent predictions do not share state */
+    struct Buffers {
+        std::vector<uint8_t> ping = {};
+        std::vector<uint8_t> pong = {};
+        std::vector<int32_t> acc = {};
+        std::vector<ftype> input = {};
+    };
+
+    QuantizedModel() = default;
+    explicit QuantizedModel(Model const &model);
+
+  public:
+    size_t nb_inputs() const { return layers_.front().nb_inputs; }
+    size_t nb_outputs() const { return layers_.back().nb_nodes; }
+    /* memory used by the quantized parameters, in bytes */
+    size_t size() const;
+
+    Buffers buffers() const;
+
+    /* class of an input with values in [0, 1] */
+    Label predict(std::span<ftype const> input, Buffers &buffers) const;
+    /* class of the sample i (the raw inputs of scale 1 / 255 are used as they
+     * are) */
+    Label predict(DataSet const &ds, size_t i, Buffers &buffers) const;
+    /* accuracy (%) on the dataset */
+    ftype evaluate(DataSet const &ds, ThreadPool *pool = nullptr) const;
+
+  private:
+    struct Layer {
+        size_t nb_nodes = 0;
+        size_t nb_inputs = 0;
+        size_t stride = 0;                // nb_inputs padded to 64
+        std::vector<int8_t> weights = {}; // (nb_nodes x stride)
+        std::vector<ftype> scales = {};   // scale of the rows / 255
+        std::vector<ftype> biases = {};
+    };
+
+    static constexpr ftype SIGMOID_MAX = 8; // the table covers [-8, 8)
+    static constexpr size_t SIGMOID_STEPS = 128;
+    static constexpr size_t SIGMOID_SIZE = 2 * SIGMOID_MAX * SIGMOID_STEPS;
+
+    Label predict(Buffers &buffers) const; // the input is in buffers.ping
+
+  private:
+    std::vector<Layer> layers_ = {};
+    std::array<uint8_t, SIGMOID_SIZE> sigmoid_ = {};
+};
+
+/* comparison of the quantized model with the float one on a dataset */
+struct QuantizationReport {
+    size_t nb_samples = 0;
+    ftype fp32_accuracy = 0;  // %
+    ftype int8_accuracy = 0;  // %
+    ftype agreement = 0;      // % of the samples with the same class
+    double fp32_latency = 0;  // seconds per sample
+    double int8_latency = 0;  // seconds per sample
+    size_t fp32_size = 0;     // bytes
+    size_t int8_size = 0;     // bytes
+};
+
+QuantizationReport compare(Model const &model, QuantizedModel const &quantized,
+                           DataSet const &ds);
+
+#endif
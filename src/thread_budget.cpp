@@ -0,0 +1,137 @@
+#include "thread_budget.hpp"
+#include "gemm.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#ifdef NN_OPENBLAS
+#include "cblas.h"
+#endif
+
+char const *activity_name(Activity activity) {
+    switch (activity) {
+    case Activity::Training:
+        return "training";
+    case Activity::Workers:
+        return "workers";
+    case Activity::Evaluation:
+        return "evaluation";
+    case Activity::Prefetch:
+        return "prefetch";
+    }
+    return "unknown";
+}
+
+void ThreadConfig::print(std::ostream &os) const {
+    os << "threads: " << nb_active << "/" << budget << " (";
+    for (size_t a = 0; a < NB_ACTIVITIES; ++a) {
+        os << (a == 0 ? "" : ", ") << activity_name(Activity(a)) << ": "
+           << activities[a];
+    }
+    os << ")" << (nb_active > budget ? " oversubscribed" : "") << ", ";
+    if (gemm_backend() == GemmBackend::OpenBLAS) {
+        os << "openblas: " << blas_threads << " threads" << std::endl;
+    } else {
+        os << "native gemm: 1 thread" << std::endl;
+    }
+}
+
+static size_t default_budget() {
+    char const *env = std::getenv("NN_THREADS");
+
+    if (env && std::atoi(env) > 0) {
+        return size_t(std::atoi(env));
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// called with the mutex locked
+static void set_blas_threads(ThreadConfig &config, size_t blas_threads) {
+    if (blas_threads != config.blas_threads) {
+        config.blas_threads = blas_threads;
+#ifdef NN_OPENBLAS
+        openblas_set_num_threads(int(blas_threads));
+#endif
+    }
+}
+
+struct BudgetState {
+    BudgetState() {
+        config.budget = default_budget();
+#ifdef NN_OPENBLAS
+        config.blas_threads = size_t(openblas_get_num_threads());
+#else
+        config.blas_threads = config.budget;
+#endif
+    }
+
+    std::mutex mutex;
+    ThreadConfig config;
+};
+
+static BudgetState &state() {
+    static BudgetState state;
+    return state;
+}
+
+// innermost lease of the thread
+static thread_local ThreadBudget::Lease *current_lease = nullptr;
+
+size_t ThreadBudget::budget() {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    return state().config.budget;
+}
+
+void ThreadBudget::budget(size_t nb_threads) {
+    assert(nb_threads > 0);
+    std::lock_guard<std::mutex> lock(state().mutex);
+    state().config.budget = nb_threads;
+}
+
+ThreadConfig ThreadBudget::config() {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    return state().config;
+}
+
+ThreadBudget::Lease::Lease(Activity activity, size_t nb_threads)
+    : activity_(activity), nb_threads_(nb_threads), outer_(current_lease) {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    ThreadConfig &config = state().config;
+
+    if (outer_) {
+        config.activities[size_t(outer_->activity_)] -= outer_->nb_threads_;
+        config.nb_active -= outer_->nb_threads_;
+    }
+    config.activities[size_t(activity_)] += nb_threads_;
+    config.nb_active += nb_threads_;
+    current_lease = this;
+}
+
+ThreadBudget::Lease::~Lease() {
+    assert(current_lease == this);
+    std::lock_guard<std::mutex> lock(state().mutex);
+    ThreadConfig &config = state().config;
+
+    config.activities[size_t(activity_)] -= nb_threads_;
+    config.nb_active -= nb_threads_;
+    if (outer_) {
+        config.activities[size_t(outer_->activity_)] += outer_->nb_threads_;
+        config.nb_active += outer_->nb_threads_;
+    }
+    current_lease = outer_;
+}
+
+ThreadBudget::BlasShare::BlasShare(size_t nb_threads) {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    ThreadConfig &config = state().config;
+    size_t share = config.budget / std::max<size_t>(1, nb_threads);
+
+    previous_ = config.blas_threads;
+    set_blas_threads(config, std::max<size_t>(1, share));
+}
+
+ThreadBudget::BlasShare::~BlasShare() {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    set_blas_threads(state().config, previous_);
+}
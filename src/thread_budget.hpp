@@ -0,0 +1,77 @@
+#ifndef THREAD_BUDGET_H
+#define THREAD_BUDGET_H
+#include <array>
+#include <cstddef>
+#include <ostream>
+
+/* activities that run on the threads of the library */
+enum class Activity { Training, Workers, Evaluation, Prefetch };
+constexpr size_t NB_ACTIVITIES = 4;
+
+char const *activity_name(Activity activity);
+
+/* distribution of the threads at a given time */
+struct ThreadConfig {
+    size_t budget = 0;       // threads of the machine
+    size_t nb_active = 0;    // threads leased by the activities
+    size_t blas_threads = 0; // threads of each BLAS call
+    std::array<size_t, NB_ACTIVITIES> activities = {};
+
+    void print(std::ostream &os) const;
+};
+
+/*
+ * Share the threads of the machine (or NN_THREADS) between the threads of the
+ * library (the pools of the trainer and of the evaluator, the prefetchers, the
+ * background tracer) and the threads of OpenBLAS.
+ *
+ * A thread that works holds a lease of its activity for the threads it runs
+ * (the caller of a pool leases the whole pool), which replaces the outer lease
+ * of the thread until it ends. The leases only count the threads.
+ *
+ * The number of threads of OpenBLAS is global and can't change while another
+ * thread is in a BLAS call, so it is only set by the training thread at the
+ * boundaries of the phases (see BlasShare): budget / nb_threads (at least
+ * one), the whole machine for a serial training and a single thread for the
+ * data parallel workers. Out of the training, the BLAS calls (e.g. the
+ * evaluations) keep the share set before it. The native gemm backend is
+ * single threaded.
+ */
+class ThreadBudget {
+  public:
+    static size_t budget();
+    /* applied by the next BlasShare */
+    static void budget(size_t nb_threads);
+    static ThreadConfig config();
+
+    class Lease {
+      public:
+        Lease(Activity activity, size_t nb_threads = 1);
+        ~Lease();
+
+        Lease(Lease const &) = delete;
+        Lease &operator=(Lease const &) = delete;
+
+      private:
+        Activity activity_;
+        size_t nb_threads_;
+        Lease *outer_;
+    };
+
+    /* Give the BLAS calls their share of the budget while nb_threads threads
+     * run, until the end of the scope. Only created by the training thread
+     * when no other thread can be in a BLAS call. */
+    class BlasShare {
+      public:
+        explicit BlasShare(size_t nb_threads);
+        ~BlasShare();
+
+        BlasShare(BlasShare const &) = delete;
+        BlasShare &operator=(BlasShare const &) = delete;
+
+      private:
+        size_t previous_;
+    };
+};
+
+#endif
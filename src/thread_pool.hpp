@@ -0,0 +1,104 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include "allocator.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed size pool of threads that all execute the same task. The calling
+ * thread takes part in the work as the thread 0, so a pool of size 1 does not
+ * start any thread. The task is not stored in a std::function, so running a
+ * task does not allocate.
+ */
+class ThreadPool {
+  public:
+    explicit ThreadPool(size_t nb_threads) : nb_threads_(nb_threads) {
+        for (size_t id = 1; id < nb_threads_; ++id) {
+            threads_.emplace_back([this, id]() { worker(id); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (auto &thread : threads_) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool const &operator=(ThreadPool const &) = delete;
+
+  public:
+    size_t size() const { return nb_threads_; }
+
+    /* execute task(thread_id) on all the threads and wait for them */
+    template <typename Task> void run(Task const &task) {
+        if (nb_threads_ == 1) {
+            task(0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            call_ = [](void const *task, size_t id) {
+                (*static_cast<Task const *>(task))(id);
+            };
+            nb_running_ = nb_threads_ - 1;
+            ++generation_;
+        }
+        start_cv_.notify_all();
+        task(0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return nb_running_ == 0; });
+    }
+
+  private:
+    void worker(size_t id) {
+        size_t generation = 0;
+
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_cv_.wait(lock, [&]() {
+                return stop_ || generation_ != generation;
+            });
+            if (stop_) {
+                lock.unlock();
+                PoolAllocator::instance().trim();
+                return;
+            }
+            generation = generation_;
+            void const *task = task_;
+            auto call = call_;
+            lock.unlock();
+
+            call(task, id);
+
+            lock.lock();
+            if (--nb_running_ == 0) {
+                done_cv_.notify_one();
+            }
+        }
+    }
+
+  private:
+    size_t nb_threads_ = 1;
+    std::vector<std::thread> threads_ = {};
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    void const *task_ = nullptr;
+    void (*call_)(void const *, size_t) = nullptr;
+    size_t nb_running_ = 0;
+    size_t generation_ = 0;
+    bool stop_ = false;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "trace_file.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+constexpr char MAGIC[8] = {'N', 'N', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr uint32_t VERSION = 1;
+// bound of the number and size of the field names read from a file
+constexpr uint32_t MAX_FIELDS = 1 << 16;
+
+template <typename T>
+void write(std::ostream &os, T value) {
+    os.write(reinterpret_cast<char const *>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read(std::istream &is, T &value) {
+    return bool(is.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+size_t nb_fields() {
+    size_t count = 0;
+    TraceRecord record;
+
+    for_each_field(record, [&](std::string const &, float) { ++count; });
+    return count;
+}
+
+} // namespace
+
+TraceWriter::TraceWriter(std::string const &path, TraceHeader const &header,
+                         size_t capacity)
+    : path_(path), file_(path, std::ios::binary | std::ios::trunc),
+      nb_fields_(nb_fields()), ring_(capacity) {
+    assert(capacity > 0);
+    if (!file_) {
+        std::cerr << "error: can't create trace file " << path << std::endl;
+        return;
+    }
+    file_.write(MAGIC, sizeof(MAGIC));
+    write<uint32_t>(file_, VERSION);
+    write<uint32_t>(file_, nb_fields_);
+    write<uint64_t>(file_, header.nb_epochs);
+    write<uint64_t>(file_, header.minibatch_size);
+    write<float>(file_, header.learning_rate);
+    write<uint32_t>(file_, 0);
+    for_each_field(ring_[0], [&](std::string const &name, float) {
+        write<uint32_t>(file_, name.size());
+        file_.write(name.data(), name.size());
+    });
+    file_.flush();
+    worker_ = std::thread([this]() { work(); });
+}
+
+TraceWriter::~TraceWriter() {
+    if (!worker_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+void TraceWriter::append(TraceRecord const &record) {
+    if (!is_open()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cv_.wait(lock, [this]() { return size_ < ring_.size(); });
+    ring_[(head_ + size_) % ring_.size()] = record;
+    if (++size_ >= std::min(CHUNK, ring_.size())) {
+        cv_.notify_all();
+    }
+}
+
+void TraceWriter::flush() {
+    if (!is_open()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    flushing_ = true;
+    cv_.notify_all();
+    cv_.wait(lock, [this]() { return size_ == 0; });
+    flushing_ = false;
+}
+
+// The records are serialized in a buffer under the lock, and written without
+// it. The pending records are written before stopping.
+void TraceWriter::work() {
+    std::vector<char> buffer;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+        cv_.wait_for(lock, FLUSH_INTERVAL, [this]() {
+            // wait for a full chunk (or a full ring if it is smaller)
+            return size_ >= std::min(CHUNK, ring_.size()) ||
+                   (flushing_ && size_ > 0) || stopping_;
+        });
+        if (size_ == 0) {
+            if (stopping_) {
+                return;
+            }
+            continue;
+        }
+        size_t count = std::min(size_, CHUNK);
+        buffer.clear();
+        for (size_t i = 0; i < count; ++i) {
+            TraceRecord const &record = ring_[(head_ + i) % ring_.size()];
+            auto append = [&](void const *value, size_t size) {
+                auto bytes = static_cast<char const *>(value);
+                buffer.insert(buffer.end(), bytes, bytes + size);
+            };
+            append(&record.epoch, sizeof(record.epoch));
+            for_each_field(record, [&](std::string const &, float value) {
+                append(&value, sizeof(value));
+            });
+        }
+        lock.unlock();
+        file_.write(buffer.data(), buffer.size());
+        file_.flush();
+        if (!file_) {
+            std::cerr << "error: can't write trace file " << path_
+                      << std::endl;
+            file_.clear();
+        }
+        lock.lock();
+        head_ = (head_ + count) % ring_.size();
+        size_ -= count;
+        cv_.notify_all();
+    }
+}
+
+bool read_trace(std::string const &path, TraceHeader &header,
+                std::vector<TraceRecord> &records) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    uint32_t version, nb_fields, reserved;
+    std::vector<std::string> names;
+
+    if (!file) {
+        std::cerr << "error: can't open trace file " << path << std::endl;
+        return false;
+    }
+    if (!file.read(magic, sizeof(magic)) ||
+        memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || !read(file, version) ||
+        version != VERSION || !read(file, nb_fields) ||
+        nb_fields > MAX_FIELDS || !read(file, header.nb_epochs) ||
+        !read(file, header.minibatch_size) ||
+        !read(file, header.learning_rate) || !read(file, reserved)) {
+        std::cerr << "error: invalid trace file " << path << std::endl;
+        return false;
+    }
+    for (uint32_t i = 0; i < nb_fields; ++i) {
+        uint32_t size;
+        if (!read(file, size) || size > MAX_FIELDS) {
+            std::cerr << "error: invalid trace file " << path << std::endl;
+            return false;
+        }
+        names.emplace_back(size, '\0');
+        if (!file.read(names.back().data(), size)) {
+            std::cerr << "error: invalid trace file " << path << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<float> values(nb_fields);
+    records.clear();
+    for (;;) {
+        TraceRecord record;
+        if (!read(file, record.epoch) ||
+            !file.read(reinterpret_cast<char *>(values.data()),
+                       nb_fields * sizeof(float))) {
+            break; // end of the file or incomplete record
+        }
+        for_each_field(record, [&](std::string const &name, float &value) {
+            auto it = std::find(names.begin(), names.end(), name);
+            value = it == names.end() ? TraceRecord::NaN
+                                      : values[it - names.begin()];
+        });
+        records.push_back(record);
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+#include "profiler.hpp"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* parameters of a traced run */
+struct TraceHeader {
+    uint64_t nb_epochs = 0;
+    uint64_t minibatch_size = 0;
+    float learning_rate = 0;
+};
+
+/* metrics of a traced epoch (the values that are not traced are NaN) */
+struct TraceRecord {
+    static constexpr float NaN = std::numeric_limits<float>::quiet_NaN();
+
+    uint64_t epoch = 0;
+    float cost_train = NaN;
+    float accuracy_train = NaN;
+    float cost_test = NaN;
+    float accuracy_test = NaN;
+    // phases of the steps since the previous record (seconds)
+    std::array<float, NB_PHASES> phase_total = {};
+    std::array<float, NB_PHASES> phase_p50 = {};
+    std::array<float, NB_PHASES> phase_p99 = {};
+    float samples_per_second = 0;
+    float evaluation_time = 0; // seconds
+    float time = 0;            // seconds since the start of the run
+};
+
+/* Calls f(name, value) on the fields of the record (except the epoch), in the
+ * order of the files. Record can be const. */
+template <typename Record, typename F>
+void for_each_field(Record &record, F &&f) {
+    f("cost_train", record.cost_train);
+    f("accuracy_train", record.accuracy_train);
+    f("cost_test", record.cost_test);
+    f("accuracy_test", record.accuracy_test);
+    for (size_t p = 0; p < NB_PHASES; ++p) {
+        std::string name = phase_name(Phase(p));
+        f(name + "_total", record.phase_total[p]);
+        f(name + "_p50", record.phase_p50[p]);
+        f(name + "_p99", record.phase_p99[p]);
+    }
+    f("samples_per_second", record.samples_per_second);
+    f("evaluation_time", record.evaluation_time);
+    f("time", record.time);
+}
+
+/*
+ * Trace file (native byte order, version 1):
+ * - magic "NNTRACE\0", version (uint32), number of fields (uint32),
+ *   nb_epochs (uint64), minibatch_size (uint64), learning_rate (float32),
+ *   reserved (uint32),
+ * - the names of the fields: length (uint32) and characters,
+ * - the records: epoch (uint64) and the value of each field (float32).
+ * The file is self-describing: a reader finds the fields by name, so fields
+ * can be added without breaking the readers. The records are appended while
+ * the run goes on, so the file can be read during the run (the last record
+ * may be incomplete).
+ */
+
+/*
+ * Append the records to a trace file in a background thread. The records are
+ * buffered in a ring of capacity records and written by chunks of CHUNK
+ * records, or after FLUSH_INTERVAL when fewer records are pending, so the
+ * file follows the run. append waits when the ring is full: the memory used by
+ * a trace does not depend on the length of the run.
+ */
+class TraceWriter {
+  public:
+    static constexpr size_t CHUNK = 64;
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{500};
+
+    TraceWriter(std::string const &path, TraceHeader const &header,
+                size_t capacity = 1024);
+    /* writes the pending records */
+    ~TraceWriter();
+
+    TraceWriter(TraceWriter const &) = delete;
+    TraceWriter &operator=(TraceWriter const &) = delete;
+
+  public:
+    bool is_open() const { return file_.is_open(); }
+    void append(TraceRecord const &record);
+    /* wait until the appended records are written */
+    void flush();
+
+  private:
+    std::string path_;
+    std::ofstream file_;
+    size_t nb_fields_ = 0;
+    std::vector<TraceRecord> ring_;
+    size_t head_ = 0; // oldest pending record
+    size_t size_ = 0; // number of pending records
+    bool flushing_ = false;
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread worker_;
+
+    void work();
+};
+
+/* Read a trace file, possibly being written (an incomplete last record is
+ * ignored). The fields that are not in the file are NaN. Returns false on
+ * error. */
+bool read_trace(std::string const &path, TraceHeader &header,
+                std::vector<TraceRecord> &records);
+
+#endif
@@ -1,70 +1,320 @@
 #ifndef TRACER_H
 #define TRACER_H
+#include "evaluator.hpp"
+#include "profiler.hpp"
+#include "thread_budget.hpp"
+#include "trace_file.hpp"
 #include "trainer.hpp"
 #include "types.hpp"
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <sstream>
+#include <thread>
 
+/*
+ * Evaluate the model on the train and test sets during the training. The
+ * evaluation can be done every trace_interval epochs, on a random subset of
+ * sample_size elements of each dataset (0 means the full dataset), and on a
+ * background thread (async). In the async mode, the model is copied into a
+ * snapshot when trace is called and the training continues while the snapshot
+ * is evaluated. The snapshots are recycled, and trace blocks when
+ * max_pending evaluations are already waiting.
+ *
+ * The snapshot is a full copy, not a copy-on-write share of the parameters:
+ * the optimizer writes all the parameters at every step, so a shared buffer
+ * would be cloned at the first step after the trace anyway. The copy is one
+ * memcpy of the parameters buffer into a recycled snapshot (no allocation)
+ * on the training thread, e.g. about 100 KB for the MNIST model, once every
+ * trace_interval steps.
+ *
+ * Every traced epoch gives a record (see TraceRecord) with the evaluation and
+ * the aggregated profile of the trainer (the phases of the steps since the
+ * previous record): total, median and 99th percentile per phase, and the
+ * number of training samples per second (over the time of the phases). The
+ * records are kept in memory and written by dump, or, when stream_path is
+ * set, appended to this file during the run by a background writer and not
+ * kept in memory (see TraceWriter).
+ */
 struct Tracer {
-    std::vector<ftype> costs_train = {};
-    std::vector<ftype> costs_test = {};
-    std::vector<ftype> accuracy_train = {};
-    std::vector<ftype> accuracy_test = {};
+    std::vector<TraceRecord> records = {};
     size_t nb_epochs = 0;
     size_t minibatch_size = 0;
     ftype learning_rate = 0;
-    DataSet const &train_ds = {};
-    DataSet const &test_ds = {};
+    DataSet const &train_ds;
+    DataSet const &test_ds;
     size_t loading_count = 0;
 
+    size_t trace_interval = 1;
+    size_t sample_size = 0;
+    uint64_t sample_seed = 0;
+    bool async = false;
+    size_t max_pending = 2;
+    std::string stream_path = {};
+
     Tracer(DataSet const &train_ds, DataSet const &test_ds)
         : train_ds(train_ds), test_ds(test_ds) {}
 
+    ~Tracer() { stop(); }
+
     void init(size_t nb_epochs, size_t minibatch_size, ftype learning_rate) {
+        stop();
         this->nb_epochs = nb_epochs;
         this->minibatch_size = minibatch_size;
         this->learning_rate = learning_rate;
-        this->costs_train = std::vector<ftype>(nb_epochs);
-        this->costs_test = std::vector<ftype>(nb_epochs);
-        this->accuracy_train = std::vector<ftype>(nb_epochs);
-        this->accuracy_test = std::vector<ftype>(nb_epochs);
+        this->records.clear();
+        this->phase_totals_ = {};
+        this->evaluation_total_ = 0;
+        this->threads_ = {};
+        this->start_ = std::chrono::steady_clock::now();
+        if (!stream_path.empty()) {
+            writer_ = std::make_unique<TraceWriter>(stream_path, header());
+        }
         this->loading_count = std::max<size_t>(1, nb_epochs / 100);
+        this->train_sample_ = create_sample(train_ds, sample_seed);
+        this->test_sample_ = create_sample(test_ds, sample_seed + 1);
+
+        if (async) {
+            snapshots_ = std::vector<Model>(max_pending);
+            free_snapshots_.clear();
+            for (size_t i = 0; i < max_pending; ++i) {
+                free_snapshots_.push_back(i);
+            }
+            stopping_ = false;
+            worker_ = std::thread([this]() { work(); });
+        }
     }
 
-    void trace(Trainer const *trainer, size_t epoch) {
-        auto eval_train = trainer->evaluate(train_ds);
-        auto eval_test = trainer->evaluate(test_ds);
-        costs_train[epoch] = eval_train.first;
-        costs_test[epoch] = eval_test.first;
-        accuracy_train[epoch] = eval_train.second;
-        accuracy_test[epoch] = eval_test.second;
+    template <typename TrainerType>
+    void trace(TrainerType *trainer, size_t epoch) {
+        if (epoch % trace_interval != 0 && epoch + 1 != nb_epochs) {
+            return;
+        }
+        TraceRecord record = profile_record(epoch, trainer->profile());
+
+        trainer->profile().reset();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            threads_ = ThreadBudget::config();
+        }
+        if (async) {
+            trace_async(trainer, record);
+        } else {
+            auto evaluator = trainer->evaluator();
+            evaluate(record, [&](DataSet const &ds) {
+                return evaluator.evaluate(ds);
+            });
+            store(record);
+        }
         if (epoch % loading_count == 0 || epoch == nb_epochs) {
             std::cout << "trace " << 100 * epoch / nb_epochs << " %"
                       << std::endl;
         }
     }
 
-    void dump(std::string const &trace_name) {
+    /* wait for the pending evaluations and the writing of their records */
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() {
+            return jobs_.empty() &&
+                   free_snapshots_.size() == snapshots_.size();
+        });
+        if (writer_) {
+            writer_->flush();
+        }
+    }
+
+    TraceHeader header() const {
+        return TraceHeader{nb_epochs, minibatch_size, float(learning_rate)};
+    }
+
+    /* write the records kept in memory to a trace file, returns its name */
+    std::string dump(std::string const &trace_name) {
         std::ostringstream ss;
         ss << trace_name << "_" << nb_epochs << "_" << learning_rate << "_"
            << minibatch_size << ".out";
 
-        std::ofstream fs(ss.str());
-
-        fs.write(reinterpret_cast<char const *>(&nb_epochs), sizeof(size_t));
-        fs.write(reinterpret_cast<char const *>(&minibatch_size),
-                 sizeof(size_t));
-        fs.write(reinterpret_cast<char const *>(&learning_rate),
-                 sizeof(ftype));
-        fs.write(reinterpret_cast<char const *>(costs_train.data()),
-                 nb_epochs * sizeof(ftype));
-        fs.write(reinterpret_cast<char const *>(accuracy_train.data()),
-                 nb_epochs * sizeof(ftype));
-        fs.write(reinterpret_cast<char const *>(costs_test.data()),
-                 nb_epochs * sizeof(ftype));
-        fs.write(reinterpret_cast<char const *>(accuracy_test.data()),
-                 nb_epochs * sizeof(ftype));
+        flush();
+        TraceWriter writer(ss.str(), header());
+        for (auto const &record : records) {
+            writer.append(record);
+        }
+        return ss.str();
+    }
+
+    /* time of each phase over the traced epochs and distribution of the
+     * threads during the training steps */
+    void print_profile(std::ostream &os) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        double total = evaluation_total_;
+
+        for (double t : phase_totals_) {
+            total += t;
+        }
+        for (size_t p = 0; p < NB_PHASES; ++p) {
+            os << phase_name(Phase(p)) << ": " << phase_totals_[p] << "s ("
+               << 100 * phase_totals_[p] / total << "%), ";
+        }
+        os << "evaluation: " << evaluation_total_ << "s ("
+           << 100 * evaluation_total_ / total << "%)" << std::endl;
+        threads_.print(os);
+    }
+
+  private:
+    struct Job {
+        TraceRecord record;
+        size_t snapshot;
+        std::function<std::pair<ftype, ftype>(DataSet const &)> evaluate;
+    };
+
+    DataSet train_sample_ = {};
+    DataSet test_sample_ = {};
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable jobs_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Job> jobs_ = {};
+    std::vector<Model> snapshots_ = {};
+    std::vector<size_t> free_snapshots_ = {};
+    bool stopping_ = false;
+    std::unique_ptr<TraceWriter> writer_ = nullptr;
+    std::chrono::steady_clock::time_point start_ = {};
+    std::array<double, NB_PHASES> phase_totals_ = {};
+    double evaluation_total_ = 0;
+    ThreadConfig threads_ = {};
+
+    DataSet create_sample(DataSet const &ds, uint64_t seed) const {
+        if (sample_size == 0 || sample_size >= ds.size()) {
+            return {};
+        }
+        std::mt19937_64 gen(seed);
+        std::vector<size_t> indexes(ds.size());
+
+        for (size_t i = 0; i < ds.size(); ++i) {
+            indexes[i] = i;
+        }
+        std::shuffle(indexes.begin(), indexes.end(), gen);
+        indexes.resize(sample_size);
+        return ds.select(indexes);
+    }
+
+    DataSet const &train_set() const {
+        return train_sample_.empty() ? train_ds : train_sample_;
+    }
+
+    DataSet const &test_set() const {
+        return test_sample_.empty() ? test_ds : test_sample_;
+    }
+
+    TraceRecord profile_record(size_t epoch, PhaseProfile const &profile) {
+        TraceRecord record;
+        std::chrono::duration<double> time =
+            std::chrono::steady_clock::now() - start_;
+        double total = profile.total();
+
+        record.epoch = epoch;
+        record.time = time.count();
+        for (size_t p = 0; p < NB_PHASES; ++p) {
+            PhaseStats stats = profile.stats(Phase(p));
+            record.phase_total[p] = stats.total;
+            record.phase_p50[p] = stats.p50;
+            record.phase_p99[p] = stats.p99;
+        }
+        record.samples_per_second =
+            total > 0 ? profile.nb_samples() / total : 0;
+        return record;
+    }
+
+    template <typename F>
+    void evaluate(TraceRecord &record, F const &evaluate) const {
+        auto start = std::chrono::steady_clock::now();
+        auto eval_train = evaluate(train_set());
+        auto eval_test = evaluate(test_set());
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        record.cost_train = eval_train.first;
+        record.accuracy_train = eval_train.second;
+        record.cost_test = eval_test.first;
+        record.accuracy_test = eval_test.second;
+        record.evaluation_time = elapsed.count();
+    }
+
+    // called with the lock in the async mode
+    void store(TraceRecord const &record) {
+        for (size_t p = 0; p < NB_PHASES; ++p) {
+            phase_totals_[p] += record.phase_total[p];
+        }
+        evaluation_total_ += record.evaluation_time;
+        if (writer_) {
+            writer_->append(record);
+        } else {
+            records.push_back(record);
+        }
+    }
+
+    template <typename TrainerType>
+    void trace_async(TrainerType *trainer, TraceRecord const &record) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return !free_snapshots_.empty(); });
+        size_t snapshot = free_snapshots_.back();
+        free_snapshots_.pop_back();
+        lock.unlock();
+
+        // the snapshot is not shared until the job is queued (full copy, see
+        // the comment of Tracer)
+        snapshots_[snapshot] = *trainer->model();
+        auto evaluator = trainer->evaluator();
+        evaluator.model(&snapshots_[snapshot]);
+        evaluator.pool(nullptr);
+
+        lock.lock();
+        jobs_.push_back(Job{record, snapshot, [evaluator](DataSet const &ds) {
+                                return evaluator.evaluate(ds);
+                            }});
+        jobs_cv_.notify_one();
+    }
+
+    void work() {
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            jobs_cv_.wait(lock,
+                          [this]() { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                return;
+            }
+            Job job = jobs_.front();
+            jobs_.pop_front();
+            lock.unlock();
+
+            evaluate(job.record, job.evaluate);
+
+            lock.lock();
+            store(job.record);
+            free_snapshots_.push_back(job.snapshot);
+            done_cv_.notify_all();
+        }
+    }
+
+    // the pending records are written when the writer is destroyed
+    void stop() {
+        if (worker_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            jobs_cv_.notify_one();
+            worker_.join();
+        }
+        writer_ = nullptr;
     }
 };
 
@@ -1,25 +1,43 @@
 #include "trainer.hpp"
-#include "cblas.h"
+#include "thread_budget.hpp"
 #include "tracer.hpp"
 #include "types.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
-#include <numeric>
+#include <iostream>
 
-Vector Trainer::act(Vector const &z) const { return map(activation_, z); }
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+Vector BasicTrainer<Cost, Act, Opt>::act(Vector const &z) const {
+    return map(activation_, z);
+}
 
-Vector Trainer::act_prime(Vector const &z) const {
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+Vector BasicTrainer<Cost, Act, Opt>::act_prime(Vector const &z) const {
     return map_derivative(activation_, z);
 }
 
-Vector Trainer::cost(Vector const &ground_truth, Vector const &y) const {
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+Vector BasicTrainer<Cost, Act, Opt>::cost(Vector const &ground_truth,
+                                          Vector const &y) const {
     return map(cost_, ground_truth, y);
 }
 
-Vector Trainer::cost_prime(Vector const &ground_truth, Vector const &y) const {
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+Vector BasicTrainer<Cost, Act, Opt>::cost_prime(Vector const &ground_truth,
+                                                Vector const &y) const {
     return map_derivative(cost_, ground_truth, y);
 }
 
-Vector Trainer::compute_z(Layer const &layer, Vector const &a) const {
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+Vector BasicTrainer<Cost, Act, Opt>::compute_z(Layer const &layer,
+                                               Vector const &a) const {
     assert(a.size == layer.nb_inputs);
     assert(layer.weights.rows == layer.nb_nodes);
     assert(layer.weights.cols == layer.nb_inputs);
@@ -31,7 +49,10 @@ Vector Trainer::compute_z(Layer const &layer, Vector const &a) const {
     return z;
 }
 
-std::pair<Vectors, Vectors> Trainer::feedforward(Vector const &input) const {
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+std::pair<Vectors, Vectors>
+BasicTrainer<Cost, Act, Opt>::feedforward(Vector const &input) const {
     Vectors zs = {};
     Vectors as = {input.clone()};
 
@@ -42,146 +63,532 @@ std::pair<Vectors, Vectors> Trainer::feedforward(Vector const &input) const {
     return {as, zs};
 }
 
-std::pair<GradW, GradB> Trainer::backpropagate(Vector const &ground_truth,
-                                               Vectors const &as,
-                                               Vectors const &zs) const {
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+Parameters
+BasicTrainer<Cost, Act, Opt>::backpropagate(Vector const &ground_truth,
+                                            Vectors const &as,
+                                            Vectors const &zs) const {
     size_t L = model_->layers.size();
     auto &layers = model_->layers;
     Vector err =
         hadamard(cost_prime(ground_truth, as.back()), act_prime(zs.back()));
-    GradB grads_b(L);
-    GradW grads_w(L);
+    Parameters grads = Parameters::zeros_like(model_->parameters());
 
-    grads_b[L - 1] = err.clone();
-    grads_w[L - 1] = matmul(err, T(as[as.size() - 2]));
+    grads.biases(L - 1) = err;
+    grads.weights(L - 1) = matmul(err, T(as[as.size() - 2]));
 
     for (size_t l = 2; l <= L; ++l) {
         err = hadamard(matmul(T(layers[L - l + 1].weights), err),
                        act_prime(zs[zs.size() - l]));
-        grads_b[L - l] = err.clone();
-        grads_w[L - l] = matmul(err, T(as[as.size() - l - 1]));
+        grads.biases(L - l) = err;
+        grads.weights(L - l) = matmul(err, T(as[as.size() - l - 1]));
+    }
+    return grads;
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::compute_z(Layer const &layer,
+                                             Matrix const &as,
+                                             Matrix &zs) const {
+    assert(as.rows == layer.nb_inputs);
+    assert(zs.rows == layer.nb_nodes && zs.cols == as.cols);
+    assert(layer.weights.rows == layer.nb_nodes);
+    assert(layer.weights.cols == layer.nb_inputs);
+
+    for (size_t i = 0; i < zs.rows; ++i) {
+        std::fill(zs[i], zs[i] + zs.cols, layer.biases[i]);
+    }
+
+    // zs = weights*as + biases
+    if (as.cols == 1) {
+        gemv<ftype>(CblasNoTrans, layer.nb_nodes, layer.nb_inputs, 1.0,
+                    layer.weights.mem, layer.nb_inputs, as.mem, 1, 1.0,
+                    zs.mem, 1);
+    } else {
+        gemm<ftype>(CblasNoTrans, CblasNoTrans, layer.nb_nodes, as.cols,
+                    layer.nb_inputs, 1.0, layer.weights.mem, layer.nb_inputs,
+                    as.mem, as.cols, 1.0, zs.mem, zs.cols);
+    }
+}
+
+// The derivative of the activation is computed in the same pass as the
+// activation and replaces zs, which are not used afterward.
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::feedforward(TrainingWorkspace &ws) const {
+    for (size_t l = 0; l < model_->layers.size(); ++l) {
+        compute_z(model_->layers[l], ws.as[l], ws.zs[l]);
+        map_and_derivative(activation_, ws.zs[l], ws.as[l + 1], ws.zs[l]);
+    }
+}
+
+// Compute the errors of every layer. The zs hold act_prime(zs) (see
+// feedforward).
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::backpropagate_errors(
+    TrainingWorkspace &ws) const {
+    size_t L = model_->layers.size();
+    auto &layers = model_->layers;
+
+    map_derivative(cost_, ws.ground_truths, ws.outputs(), ws.errs[L - 1]);
+    hadamard(ws.errs[L - 1], ws.zs[L - 1]);
+
+    for (size_t l = 2; l <= L; ++l) {
+        matmul(T(layers[L - l + 1].weights), ws.errs[L - l + 1],
+               ws.errs[L - l]);
+        hadamard(ws.errs[L - l], ws.zs[L - l]);
     }
-    return {grads_w, grads_b};
+}
+
+// The gradients are summed over the batch (the columns of the matrices), so
+// the result is the same as adding the gradients of every sample.
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::backpropagate(TrainingWorkspace &ws) const {
+    backpropagate_errors(ws);
+    for (size_t l = 0; l < model_->layers.size(); ++l) {
+        sum_cols(ws.errs[l], ws.grads.biases(l));
+        matmul(ws.errs[l], T(ws.as[l]), ws.grads.weights(l));
+    }
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+TrainingWorkspace &BasicTrainer<Cost, Act, Opt>::workspace(size_t batch_size) {
+    workspace_.reserve(*model_, batch_size);
+    return workspace_;
 }
 
 // SGD -> we should have more in the future
-void Trainer::optimize(GradW const &grads_w, GradB const &grads_b,
-                       ftype const learning_rate) {
-    optimize_->execute(model_, grads_w, grads_b, learning_rate);
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::optimize(Parameters const &grads,
+                                            ftype const learning_rate) {
+    optimize_->execute(model_, grads, learning_rate);
+    model_->refresh_half();
 }
 
-void Trainer::update_minibatch(MinibatchGenerator const &minibatch,
-                               ftype learning_rate) {
-    auto const &[x, gt] = minibatch.get(0);
-    auto [as, zs] = feedforward(x);
-    auto [total_grad_w, total_grad_b] = backpropagate(gt, as, zs);
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+template <typename Batch>
+void BasicTrainer<Cost, Act, Opt>::update_batch(Batch const &batch,
+                                                ftype learning_rate) {
+    TrainingWorkspace &ws = workspace(batch.size());
 
-    for (size_t i = 1; i < minibatch.size(); ++i) {
-        auto const &[x, gt] = minibatch.get(i);
-        auto [as, zs] = feedforward(x);
-        auto [grads_w, grads_b] = backpropagate(gt, as, zs);
-        total_grad_w += grads_w;
-        total_grad_b += grads_b;
+    {
+        PhaseTimer timer(&profile_, Phase::Data);
+        batch.pack(ws.inputs(), ws.ground_truths);
+    }
+    {
+        PhaseTimer timer(&profile_, Phase::Forward);
+        feedforward(ws);
     }
-    optimize(total_grad_w, total_grad_b,
-             learning_rate / (ftype)minibatch.size());
+    {
+        PhaseTimer timer(&profile_, Phase::Backward);
+        backpropagate(ws);
+    }
+    {
+        PhaseTimer timer(&profile_, Phase::Optimizer);
+        optimize(ws.grads, learning_rate / (ftype)batch.size());
+    }
+    profile_.end_step(batch.size());
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::update_minibatch(
+    MinibatchGenerator const &minibatch, ftype learning_rate) {
+    update_batch(minibatch, learning_rate);
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::update_minibatch(PackedBatch const &batch,
+                                                    ftype learning_rate) {
+    update_batch(batch, learning_rate);
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::threads(size_t nb_threads) {
+    assert(nb_threads > 0);
+    if (nb_threads == 1) {
+        pool_ = nullptr;
+        workspaces_.clear();
+    } else {
+        pool_ = std::make_shared<ThreadPool>(nb_threads);
+        workspaces_.resize(nb_threads);
+    }
+    optimize_->pool(pool_);
+}
+
+// Parallel tree reduction: at each level, the workspace i receives the
+// gradients of the workspace i + stride. The final sum is in workspaces_[0].
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::reduce_gradients(size_t nb_workspaces) {
+    for (size_t stride = 1; stride < nb_workspaces; stride *= 2) {
+        pool_->run([&](size_t id) {
+            if (id % (2 * stride) == 0 && id + stride < nb_workspaces) {
+                workspaces_[id].grads += workspaces_[id + stride].grads;
+            }
+        });
+    }
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+template <typename Batch>
+void BasicTrainer<Cost, Act, Opt>::update_batch_parallel(Batch const &minibatch,
+                                                         ftype learning_rate) {
+    size_t nb_workers = std::min(pool_->size(), minibatch.size());
+    pool_->run([&](size_t id) {
+        if (id >= nb_workers) {
+            return;
+        }
+        size_t first = id * minibatch.size() / nb_workers;
+        size_t last = (id + 1) * minibatch.size() / nb_workers;
+        TrainingWorkspace &ws = workspaces_[id];
+        // the threads process slices of the same size: only the first one is
+        // timed
+        PhaseProfile *profile = id == 0 ? &profile_ : nullptr;
+
+        ws.reserve(*model_, last - first);
+        {
+            PhaseTimer timer(profile, Phase::Data);
+            minibatch.pack(ws.inputs(), ws.ground_truths, first);
+        }
+        {
+            PhaseTimer timer(profile, Phase::Forward);
+            feedforward(ws);
+        }
+        {
+            PhaseTimer timer(profile, Phase::Backward);
+            backpropagate(ws);
+        }
+    });
+    {
+        PhaseTimer timer(&profile_, Phase::Backward);
+        reduce_gradients(nb_workers);
+    }
+    {
+        PhaseTimer timer(&profile_, Phase::Optimizer);
+        optimize(workspaces_[0].grads,
+                 learning_rate / (ftype)minibatch.size());
+    }
+    profile_.end_step(minibatch.size());
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::update_minibatch_parallel(
+    MinibatchGenerator const &minibatch, ftype learning_rate) {
+    update_batch_parallel(minibatch, learning_rate);
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::update_minibatch_parallel(
+    PackedBatch const &batch, ftype learning_rate) {
+    update_batch_parallel(batch, learning_rate);
 }
 
-void Trainer::update(DataSet const &ds, ftype learning_rate) {
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::update(DataSet const &ds,
+                                          ftype learning_rate) {
+    TrainingWorkspace &ws = workspace(1);
+
     for (size_t i = 0; i < ds.size(); ++i) {
-        auto const &[x, gt] = ds[i];
-        auto [as, zs] = feedforward(x);
-        auto [grads_w, grads_b] = backpropagate(gt, as, zs);
-        optimize(grads_w, grads_b, learning_rate);
+        assert(ds.nb_inputs() == ws.inputs().rows);
+        assert(ds.nb_outputs() == ws.ground_truths.rows);
+        {
+            PhaseTimer timer(&profile_, Phase::Data);
+            ds.input(i, std::span(ws.inputs().mem, ws.inputs().rows));
+            ds.ground_truth(i, ws.ground_truths.mem);
+        }
+        {
+            PhaseTimer timer(&profile_, Phase::Forward);
+            feedforward(ws);
+        }
+        {
+            PhaseTimer timer(&profile_, Phase::Backward);
+            backpropagate(ws);
+        }
+        {
+            PhaseTimer timer(&profile_, Phase::Optimizer);
+            optimize(ws.grads, learning_rate);
+        }
+        profile_.end_step(1);
+    }
+}
+
+// x -= delta with a relaxed load and store: the concurrent updates of the
+// hogwild threads are not data races, but they can still overwrite each other
+static inline void update_relaxed(ftype &x, ftype delta) {
+    std::atomic_ref<ftype> ref(x);
+    ref.store(ref.load(std::memory_order_relaxed) - delta,
+              std::memory_order_relaxed);
+}
+
+// Apply the SGD update of one sample directly on the model: w -= lr * err * aT
+// and b -= lr * err. The weights multiplied by a null activation are not
+// modified, which skips most of the first layer on sparse inputs. Returns the
+// number of updated parameters.
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+size_t
+BasicTrainer<Cost, Act, Opt>::apply_sgd_sparse(TrainingWorkspace &ws,
+                                               ftype learning_rate,
+                                               std::vector<size_t> &nonzeros) {
+    size_t nb_updates = 0;
+
+    for (size_t l = 0; l < model_->layers.size(); ++l) {
+        Layer &layer = model_->layers[l];
+        ftype const *a = ws.as[l].mem;
+        ftype const *err = ws.errs[l].mem;
+
+        nonzeros.clear();
+        for (size_t j = 0; j < layer.nb_inputs; ++j) {
+            if (a[j] != 0) {
+                nonzeros.push_back(j);
+            }
+        }
+        for (size_t i = 0; i < layer.nb_nodes; ++i) {
+            ftype lr_err = learning_rate * err[i];
+            ftype *w = layer.weights[i];
+
+            for (size_t j : nonzeros) {
+                update_relaxed(w[j], lr_err * a[j]);
+            }
+            update_relaxed(layer.biases[i], lr_err);
+        }
+        nb_updates += layer.nb_nodes * (nonzeros.size() + 1);
     }
+    return nb_updates;
 }
 
-void Trainer::train(DataSet const &ds, size_t nb_epochs, ftype learning_rate) {
+// Hogwild: every thread trains on its own shard of the dataset and updates the
+// shared weights without locks, with relaxed atomic loads and stores (see
+// apply_sgd_sparse). The lost updates are deliberate: concurrent updates are
+// rare on sparse inputs and their collisions only add a small noise to SGD.
+// The gemv of feedforward reads the weights directly: the values are not torn
+// (aligned floats) but can be stale.
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::update_hogwild(DataSet const &ds,
+                                                  ftype learning_rate) {
+    assert(pool_ && hogwild_stats_.size() == pool_->size());
+    assert(nonzeros_.size() == pool_->size());
+    size_t nb_threads = std::min(pool_->size(), ds.size());
+    pool_->run([&](size_t id) {
+        if (id >= nb_threads) {
+            return;
+        }
+        size_t first = id * ds.size() / nb_threads;
+        size_t last = (id + 1) * ds.size() / nb_threads;
+        TrainingWorkspace &ws = workspaces_[id];
+        HogwildStats &stats = hogwild_stats_[id];
+        auto t1 = std::chrono::steady_clock::now();
+
+        if (ws.reserve(*model_, 1)) [[unlikely]] {
+            nonzeros_[id].reserve(ws.inputs().rows);
+        }
+        for (size_t i = first; i < last; ++i) {
+            ds.input(i, std::span(ws.inputs().mem, ws.inputs().rows));
+            ds.ground_truth(i, ws.ground_truths.mem);
+            feedforward(ws);
+            backpropagate_errors(ws);
+            stats.nb_updates += apply_sgd_sparse(ws, learning_rate,
+                                                 nonzeros_[id]);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        stats.nb_samples += last - first;
+        stats.time += std::chrono::duration<double>(t2 - t1).count();
+    });
+    model_->refresh_half();
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::hogwild(bool enable) {
+    if (enable && dynamic_cast<SGD *>(optimize_) == nullptr) {
+        std::cerr << "error: the hogwild mode can only be used with SGD."
+                  << std::endl;
+        exit(1);
+    }
+    hogwild_ = enable;
+}
+
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::train(DataSet const &ds, size_t nb_epochs,
+                                         ftype learning_rate) {
+    bool async = hogwild_ && threads() > 1;
+    size_t nb_threads = async ? threads() : 1;
+    bool async_tracer = tracer_ && tracer_->async;
+    ThreadBudget::Lease lease(async ? Activity::Workers : Activity::Training,
+                              nb_threads);
+    ThreadBudget::BlasShare blas_share(nb_threads + async_tracer);
+
     if (tracer_) {
         tracer_->init(nb_epochs, ds.size(), learning_rate);
     }
+    if (async) {
+        hogwild_stats_.assign(threads(), HogwildStats{});
+        nonzeros_.resize(threads());
+    }
     for (size_t epoch = 0; epoch < nb_epochs; ++epoch) {
-        update(ds, learning_rate);
+        if (async) {
+            update_hogwild(ds, learning_rate);
+        } else {
+            update(ds, learning_rate);
+        }
         if (tracer_) {
             tracer_->trace(this, epoch);
         }
     }
+    thread_config_ = ThreadBudget::config();
+    if (tracer_) {
+        tracer_->flush();
+    }
 }
 
-void Trainer::train_minibatch(DataSet const &ds, size_t minibatch_size,
-                              size_t nb_epochs, ftype learning_rate,
-                              uint32_t seed) {
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+void BasicTrainer<Cost, Act, Opt>::train_minibatch(DataSet const &ds,
+                                                   size_t minibatch_size,
+                                                   size_t nb_epochs,
+                                                   ftype learning_rate,
+                                                   uint32_t seed) {
     assert(ds.size() >= minibatch_size);
-    MinibatchGenerator minibatch(ds, minibatch_size, seed);
+    MinibatchGenerator minibatch(ds, minibatch_size, seed, last_batch_);
+    std::unique_ptr<MinibatchPrefetcher> prefetcher = nullptr;
+    std::unique_ptr<CheckpointWriter> writer = nullptr;
+    size_t first_step = 0;
+    // the training thread and the pool, the producers and the background
+    // evaluations compete with the BLAS calls
+    bool async_tracer = tracer_ && tracer_->async;
+    ThreadBudget::Lease lease(
+        threads() > 1 ? Activity::Workers : Activity::Training, threads());
+    ThreadBudget::BlasShare blas_share(threads() + nb_prefetchers_ +
+                                       async_tracer);
 
+    if (resume_) {
+        if (!minibatch.restore(resume_->minibatch) ||
+            !model_->parameters().same_layout(resume_->model.parameters()) ||
+            !optimize_->restore_state(resume_->optimizer)) {
+            std::cerr << "error: the checkpoint does not match the training"
+                      << std::endl;
+            exit(1);
+        }
+        Precision half_precision = model_->half_precision();
+        *model_ = resume_->model;
+        model_->half_precision(half_precision);
+        first_step = resume_->step;
+        resume_ = nullptr;
+    }
+    if (checkpoint_interval_ > 0) {
+        writer = std::make_unique<CheckpointWriter>(checkpoint_path_);
+    }
+    if (nb_prefetchers_ > 0) {
+        prefetcher =
+            std::make_unique<MinibatchPrefetcher>(minibatch, nb_prefetchers_);
+    }
     if (tracer_) {
         tracer_->init(nb_epochs, minibatch_size, learning_rate);
     }
-    for (size_t epoch = 0; epoch < nb_epochs; ++epoch) {
-        minibatch.generate();
-        update_minibatch(minibatch, learning_rate);
+    for (size_t epoch = first_step; epoch < nb_epochs; ++epoch) {
+        if (prefetcher) {
+            PackedBatch const *batch = nullptr;
+            {
+                PhaseTimer timer(&profile_, Phase::Data);
+                batch = &prefetcher->next();
+                if (writer) {
+                    minibatch.generate(); // position of the checkpoints
+                }
+            }
+            if (threads() > 1) {
+                update_minibatch_parallel(*batch, learning_rate);
+            } else {
+                update_minibatch(*batch, learning_rate);
+            }
+        } else {
+            {
+                PhaseTimer timer(&profile_, Phase::Data);
+                minibatch.generate();
+            }
+            if (threads() > 1) {
+                update_minibatch_parallel(minibatch, learning_rate);
+            } else {
+                update_minibatch(minibatch, learning_rate);
+            }
+        }
+        if (writer && ((epoch + 1) % checkpoint_interval_ == 0 ||
+                       epoch + 1 == nb_epochs)) {
+            Checkpoint &checkpoint = writer->snapshot();
+            checkpoint.step = epoch + 1;
+            checkpoint.model = *model_;
+            optimize_->save_state(checkpoint.optimizer);
+            minibatch.save(checkpoint.minibatch);
+            writer->submit();
+        }
         if (tracer_) {
             tracer_->trace(this, epoch);
         }
     }
-}
-
-int Trainer::get_expected_label(Vector const &v) const {
-    int max_idx = 0;
-
-    for (size_t i = 0; i < v.size; ++i) {
-        if (v[i] > v[max_idx]) {
-            max_idx = i;
-        }
+    thread_config_ = ThreadBudget::config();
+    if (tracer_) {
+        tracer_->flush();
+    }
+    if (writer) {
+        writer->flush();
+    }
+    if (prefetcher) {
+        prefetch_stats_ = prefetcher->stats();
     }
-    return max_idx;
 }
 
-ftype Trainer::evaluate_cost(DataSet const &ds) const {
-    ftype cost_sum = 0;
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+bool BasicTrainer<Cost, Act, Opt>::resume(std::string const &path) {
+    auto checkpoint = std::make_shared<Checkpoint>();
 
-    for (auto const &elt : ds) {
-        auto [as, zs] = feedforward(elt.input);
-        auto costs = cost(elt.ground_truth, as.back());
-        cost_sum += std::accumulate(costs.mem, costs.mem + costs.size, 0.0) /
-                    costs.size;
+    if (!load_checkpoint(path, *checkpoint)) {
+        return false;
     }
-    return cost_sum / ds.size();
+    resume_ = checkpoint;
+    return true;
 }
 
-ftype Trainer::evaluate_accuracy(DataSet const &ds) const {
-    size_t count_valid = 0;
-
-    for (auto const &elt : ds) {
-        auto [as, zs] = feedforward(elt.input);
-        int found = get_expected_label(as.back());
-        int expected = get_expected_label(elt.ground_truth);
-        if (found == expected) {
-            ++count_valid;
-        }
-    }
-    return 100 * ((ftype)count_valid / (ftype)ds.size());
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+BasicEvaluator<Cost, Act> BasicTrainer<Cost, Act, Opt>::evaluator() const {
+    return BasicEvaluator<Cost, Act>(model_, cost_, activation_, pool_.get());
 }
 
-std::pair<ftype, ftype> Trainer::evaluate(DataSet const &ds) const {
-    size_t count_valid = 0;
-    ftype cost_sum = 0;
-    ftype avg_cost = 0;
-    ftype accuracy = 0;
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+ftype BasicTrainer<Cost, Act, Opt>::evaluate_cost(DataSet const &ds) const {
+    return evaluate(ds).first;
+}
 
-    for (auto const &elt : ds) {
-        auto [as, zs] = feedforward(elt.input);
-        auto costs = cost(elt.ground_truth, as.back());
-        int found = get_expected_label(as.back());
-        int expected = get_expected_label(elt.ground_truth);
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+ftype BasicTrainer<Cost, Act, Opt>::evaluate_accuracy(DataSet const &ds) const {
+    return evaluate(ds).second;
+}
 
-        if (found == expected) {
-            ++count_valid;
-        }
-        cost_sum += std::accumulate(costs.mem, costs.mem + costs.size, 0.0) /
-                    costs.size;
-    }
-    avg_cost = cost_sum / (ftype)ds.size();
-    accuracy = 100 * ((ftype)count_valid / (ftype)ds.size());
-    return {avg_cost, accuracy};
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+std::pair<ftype, ftype>
+BasicTrainer<Cost, Act, Opt>::evaluate(DataSet const &ds) const {
+    return evaluator().evaluate(ds);
 }
+
+template class BasicTrainer<CostFunction, ActivationFunction, OptimizeFunction>;
+template class BasicTrainer<QuadraticLoss, Sigmoid, SGD>;
+template class BasicTrainer<QuadraticLoss, Sigmoid, Adam>;
@@ -1,18 +1,41 @@
 #ifndef TRAINER_H
 #define TRAINER_H
+#include "checkpoint.hpp"
+#include "evaluator.hpp"
 #include "functions.hpp"
 #include "minibatch_generator.hpp"
 #include "model.hpp"
+#include "prefetcher.hpp"
+#include "profiler.hpp"
+#include "thread_budget.hpp"
+#include "thread_pool.hpp"
 #include "types.hpp"
+#include "workspace.hpp"
 #include <cassert>
-#include <cblas.h>
+#include <memory>
+#include <string>
 
 struct Tracer;
 
-class Trainer {
+/* statistics of one thread of the hogwild mode */
+struct HogwildStats {
+    size_t nb_samples = 0;
+    size_t nb_updates = 0; // number of parameters updated
+    double time = 0;       // seconds
+};
+
+/*
+ * The trainer is specialized on the cost, activation and optimize function
+ * types. With the concrete (final) types, the function calls in the hot loops
+ * are resolved at compile time. The Trainer alias uses the interfaces and
+ * keeps the runtime polymorphism for dynamic configurations.
+ */
+template <CostFunctionType Cost, ActivationFunctionType Act,
+          OptimizeFunctionType Opt>
+class BasicTrainer {
   public:
-    Trainer(Model *model, auto cost, auto activation, auto optimize,
-            Tracer *tracer = nullptr)
+    BasicTrainer(Model *model, Cost *cost, Act *activation, Opt *optimize,
+                 Tracer *tracer = nullptr)
         : model_(model), cost_(cost), activation_(activation),
           optimize_(optimize), tracer_(tracer) {}
 
@@ -25,16 +48,27 @@ class Trainer {
     Vector cost_prime(Vector const &ground_truth, Vector const &y) const;
 
     std::pair<Vectors, Vectors> feedforward(Vector const &input) const;
-    std::pair<GradW, GradB> backpropagate(Vector const &ground_truth,
-                                          Vectors const &as,
-                                          Vectors const &zs) const;
+    Parameters backpropagate(Vector const &ground_truth, Vectors const &as,
+                             Vectors const &zs) const;
+
+    /* batched versions: the samples are stored in the columns of the
+     * workspace matrices and no memory is allocated */
+    void compute_z(Layer const &layer, Matrix const &as, Matrix &zs) const;
+    void feedforward(TrainingWorkspace &ws) const;
+    void backpropagate_errors(TrainingWorkspace &ws) const;
+    void backpropagate(TrainingWorkspace &ws) const;
 
     void update_minibatch(MinibatchGenerator const &minibatch,
                           ftype learning_rate);
+    void update_minibatch_parallel(MinibatchGenerator const &minibatch,
+                                   ftype learning_rate);
+    void update_minibatch(PackedBatch const &batch, ftype learning_rate);
+    void update_minibatch_parallel(PackedBatch const &batch,
+                                   ftype learning_rate);
     void update(DataSet const &ds, ftype learning_rate);
+    void update_hogwild(DataSet const &ds, ftype learning_rate);
 
-    void optimize(GradW const &grads_w, GradB const &grads_b,
-                  ftype learning_rate);
+    void optimize(Parameters const &grads, ftype learning_rate);
 
     void train(DataSet const &ds, size_t nb_epochs, ftype learning_rate);
     void train_minibatch(DataSet const &ds, size_t minibatch_size,
@@ -47,16 +81,93 @@ class Trainer {
 
   private:
     Model *model_ = nullptr;
-    CostFunction *cost_ = nullptr;
-    ActivationFunction *activation_ = nullptr;
-    OptimizeFunction *optimize_ = nullptr;
+    Cost *cost_ = nullptr;
+    Act *activation_ = nullptr;
+    Opt *optimize_ = nullptr;
     Tracer *tracer_ = nullptr;
+    TrainingWorkspace workspace_ = {};
+    std::shared_ptr<ThreadPool> pool_ = nullptr;
+    std::vector<TrainingWorkspace> workspaces_ = {};
+    bool hogwild_ = false;
+    std::vector<HogwildStats> hogwild_stats_ = {};
+    std::vector<std::vector<size_t>> nonzeros_ = {};
+    LastBatch last_batch_ = LastBatch::Partial;
+    size_t nb_prefetchers_ = 0;
+    PrefetchStats prefetch_stats_ = {};
+    std::string checkpoint_path_ = {};
+    size_t checkpoint_interval_ = 0;
+    std::shared_ptr<Checkpoint> resume_ = nullptr;
+    PhaseProfile profile_ = {};
+    ThreadConfig thread_config_ = {};
 
   public:
     void tracer(Tracer *tracer) { tracer_ = tracer; }
+    Model const *model() const { return model_; }
+
+    /* Number of threads used to train on a minibatch. The minibatch is split
+     * in contiguous slices (one per thread) and the gradients are reduced in
+     * a fixed order, so the result only depends on the number of threads.
+     * The evaluation functions use the same threads. */
+    void threads(size_t nb_threads);
+    size_t threads() const { return pool_ ? pool_->size() : 1; }
+
+    /* Asynchronous lock-free SGD for the online training (train). Each thread
+     * updates the model on its own shard of the dataset. Requires SGD and
+     * more than one thread. */
+    void hogwild(bool enable);
+    std::vector<HogwildStats> const &hogwild_stats() const {
+        return hogwild_stats_;
+    }
+
+    /* policy for the last samples of the epochs in train_minibatch */
+    void last_batch(LastBatch policy) { last_batch_ = policy; }
+
+    /* Number of producer threads that prepare the next minibatches of
+     * train_minibatch in the background (0: the minibatches are prepared by
+     * the training thread). The sequence of minibatches does not change. */
+    void prefetch(size_t nb_producers) { nb_prefetchers_ = nb_producers; }
+    PrefetchStats const &prefetch_stats() const { return prefetch_stats_; }
+
+    /* Checkpoints of train_minibatch: every interval minibatches (and after
+     * the last one), the model, the optimizer state and the position of the
+     * minibatch generator are copied in memory and written to path by a
+     * background thread. interval 0 disables the checkpoints. */
+    void checkpoint(std::string const &path, size_t interval) {
+        checkpoint_path_ = path;
+        checkpoint_interval_ = interval;
+    }
+
+    /* The next train_minibatch continues the run saved in the checkpoint
+     * path: it starts at the saved step, with the same dataset, minibatch
+     * size and number of steps as the saved run. Returns false when the file
+     * can't be loaded. */
+    bool resume(std::string const &path);
+
+    /* Time of the phases of the training steps (data, forward, backward
+     * and optimizer) since the last reset. The tracer resets it at every
+     * trace. The timers are compiled with NN_PROFILE, and the hogwild mode
+     * is not profiled. */
+    PhaseProfile &profile() { return profile_; }
+    PhaseProfile const &profile() const { return profile_; }
+
+    /* distribution of the threads at the end of the last training (see
+     * ThreadBudget) */
+    ThreadConfig const &thread_config() const { return thread_config_; }
+
+    BasicEvaluator<Cost, Act> evaluator() const;
 
   private:
-    int get_expected_label(Vector const &v) const;
+    template <typename Batch>
+    void update_batch(Batch const &batch, ftype learning_rate);
+    template <typename Batch>
+    void update_batch_parallel(Batch const &batch, ftype learning_rate);
+    TrainingWorkspace &workspace(size_t batch_size);
+    void reduce_gradients(size_t nb_workspaces);
+    size_t apply_sgd_sparse(TrainingWorkspace &ws, ftype learning_rate,
+                            std::vector<size_t> &nonzeros);
 };
 
+using Trainer =
+    BasicTrainer<CostFunction, ActivationFunction, OptimizeFunction>;
+
 #endif
@@ -1,15 +1,10 @@
 #ifndef TYPES_H
 #define TYPES_H
+#include "dataset.hpp"
 #include "math.hpp"
 #include <vector>
 
 using Vectors = std::vector<Vector>;
-
-struct DataSetEntry {
-    Vector input;
-    Vector ground_truth;
-};
-
-using DataSet = std::vector<DataSetEntry>;
+using Matrices = std::vector<Matrix>;
 
 #endif
@@ -0,0 +1,90 @@
+#include "workspace.hpp"
+#include <cassert>
+#include <memory>
+
+void TrainingWorkspace::init(Model const &model, size_t capacity) {
+    constexpr size_t PADDING = Allocator::ALIGNMENT / sizeof(ftype);
+    size_t L = model.layers.size();
+    std::vector<Matrix *> matrices;
+    std::vector<size_t> rows;
+
+    assert(L > 0);
+    as.resize(L + 1);
+    zs.resize(L);
+    errs.resize(L);
+    grads = Parameters::zeros_like(model.parameters());
+
+    matrices.push_back(&ground_truths);
+    rows.push_back(model.layers.back().nb_nodes);
+    matrices.push_back(&as[0]);
+    rows.push_back(model.layers.front().nb_inputs);
+    for (size_t l = 0; l < L; ++l) {
+        for (Matrix *m : {&as[l + 1], &zs[l], &errs[l]}) {
+            matrices.push_back(m);
+            rows.push_back(model.layers[l].nb_nodes);
+        }
+    }
+
+    // each matrix starts on an aligned offset of the buffer
+    std::vector<size_t> offsets;
+    size_t size = 0;
+    for (size_t r : rows) {
+        offsets.push_back(size);
+        size += (r * capacity + PADDING - 1) / PADDING * PADDING;
+    }
+    // assigning to a view would copy into it, so the matrices are rebuilt
+    buffer_ = Matrix(1, size);
+    for (size_t i = 0; i < matrices.size(); ++i) {
+        std::destroy_at(matrices[i]);
+        std::construct_at(matrices[i], Matrix::view(buffer_.mem + offsets[i],
+                                                    rows[i], capacity));
+    }
+    this->capacity = capacity;
+    this->batch_size = capacity;
+}
+
+TrainingWorkspace::TrainingWorkspace(TrainingWorkspace const &other)
+    : batch_size(other.batch_size), capacity(other.capacity),
+      as(other.as.size()), zs(other.zs.size()), errs(other.errs.size()),
+      grads(other.grads), buffer_(other.buffer_) {
+    // the views point at the same offsets in the copy of the buffer
+    auto rebind = [&](Matrix &m, Matrix const &src) {
+        m = Matrix::view(buffer_.mem + (src.mem - other.buffer_.mem), src.rows,
+                         src.cols);
+    };
+    rebind(ground_truths, other.ground_truths);
+    for (size_t l = 0; l < as.size(); ++l) {
+        rebind(as[l], other.as[l]);
+    }
+    for (size_t l = 0; l < zs.size(); ++l) {
+        rebind(zs[l], other.zs[l]);
+        rebind(errs[l], other.errs[l]);
+    }
+}
+
+bool TrainingWorkspace::fits(Model const &model, size_t batch_size) const {
+    return batch_size <= capacity && grads.same_layout(model.parameters());
+}
+
+void TrainingWorkspace::resize(size_t batch_size) {
+    assert(batch_size <= capacity);
+    if (batch_size == this->batch_size) {
+        return;
+    }
+    ground_truths.cols = batch_size;
+    for (Matrices *matrices : {&as, &zs, &errs}) {
+        for (Matrix &m : *matrices) {
+            m.cols = batch_size;
+        }
+    }
+    this->batch_size = batch_size;
+}
+
+bool TrainingWorkspace::reserve(Model const &model, size_t batch_size) {
+    if (!fits(model, batch_size)) [[unlikely]] {
+        init(model, batch_size);
+        return true;
+    }
+    resize(batch_size);
+    return false;
+}
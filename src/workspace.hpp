@@ -0,0 +1,45 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+#include "math.hpp"
+#include "model.hpp"
+#include "types.hpp"
+
+/*
+ * Buffers used during one training step. The workspace is sized once from the
+ * model layers and a maximum batch size (capacity), and then reused for every
+ * step so the training loop does not allocate. The samples are stored in the
+ * columns of the matrices, which are views on one buffer: resizing the
+ * workspace for a smaller batch (ex: the last one of an epoch) only changes
+ * their number of columns.
+ */
+struct TrainingWorkspace {
+    size_t batch_size = 0;     // current number of samples
+    size_t capacity = 0;       // maximum number of samples
+    Matrix ground_truths = {}; // (outputs x batch)
+    Matrices as = {};          // as[0] is the input, as[l + 1] = act(zs[l])
+    Matrices zs = {};          // act_prime(zs) after the feedforward
+    Matrices errs = {};        // (nodes x batch) for each layer
+    Parameters grads = {};     // layout of the model parameters
+
+    TrainingWorkspace() = default;
+    TrainingWorkspace(Model const &model, size_t batch_size) {
+        init(model, batch_size);
+    }
+    TrainingWorkspace(TrainingWorkspace const &other);
+    TrainingWorkspace(TrainingWorkspace &&) = default;
+
+    void init(Model const &model, size_t capacity);
+    bool fits(Model const &model, size_t batch_size) const;
+    void resize(size_t batch_size);
+    /* resize the workspace for batch_size samples, or init it if it does not
+     * fit, returns true when the buffers are reallocated */
+    bool reserve(Model const &model, size_t batch_size);
+
+    Matrix &inputs() { return as.front(); }
+    Matrix const &outputs() const { return as.back(); }
+
+  private:
+    Matrix buffer_ = {};
+};
+
+#endif